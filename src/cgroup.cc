@@ -20,14 +20,27 @@
 // THE SOFTWARE.
 ////////////////////////////////////////////////////////////////////////////////
 
+#include <climits>
+#include <cstddef>
 #include <cstdio>
 #include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <atomic>
+#include <mutex>
 #include <list>
 #include <dirent.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sched.h>
 #include <signal.h>
+#include <stdint.h>
+#include <linux/bpf.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
 #include <sys/mount.h>
+#include <sys/personality.h>
 #include <sys/prctl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -38,7 +51,10 @@
 #include "cgroup.h"
 #include "utils/linux_only.h"
 #include "utils/for_each.h"
+#include "utils/fdpass.h"
 #include "utils/fs.h"
+#include "utils/now.h"
+#include "utils/pidfd.h"
 #include "utils/strconv.h"
 
 
@@ -47,11 +63,14 @@ using namespace lrun;
 using std::string;
 using std::list;
 
-const char Cgroup::subsys_names[4][8] = {
+const char Cgroup::subsys_names[7][8] = {
     "cpuacct",
     "memory",
     "devices",
     "freezer",
+    "pids",
+    "cpu",
+    "cpuset",
 };
 
 static struct {
@@ -66,7 +85,122 @@ static struct {
     {"urandom", 9},
 };
 
+static const struct {
+    Cgroup::subsys_id_t subsys_id;
+    const char *name[2];  // v1, v2. NULL: not available
+    int flags;
+} counter_files[] = {
+    {Cgroup::CG_CPUACCT, {"cpuacct.usage", "cpu.stat"}, O_RDONLY},
+    {Cgroup::CG_MEMORY, {"memory.memsw.usage_in_bytes", NULL}, O_RDONLY},
+    {Cgroup::CG_MEMORY, {"memory.usage_in_bytes", "memory.current"}, O_RDONLY},
+    {Cgroup::CG_MEMORY, {"memory.memsw.max_usage_in_bytes", NULL}, O_RDONLY},
+    // memory.peak can be reset by writing to the fd (Linux >= 6.12)
+    {Cgroup::CG_MEMORY, {"memory.max_usage_in_bytes", "memory.peak"}, O_RDWR},
+    {Cgroup::CG_MEMORY, {"memory.stat", "memory.stat"}, O_RDONLY},
+    {Cgroup::CG_CPUACCT, {NULL, "cpu.pressure"}, O_RDONLY},
+    {Cgroup::CG_MEMORY, {NULL, "memory.pressure"}, O_RDONLY},
+    {Cgroup::CG_MEMORY, {NULL, "io.pressure"}, O_RDONLY},
+    {Cgroup::CG_MEMORY, {NULL, "memory.swap.current"}, O_RDONLY},
+    {Cgroup::CG_PIDS, {"pids.current", "pids.current"}, O_RDONLY},
+    {Cgroup::CG_PIDS, {"pids.events", "pids.events"}, O_RDONLY},
+};
+
+// v2 controllers to enable
+static const char * const unified_controllers[] = {
+    "cpu",
+    "memory",
+    "pids",
+    "cpuset",
+};
+
+// check if a comma or space separated list, like mount options or
+// cgroup.subtree_control, has a word. "cpu" does not match "cpuacct"
+static bool has_word(const string& list, const char *word) {
+    size_t len = strlen(word);
+    for (size_t pos = list.find(word); pos != string::npos; pos = list.find(word, pos + 1)) {
+        bool start = (pos == 0 || strchr(", \n", list[pos - 1]));
+        bool end = (pos + len == list.length() || strchr(", \n", list[pos + len]));
+        if (start && end) return true;
+    }
+    return false;
+}
+
 std::string Cgroup::subsys_base_paths_[sizeof(subsys_names) / sizeof(subsys_names[0])];
+int Cgroup::version_ = 0;
+int Cgroup::subsys_available_[SUBSYS_COUNT];
+
+// set by Cgroup::init, the caches above are read-only after that
+static bool caches_initialized = false;
+
+int Cgroup::version() {
+    if (version_) return version_;
+
+    std::map<string, fs::MountEntry> mounts = fs::get_mounts();
+    int v1_mounted = 0;
+    string unified_path;
+    FOR_EACH_CONST(p, mounts) {
+        const fs::MountEntry& ent = p.second;
+        if (ent.type == string(fs::TYPE_CGROUP)) {
+            for (int id = 0; id < SUBSYS_COUNT; ++id) {
+                if (has_word(ent.opts, subsys_names[id])) v1_mounted |= (1 << id);
+            }
+        } else if (ent.type == string(fs::TYPE_CGROUP2) && unified_path.empty()) {
+            unified_path = ent.dir;
+        }
+    }
+
+    // prefer v1 if it is fully usable, it is the most tested one.
+    // if nothing is mounted, v1 is also used and base_path will mount it.
+    version_ = 1;
+    int required = (1 << REQUIRED_SUBSYS_COUNT) - 1;
+    if ((v1_mounted & required) != required && !unified_path.empty()) {
+        string controllers = fs::read(unified_path + "/cgroup.controllers");
+        if (controllers.find("memory") != string::npos) version_ = 2;
+    }
+    INFO("cgroup version = %d", version_);
+
+    return version_;
+}
+
+// whether a cgroup has a directory for the subsystem. v2 only has one,
+// the one of id 0. optional v1 subsystems are only used if asked for
+static bool has_directory(int id, int optional_subsys) {
+    if (Cgroup::version() == 2) return id == 0;
+    if (id >= Cgroup::REQUIRED_SUBSYS_COUNT && !(optional_subsys & (1 << id))) return false;
+    return Cgroup::subsys_available((Cgroup::subsys_id_t)id);
+}
+
+static string unified_base_path(bool create_on_need) {
+    string mnt;
+    std::map<string, fs::MountEntry> mounts = fs::get_mounts();
+    FOR_EACH_CONST(p, mounts) {
+        if (p.second.type == string(fs::TYPE_CGROUP2)) {
+            mnt = p.second.dir;
+            break;
+        }
+    }
+    if (mnt.empty()) return "";
+
+    // put all lrun cgroups in a "lrun" directory
+    string path = mnt + "/lrun";
+    if (!fs::is_dir(path)) {
+        if (!create_on_need) return "";
+        INFO("mkdir '%s'", path.c_str());
+        if (mkdir(path.c_str(), 0700)) FATAL("can not mkdir '%s'", path.c_str());
+    }
+
+    // controllers must be enabled in parents' subtree_control
+    for (size_t i = 0; i < sizeof(unified_controllers) / sizeof(unified_controllers[0]); ++i) {
+        string value = string("+") + unified_controllers[i];
+        if (fs::write(mnt + "/cgroup.subtree_control", value)
+            || fs::write(path + "/cgroup.subtree_control", value)) {
+            WARNING("can not enable cgroup controller %s", unified_controllers[i]);
+        }
+    }
+
+    INFO("cgroup v2 path = '%s'", path.c_str());
+    return path;
+}
 
 int Cgroup::subsys_id_from_name(const char * const name) {
     for (size_t i = 0; i < sizeof(Cgroup::subsys_names) / sizeof(Cgroup::subsys_names[0]); ++i) {
@@ -75,7 +209,26 @@ int Cgroup::subsys_id_from_name(const char * const name) {
     return -1;
 }
 
+bool Cgroup::subsys_available(subsys_id_t subsys_id) {
+    if (subsys_id < REQUIRED_SUBSYS_COUNT) return true;
+
+    int& result = subsys_available_[subsys_id];
+    if (result == 0) {
+        // optional v1 subsystems are not mounted by base_path
+        string path = base_path(subsys_id);
+        bool ok = !path.empty();
+        // v2 children get controllers listed in parent's subtree_control
+        if (ok && version() == 2) ok = has_word(fs::read(path + "/cgroup.subtree_control"), subsys_names[subsys_id]);
+        INFO("cgroup %s is %savailable", subsys_names[subsys_id], ok ? "" : "not ");
+        result = ok ? 2 : 1;
+    }
+    return result == 2;
+}
+
 string Cgroup::base_path(subsys_id_t subsys_id, bool create_on_need) {
+    // filled by init(), do not check or change it from now on
+    if (caches_initialized) return subsys_base_paths_[subsys_id];
+
     {
         // FIXME cache may not work when user manually umount cgroup
         // check last cached path
@@ -83,6 +236,12 @@ string Cgroup::base_path(subsys_id_t subsys_id, bool create_on_need) {
         if ((!path.empty()) && fs::is_dir(path)) return path;
     }
 
+    if (version() == 2) {
+        string path = unified_base_path(create_on_need);
+        for (int id = 0; id < SUBSYS_COUNT; ++id) subsys_base_paths_[id] = path;
+        return path;
+    }
+
     const char * const MNT_SRC_NAME = "cgroup_lrun";
     const char * MNT_DEST_BASE_PATH = "/sys/fs/cgroup";
     const char * subsys_name = subsys_names[subsys_id];
@@ -91,14 +250,14 @@ string Cgroup::base_path(subsys_id_t subsys_id, bool create_on_need) {
     FOR_EACH_CONST(p, mounts) {
         const fs::MountEntry& ent = p.second;
         if (ent.type != string(fs::TYPE_CGROUP)) continue;
-        if (strstr(ent.opts.c_str(), subsys_name)) {
+        if (has_word(ent.opts, subsys_name)) {
             INFO("cgroup %s path = '%s'", subsys_name, ent.dir.c_str());
             return (subsys_base_paths_[subsys_id] = string(ent.dir));
         }
     }
 
-    // no cgroups mounted, prepare one
-    if (!create_on_need) return "";
+    // no cgroups mounted, prepare one. optional ones are not mounted
+    if (!create_on_need || subsys_id >= REQUIRED_SUBSYS_COUNT) return "";
 
     if (!fs::is_dir(MNT_DEST_BASE_PATH)) {
         // no /sys/fs/cgroup in system, try conservative location
@@ -134,6 +293,21 @@ string Cgroup::base_path(subsys_id_t subsys_id, bool create_on_need) {
     return (subsys_base_paths_[subsys_id] = dest_path);
 }
 
+static void fill_caches() {
+    if (Cgroup::version() <= 0) return;
+    for (int id = 0; id < Cgroup::REQUIRED_SUBSYS_COUNT; ++id) {
+        if (Cgroup::base_path((Cgroup::subsys_id_t)id).empty()) return;
+    }
+    for (int id = Cgroup::REQUIRED_SUBSYS_COUNT; id < Cgroup::SUBSYS_COUNT; ++id) Cgroup::subsys_available((Cgroup::subsys_id_t)id);
+    caches_initialized = true;
+}
+
+int Cgroup::init() {
+    static std::once_flag once;
+    std::call_once(once, fill_caches);
+    return caches_initialized ? 0 : -1;
+}
+
 string Cgroup::path_from_name(subsys_id_t subsys_id, const string& name) {
     return base_path(subsys_id) + "/" + name;
 }
@@ -143,24 +317,37 @@ string Cgroup::subsys_path(Cgroup::subsys_id_t subsys_id) const {
 }
 
 
-int Cgroup::exists(const string& name) {
+bool Cgroup::has_directory(int subsys_id) const {
+    return ::has_directory(subsys_id, optional_subsys_);
+}
+
+bool Cgroup::has_subsys(subsys_id_t subsys_id) const {
+    if (version() == 1) return has_directory(subsys_id);
+    return subsys_available(subsys_id);
+}
+
+int Cgroup::exists(const string& name, int optional_subsys) {
     for (int id = 0; id < SUBSYS_COUNT; ++id) {
+        if (!::has_directory(id, optional_subsys)) continue;
         if (!fs::is_dir(path_from_name((subsys_id_t)(id), name))) return false;
     }
     return true;
 }
 
-Cgroup Cgroup::create(const string& name) {
+Cgroup Cgroup::create(const string& name, int optional_subsys) {
     Cgroup cg;
+    cg.optional_subsys_ = optional_subsys;
 
-    if (exists(name)) {
+    if (exists(name, optional_subsys)) {
         INFO("create cgroup '%s': already exists", name.c_str());
         cg.name_ = name;
+        if (cg.open_fds()) cg.name_.clear();
         return cg;
     }
 
     int success = 1;
     for (int id = 0; id < SUBSYS_COUNT; ++id) {
+        if (!::has_directory(id, optional_subsys)) continue;
         string path = path_from_name((subsys_id_t)id, name);
         if (fs::is_dir(path)) continue;
         if (mkdir(path.c_str(), 0700)) {
@@ -170,25 +357,148 @@ Cgroup Cgroup::create(const string& name) {
         }
     }
 
-    if (success) cg.name_ = name;
-    cg.init_pid_ = 0;
+    if (success) {
+        cg.name_ = name;
+        if (cg.open_fds()) cg.name_.clear();
+        // a new v1 cpuset has no cpus and mems, tasks can not be attached
+        else if (version() == 1 && cg.has_subsys(CG_CPUSET)) cg.set_cpuset("", "");
+    }
 
     return cg;
 }
 
-Cgroup::Cgroup() { }
+Cgroup::Cgroup() : init_pid_(0), init_pidfd_(-1), child_pidfd_(-1), kill_pending_(false), zygote_pid_(-1), zygote_sock_(-1), zygote_init_pidfd_(-1), zygote_report_(NULL), cpu_usage_base_(NULL), oom_count_base_(0), optional_subsys_(0) {
+    memset(&spawn_report_, 0, sizeof spawn_report_);
+    spawn_report_.failed_step = -1;
+    for (int id = 0; id < SUBSYS_COUNT; ++id) subsys_fds_[id] = -1;
+    for (int i = 0; i < COUNTER_COUNT; ++i) counter_fds_[i] = -1;
+
+    if (version() == 2) {
+        void *p = mmap(NULL, sizeof(*cpu_usage_base_), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (p != MAP_FAILED) cpu_usage_base_ = (long long *)p;
+    }
+}
+
+Cgroup::Cgroup(Cgroup&& other) :
+    name_(other.name_), output_counter_(other.output_counter_), init_pid_(other.init_pid_),
+    init_pidfd_(other.init_pidfd_), child_pidfd_(other.child_pidfd_), kill_pending_(other.kill_pending_),
+    zygote_pid_(other.zygote_pid_), zygote_sock_(other.zygote_sock_), zygote_init_pidfd_(other.zygote_init_pidfd_),
+    zygote_report_(other.zygote_report_),
+    cpu_usage_base_(other.cpu_usage_base_), oom_count_base_(other.oom_count_base_),
+    optional_subsys_(other.optional_subsys_) {
+    spawn_report_ = other.spawn_report_;
+    other.init_pidfd_ = -1;
+    other.child_pidfd_ = -1;
+    other.zygote_pid_ = -1;
+    other.zygote_sock_ = -1;
+    other.zygote_init_pidfd_ = -1;
+    other.zygote_report_ = NULL;
+    other.cpu_usage_base_ = NULL;
+    // take over fds
+    for (int id = 0; id < SUBSYS_COUNT; ++id) {
+        subsys_fds_[id] = other.subsys_fds_[id];
+        other.subsys_fds_[id] = -1;
+    }
+    for (int i = 0; i < COUNTER_COUNT; ++i) {
+        counter_fds_[i] = other.counter_fds_[i];
+        other.counter_fds_[i] = -1;
+    }
+}
+
+Cgroup::~Cgroup() {
+    close_fds();
+    stop_zygote();
+    if (cpu_usage_base_) munmap(cpu_usage_base_, sizeof(*cpu_usage_base_));
+}
+
+int Cgroup::open_fds() {
+    close_fds();
+    for (int id = 0; id < SUBSYS_COUNT; ++id) {
+        if (!has_directory(id)) continue;
+        string path = subsys_path((subsys_id_t)id);
+        subsys_fds_[id] = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (subsys_fds_[id] < 0) {
+            ERROR("can not open '%s'", path.c_str());
+            close_fds();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void Cgroup::close_fds() {
+    for (int id = 0; id < SUBSYS_COUNT; ++id) {
+        if (subsys_fds_[id] >= 0) close(subsys_fds_[id]);
+        subsys_fds_[id] = -1;
+    }
+    for (int i = 0; i < COUNTER_COUNT; ++i) {
+        if (counter_fds_[i] >= 0) close(counter_fds_[i]);
+        counter_fds_[i] = -1;
+    }
+    // a dead init is a zombie until reaped, a library user may create many
+    if (init_pidfd_ >= 0) {
+        pidfd::reap(init_pidfd_);
+        close(init_pidfd_);
+    }
+    init_pidfd_ = -1;
+    if (child_pidfd_ >= 0) close(child_pidfd_);
+    child_pidfd_ = -1;
+}
+
+int Cgroup::subsys_fd(subsys_id_t subsys_id) const {
+    // v2 only has one directory
+    return subsys_fds_[version() == 2 ? 0 : subsys_id];
+}
+
+int Cgroup::open_property(subsys_id_t subsys_id, const char *property, int flags) const {
+    int dirfd = subsys_fd(subsys_id);
+    if (dirfd < 0) return -1;
+    return openat(dirfd, property, flags | O_CLOEXEC);
+}
+
+ssize_t Cgroup::read_counter(counter_id_t counter_id, char *buf, size_t size) const {
+    int& fd = counter_fds_[counter_id];
+    if (fd == -1) {
+        const char *name = counter_files[counter_id].name[version() - 1];
+        fd = name ? open_property(counter_files[counter_id].subsys_id, name, counter_files[counter_id].flags) : -1;
+        // do not retry files not supported by kernel, like memsw
+        if (fd < 0) fd = -2;
+    }
+    if (fd < 0) return -1;
+
+    // cgroup files are regenerated when read from offset 0
+    ssize_t len = pread(fd, buf, size - 1, 0);
+    buf[len > 0 ? len : 0] = '\0';
+    return len;
+}
+
+long long Cgroup::counter_value(counter_id_t counter_id) const {
+    char buf[32];
+    if (read_counter(counter_id, buf, sizeof buf) <= 0) return -1;
+    return strtoll(buf, NULL, 10);
+}
 
 bool Cgroup::valid() const {
-    return !name_.empty() && exists(name_);
+    if (name_.empty()) return false;
+
+    // a removed cgroup directory has no entries, even if it is still opened
+    for (int id = 0; id < SUBSYS_COUNT; ++id) {
+        if (!has_directory(id)) continue;
+        if (subsys_fds_[id] < 0 || faccessat(subsys_fds_[id], "cgroup.procs", F_OK, 0)) return false;
+    }
+    return true;
 }
 
 void Cgroup::update_output_count() {
-    if (!valid()) return;
-    string procs_path = subsys_path(CG_FREEZER) + "/cgroup.procs";
+    if (!valid() || empty()) return;
 
-    if (fs::read(procs_path, 4).empty()) return;
+    int procs_fd = open_property(CG_FREEZER, "cgroup.procs", O_RDONLY);
+    FILE * procs = procs_fd < 0 ? NULL : fdopen(procs_fd, "r");
+    if (!procs) {
+        if (procs_fd >= 0) close(procs_fd);
+        return;
+    }
 
-    FILE * procs = fopen(procs_path.c_str(), "r");
     char spid[26]; // sizeof(pid_t) * 3 + 2, assuming sizeof(pid_t) is 8
     while (fscanf(procs, "%25s", spid) == 1) {
         unsigned long pid;
@@ -215,10 +525,11 @@ long long Cgroup::output_usage() const {
 }
 
 list<pid_t> Cgroup::get_pids() {
-    string procs_path = subsys_path(CG_FREEZER) + "/cgroup.procs";
-    FILE * procs = fopen(procs_path.c_str(), "r");
+    int procs_fd = open_property(CG_FREEZER, "cgroup.procs", O_RDONLY);
+    FILE * procs = procs_fd < 0 ? NULL : fdopen(procs_fd, "r");
     list<pid_t> pids;
 
+    if (!procs && procs_fd >= 0) close(procs_fd);
     if (procs) {
         unsigned long pid;
         while (fscanf(procs, "%lu", &pid) == 1) pids.push_back((pid_t)pid);
@@ -227,6 +538,39 @@ list<pid_t> Cgroup::get_pids() {
     return pids;
 }
 
+string Cgroup::identity() const {
+    string result;
+    for (int id = 0; id < SUBSYS_COUNT; ++id) {
+        if (!has_directory(id)) continue;
+        struct stat st;
+        if (subsys_fds_[id] < 0 || fstat(subsys_fds_[id], &st)) return "";
+        result += strconv::from_ulong((unsigned long)st.st_ino) + " ";
+    }
+    return result;
+}
+
+int Cgroup::thread_count() const {
+    // pids.current is an open counter fd, if the pids cgroup is used
+    long long pids = pids_current();
+    if (pids >= 0) return (int)pids;
+
+    // one tid per line, stop at THREAD_COUNT_MAX so a fork bomb does not
+    // make every checkpoint slow
+    int tasks_fd = open_property(CG_CPUACCT, version() == 2 ? "cgroup.threads" : "tasks", O_RDONLY);
+    if (tasks_fd < 0) return 0;
+
+    int count = 0;
+    char buf[4096];
+    ssize_t len;
+    while (count < THREAD_COUNT_MAX && (len = read(tasks_fd, buf, sizeof buf)) > 0) {
+        for (ssize_t i = 0; i < len; ++i) {
+            if (buf[i] == '\n') ++count;
+        }
+    }
+    close(tasks_fd);
+    return count < THREAD_COUNT_MAX ? count : THREAD_COUNT_MAX;
+}
+
 bool Cgroup::has_pid(pid_t pid) {
     bool result = false;
 
@@ -239,6 +583,18 @@ bool Cgroup::has_pid(pid_t pid) {
     char *line = NULL;
     char buf[64];  // FIXME cgroup name is 63 chars long
     while (getline(&line, &len, fp) != -1) {
+        if (version() == 2) {
+            // the line should look like:
+            // 0::/lrun/cgname
+            // the path is relative to the mount point, the parent of
+            // base_path. compare the directories instead of names
+            if (strncmp(line, "0::", 3) != 0) continue;
+            string path = fs::dirname(base_path(CG_CPUACCT)) + string(line + 3, strcspn(line + 3, "\n"));
+            struct stat st, cg_st;
+            result = stat(path.c_str(), &st) == 0 && subsys_fds_[0] >= 0 && fstat(subsys_fds_[0], &cg_st) == 0
+                && st.st_ino == cg_st.st_ino && st.st_dev == cg_st.st_dev;
+            break;
+        }
         // the line should look like:
         // 4:memory:/cgname
         if (sscanf(line, "%*d:memory:/%63s", buf) != 1)
@@ -255,17 +611,21 @@ static const useconds_t LOOP_ITERATION_INTERVAL = 10000;  // 10 ms
 
 int Cgroup::freeze(bool freeze, int timeout) {
     if (!valid()) return -1;
-    string freeze_state_path = subsys_path(CG_FREEZER) + "/freezer.state";
+
+    bool v2 = (version() == 2);
 
     if (!freeze) {
         INFO("unfreeze");
-        fs::write(freeze_state_path, "THAWED\n");
+        if (v2) set(CG_FREEZER, "cgroup.freeze", "0\n");
+        else set(CG_FREEZER, "freezer.state", "THAWED\n");
     } else {
         INFO("freezing");
-        fs::write(freeze_state_path, "FROZEN\n");
+        if (v2) set(CG_FREEZER, "cgroup.freeze", "1\n");
+        else set(CG_FREEZER, "freezer.state", "FROZEN\n");
 
         for (;;) {
-            int frozen = (strncmp(fs::read(freeze_state_path, 4).c_str(), "FRO", 3) == 0);
+            int frozen = v2 ? (get(CG_FREEZER, "cgroup.events").find("frozen 1") != string::npos)
+                            : (strncmp(get(CG_FREEZER, "freezer.state", 4).c_str(), "FRO", 3) == 0);
             if (frozen) break;
 
             timeout--;
@@ -285,34 +645,119 @@ int Cgroup::freeze(bool freeze, int timeout) {
 }
 
 int Cgroup::empty() {
-    string procs_path = subsys_path(CG_FREEZER) + "/cgroup.procs";
-    return fs::read(procs_path, 4).empty() ? 1 : 0;
+    // cgroup v1 caches the pid list per opened file, so it can not be kept open
+    int fd = open_property(CG_FREEZER, "cgroup.procs", O_RDONLY);
+    if (fd < 0) return 1;
+
+    char buf[4];
+    ssize_t len = read(fd, buf, sizeof buf);
+    close(fd);
+    return len <= 0 ? 1 : 0;
+}
+
+void Cgroup::wait_empty() {
+    // the timeout is a fallback in case a notification is missed
+    static const int WAIT_TIMEOUT_MS = 100;
+
+    int events_fd = version() == 2 ? open_property(CG_FREEZER, "cgroup.events", O_RDONLY) : -1;
+
+    while (valid() && !empty()) {
+        struct pollfd pfds[2];
+        int nfds = 0;
+        if (events_fd >= 0) {
+            // reading cgroup.events also re-arms POLLPRI
+            char buf[256];
+            ssize_t len = pread(events_fd, buf, sizeof buf - 1, 0);
+            if (len <= 0) break;
+            buf[len] = '\0';
+            if (strstr(buf, "populated 0")) break;
+            pfds[nfds].fd = events_fd;
+            pfds[nfds++].events = POLLPRI;
+        } else if (zygote_init_pidfd_ >= 0 || init_pidfd_ >= 0) {
+            // init exits after all processes in its pid namespace are gone
+            // and reaped. the spawned child is reaped by us
+            pfds[nfds].fd = zygote_init_pidfd_ >= 0 ? zygote_init_pidfd_ : init_pidfd_;
+            pfds[nfds++].events = POLLIN;
+            if (child_pidfd_ >= 0) {
+                pfds[nfds].fd = child_pidfd_;
+                pfds[nfds++].events = POLLIN;
+            }
+        } else {
+            usleep(LOOP_ITERATION_INTERVAL);
+            continue;
+        }
+
+        for (int i = 0; i < nfds; ++i) pfds[i].revents = 0;
+        poll(pfds, nfds, WAIT_TIMEOUT_MS);
+
+        for (int i = 0; i < nfds; ++i) {
+            if ((pfds[i].revents & POLLIN) == 0) continue;
+            if (pfds[i].fd == child_pidfd_) {
+                // the caller does not need its status after kill
+                pidfd::reap(child_pidfd_);
+                close(child_pidfd_);
+                child_pidfd_ = -1;
+            } else if (pfds[i].fd == zygote_init_pidfd_) {
+                pidfd::reap(zygote_init_pidfd_);
+                close(zygote_init_pidfd_);
+                zygote_init_pidfd_ = -1;
+            } else if (pfds[i].fd == init_pidfd_) {
+                // init is gone, do not poll it again
+                pidfd::reap(init_pidfd_);
+                close(init_pidfd_);
+                init_pidfd_ = -1;
+            }
+        }
+    }
+
+    if (events_fd >= 0) close(events_fd);
 }
 
 void Cgroup::killall(bool confirm) {
-    if (!valid() || empty()) return;
+    if (!valid()) return;
+    if (empty()) {
+        // the dummy init is not in the cgroup, and it outlives the
+        // processes in its pid namespace
+        if (init_pid_ > 0 && zygote_pid_ <= 0) {
+            if (init_pidfd_ < 0 || pidfd::send_signal(init_pidfd_, SIGKILL)) kill(init_pid_, SIGKILL);
+            init_pid_ = -1;
+        }
+        return;
+    }
 
-    if (init_pid_) {
+    // cgroup.kill (v2, Linux >= 5.14) kills all processes atomically,
+    // including new ones forked during the kill
+    bool killed = (version() == 2 && set(CG_FREEZER, "cgroup.kill", "1\n") == 0);
+    if (killed) INFO("sent SIGKILL using cgroup.kill");
+    kill_pending_ = killed && !confirm;
+
+    // the zygote lives in the same pid namespace and must survive
+    if (init_pid_ && zygote_pid_ <= 0) {
         if (init_pid_ > 0) {
             // if init pid exists, just kill it and the kernel will kill all
             // remaining processes in the same pid ns.
             // because our init process (clone_init_fn) won't allocate memory,
             // it will not enter D state and is safe to kill.
-            kill(init_pid_, SIGKILL);
+            if (init_pidfd_ < 0 || pidfd::send_signal(init_pidfd_, SIGKILL)) kill(init_pid_, SIGKILL);
             // cancel memory limit. this will wake up some D state processes,
             // which are allocating memory and reached memory limit.
             set_memory_limit(-1);
             INFO("sent SIGKILL to init process %lu", (unsigned long)init_pid_);
             init_pid_ = -1;
         }
-
-        if (confirm) {
-            // wait and confirm that processes are gone
-            for (int clear = 0; clear == 0;) {
-                if (!valid() || empty()) break;
-                usleep(LOOP_ITERATION_INTERVAL);
-            }
+        killed = true;
+    } else if (zygote_pid_ > 0 && zygote_init_pidfd_ >= 0) {
+        // the zygote child has its own pid namespace, kill its init instead
+        if (pidfd::send_signal(zygote_init_pidfd_, SIGKILL) == 0) {
+            set_memory_limit(-1);
+            INFO("sent SIGKILL to init process of zygote child");
+            killed = true;
         }
+    }
+
+    if (killed) {
+        // wait and confirm that processes are gone
+        if (confirm) wait_empty();
     } else {
         // legacy (unreliable) way to kill processes, or not using a pid
         // namespace
@@ -330,46 +775,145 @@ void Cgroup::killall(bool confirm) {
     return;
 }
 
+void Cgroup::killall_except(pid_t keep_pid) {
+    while (valid()) {
+        list<pid_t> pids = get_pids();
+        if (pids.empty() || (pids.size() == 1 && pids.front() == keep_pid)) break;
+
+        freeze(true, 2);
+        pids = get_pids();
+        FOR_EACH(p, pids) if (p != keep_pid) kill(p, SIGKILL);
+        INFO("sent SIGKILLs to %lu processes", (unsigned long)pids.size());
+        freeze(false, 1);
+        usleep(LOOP_ITERATION_INTERVAL);
+    }
+}
+
 int Cgroup::destroy() {
     killall();
 
     int ret = 0;
     for (int id = 0; id < SUBSYS_COUNT; ++id) {
+        if (!has_directory(id)) continue;
         string path = subsys_path((subsys_id_t)id);
         if (path.empty()) continue;
         if (fs::is_dir(path)) ret |= rmdir(path.c_str());
     }
+    close_fds();
 
     return ret;
 }
 
 int Cgroup::set(subsys_id_t subsys_id, const string& property, const string& value) {
-    return fs::write(subsys_path(subsys_id) + "/" + property, value);
+    int fd = open_property(subsys_id, property.c_str(), O_WRONLY);
+    if (fd < 0) return -1;
+
+    ssize_t ret = write(fd, value.c_str(), value.length());
+    close(fd);
+    return ret == (ssize_t)value.length() ? 0 : -2;
 }
 
 string Cgroup::get(subsys_id_t subsys_id, const string& property, size_t max_length) const {
-    return fs::read(subsys_path(subsys_id) + "/" + property, max_length);
+    int fd = open_property(subsys_id, property.c_str(), O_RDONLY);
+    if (fd < 0) return "";
+
+    string content(max_length, '\0');
+    size_t len = 0;
+    while (len < max_length) {
+        ssize_t ret = read(fd, &content[len], max_length - len);
+        if (ret <= 0) break;
+        len += ret;
+    }
+    close(fd);
+    content.resize(len);
+    return content;
 }
 
 int Cgroup::inherit(subsys_id_t subsys_id, const string& property) {
     string value = fs::read(base_path(subsys_id, false) + "/" + property);
-    return fs::write(subsys_path(subsys_id) + "/" + property, value);
+    return set(subsys_id, property, value);
 }
 
 int Cgroup::attach(pid_t pid) {
     char pidbuf[32];
     snprintf(pidbuf, sizeof(pidbuf), "%lu\n", (unsigned long)pid);
 
+    if (version() == 2) return set(CG_FREEZER, "cgroup.procs", pidbuf);
+
     int ret = 0;
     for (int id = 0; id < SUBSYS_COUNT; ++id) {
-        string path = subsys_path((subsys_id_t)id);
-        ret |= fs::write(path + "/tasks", pidbuf);
+        if (!has_directory(id)) continue;
+        ret |= set((subsys_id_t)id, "tasks", pidbuf);
     }
 
     return ret;
 }
 
+// v2 does not have devices.allow, use a BPF_PROG_TYPE_CGROUP_DEVICE program
+static struct bpf_insn bpf_insn_make(__u8 code, __u8 dst_reg, __u8 src_reg, __s16 off, __s32 imm) {
+    struct bpf_insn insn;
+    memset(&insn, 0, sizeof insn);
+    insn.code = code;
+    insn.dst_reg = dst_reg;
+    insn.src_reg = src_reg;
+    insn.off = off;
+    insn.imm = imm;
+    return insn;
+}
+
+static int attach_devices_filter(int cgroup_fd) {
+    static const int BASIC_DEVICE_COUNT = sizeof(basic_devices) / sizeof(basic_devices[0]);
+    struct bpf_insn insns[10 + BASIC_DEVICE_COUNT];
+    int n = 0;
+
+    // index of "return 0" and "return 1" instructions
+    const int deny = 6 + BASIC_DEVICE_COUNT, allow = deny + 2;
+
+    // r1: struct bpf_cgroup_dev_ctx *, r2: temporary
+    // device type is the lower 16 bits of access_type
+    insns[n++] = bpf_insn_make(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct bpf_cgroup_dev_ctx, access_type), 0);
+    insns[n++] = bpf_insn_make(BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_2, 0, 0, 0xffff);
+    insns[n] = bpf_insn_make(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_2, 0, deny - n - 1, BPF_DEVCG_DEV_CHAR); ++n;
+    // all basic_devices have major = 1
+    insns[n++] = bpf_insn_make(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct bpf_cgroup_dev_ctx, major), 0);
+    insns[n] = bpf_insn_make(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_2, 0, deny - n - 1, 1); ++n;
+    insns[n++] = bpf_insn_make(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct bpf_cgroup_dev_ctx, minor), 0);
+    for (int i = 0; i < BASIC_DEVICE_COUNT; ++i) {
+        insns[n] = bpf_insn_make(BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_2, 0, allow - n - 1, basic_devices[i].minor); ++n;
+    }
+    insns[n++] = bpf_insn_make(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, 0);
+    insns[n++] = bpf_insn_make(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+    insns[n++] = bpf_insn_make(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, 1);
+    insns[n++] = bpf_insn_make(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof attr);
+    attr.prog_type = BPF_PROG_TYPE_CGROUP_DEVICE;
+    attr.insns = (__u64)(unsigned long)insns;
+    attr.insn_cnt = n;
+    attr.license = (__u64)(unsigned long)"GPL";
+    int prog_fd = (int)syscall(__NR_bpf, BPF_PROG_LOAD, &attr, sizeof attr);
+    if (prog_fd < 0) {
+        ERROR("can not load devices bpf program");
+        return -1;
+    }
+
+    // without flags, an existing program will be replaced
+    memset(&attr, 0, sizeof attr);
+    attr.target_fd = cgroup_fd;
+    attr.attach_bpf_fd = prog_fd;
+    attr.attach_type = BPF_CGROUP_DEVICE;
+    int e = (int)syscall(__NR_bpf, BPF_PROG_ATTACH, &attr, sizeof attr);
+    if (e) ERROR("can not attach devices bpf program");
+
+    // the cgroup holds a reference to the program
+    close(prog_fd);
+    return e ? -1 : 0;
+}
+
 int Cgroup::limit_devices() {
+    if (version() == 2) return attach_devices_filter(subsys_fd(CG_DEVICES));
+
     int e = 0;
     e += set(CG_DEVICES, "devices.deny", "a");
     for (size_t i = 0; i < sizeof(basic_devices) / sizeof(basic_devices[0]); ++i) {
@@ -382,43 +926,241 @@ int Cgroup::limit_devices() {
 
 int Cgroup::reset_usages() {
     int e = 0;
-    e += set(CG_CPUACCT, "cpuacct.usage", "0");
-    e += set(CG_MEMORY, "memory.max_usage_in_bytes", "0") * set(CG_MEMORY, "memory.memsw.max_usage_in_bytes", "0");
+    if (version() == 2) {
+        e += reset_cpu_usage();
+        // memory.peak is reset only for the fd written to. older kernels
+        // do not support this and peak will be the value since creation.
+        char buf[32];
+        read_counter(CNT_MEMORY_PEAK, buf, sizeof buf);
+        int fd = counter_fds_[CNT_MEMORY_PEAK];
+        if (fd < 0 || write(fd, "0\n", 2) != 2) INFO("can not reset memory.peak");
+    } else {
+        // counters are cheap to read, skip writes if they are already 0
+        if (counter_value(CNT_CPU_USAGE) != 0) e += set(CG_CPUACCT, "cpuacct.usage", "0");
+        if (counter_value(CNT_MEMORY_PEAK) != 0 || counter_value(CNT_MEMSW_PEAK) > 0) {
+            e += set(CG_MEMORY, "memory.max_usage_in_bytes", "0") * set(CG_MEMORY, "memory.memsw.max_usage_in_bytes", "0");
+        }
+    }
     output_counter_.clear();
     return e ? -1 : 0;
 }
 
 int Cgroup::reset_cpu_usage() {
     int e = 0;
-    e = set(CG_CPUACCT, "cpuacct.usage", "0");
+    if (version() == 2) {
+        if (!cpu_usage_base_) return -1;
+        *cpu_usage_base_ = 0;
+        long long usage = (long long)(cpu_usage() * 1e9);
+        if (usage <= 0 && !valid()) return -1;
+        *cpu_usage_base_ = usage;
+    } else {
+        e = set(CG_CPUACCT, "cpuacct.usage", "0");
+    }
     return e ? -1 : 0;
 }
 
 double Cgroup::cpu_usage() const {
-    string cpu_usage = get(CG_CPUACCT, "cpuacct.usage", 31);
+    long long usage;
+    if (version() == 2) {
+        // cpu.stat starts with "usage_usec <usec>"
+        char buf[64];
+        if (read_counter(CNT_CPU_USAGE, buf, sizeof buf) <= 0 || sscanf(buf, "usage_usec %lld", &usage) != 1) return 0;
+        usage = usage * 1000 - (cpu_usage_base_ ? *cpu_usage_base_ : 0);
+    } else {
+        usage = counter_value(CNT_CPU_USAGE);
+    }
     // convert from nanoseconds to seconds
-    return strconv::to_double(cpu_usage) / 1e9;
+    return usage > 0 ? usage / 1e9 : 0;
 }
 
 long long Cgroup::memory_current() const {
-    string usage = get(CG_MEMORY, "memory.memsw.usage_in_bytes");
-    if (usage.empty()) usage = get(CG_MEMORY, "memory.usage_in_bytes");
-    return strconv::to_longlong(usage);
+    long long usage = counter_value(CNT_MEMSW_USAGE);
+    if (usage < 0) usage = counter_value(CNT_MEMORY_USAGE);
+    return usage > 0 ? usage : 0;
+}
+
+std::vector<double> Cgroup::cpu_usage_percpu() const {
+    std::vector<double> usages;
+    if (version() == 2) return usages;
+
+    string content = get(CG_CPUACCT, "cpuacct.usage_percpu", 65536);
+    const char *p = content.c_str();
+    for (;;) {
+        char *end;
+        long long usage = strtoll(p, &end, 10);
+        if (end == p) break;
+        usages.push_back(usage / 1e9);
+        p = end;
+    }
+    return usages;
+}
+
+std::map<string, long long> Cgroup::get_stats(subsys_id_t subsys_id, const string& property) const {
+    std::map<string, long long> stats;
+    string content = get(subsys_id, property, 65536);
+
+    size_t line_start = 0;
+    while (line_start < content.length()) {
+        size_t line_end = content.find('\n', line_start);
+        if (line_end == string::npos) line_end = content.length();
+        size_t sep = content.find(' ', line_start);
+        if (sep < line_end) {
+            stats[content.substr(line_start, sep - line_start)] = strtoll(content.c_str() + sep + 1, NULL, 10);
+        }
+        line_start = line_end + 1;
+    }
+    return stats;
+}
+
+void Cgroup::memory_stat(long long& rss, long long& cache, long long& swap) const {
+    rss = cache = swap = -1;
+    if (version() == 2) swap = counter_value(CNT_SWAP_USAGE);
+
+    char buf[8192];
+    if (read_counter(CNT_MEMORY_STAT, buf, sizeof buf) <= 0) return;
+
+    // on v1, "total_" ones include child cgroups. "total_swap" exists
+    // if swap is accounted
+    const char *rss_key = version() == 2 ? "anon " : "total_rss ";
+    const char *cache_key = version() == 2 ? "file " : "total_cache ";
+    const char *swap_key = version() == 2 ? NULL : "total_swap ";
+    for (const char *line = buf; line && *line; line = strchr(line, '\n')) {
+        if (*line == '\n') ++line;
+        if (strncmp(line, rss_key, strlen(rss_key)) == 0) rss = strtoll(line + strlen(rss_key), NULL, 10);
+        if (strncmp(line, cache_key, strlen(cache_key)) == 0) cache = strtoll(line + strlen(cache_key), NULL, 10);
+        if (swap_key && strncmp(line, swap_key, strlen(swap_key)) == 0) swap = strtoll(line + strlen(swap_key), NULL, 10);
+    }
+}
+
+double Cgroup::pressure_stall(const string& resource) const {
+    counter_id_t counter_id;
+    if (resource == "cpu") {
+        counter_id = CNT_CPU_PRESSURE;
+    } else if (resource == "memory") {
+        counter_id = CNT_MEMORY_PRESSURE;
+    } else if (resource == "io") {
+        counter_id = CNT_IO_PRESSURE;
+    } else {
+        return -1;
+    }
+
+    // "some avg10=0.00 avg60=0.00 avg300=0.00 total=<usec>"
+    char buf[256];
+    long long total;
+    if (read_counter(counter_id, buf, sizeof buf) <= 0) return -1;
+    const char *p = strstr(buf, "total=");
+    if (!p || sscanf(p, "total=%lld", &total) != 1) return -1;
+    return total / 1e6;
+}
+
+long long Cgroup::pids_current() const {
+    return counter_value(CNT_PIDS_CURRENT);
+}
+
+long long Cgroup::pids_limit_hits() const {
+    char buf[128];
+    if (read_counter(CNT_PIDS_EVENTS, buf, sizeof buf) <= 0) return -1;
+    // "max N", newer kernels also have "max.imposed N"
+    if (strncmp(buf, "max ", 4) != 0) return -1;
+    return strtoll(buf + 4, NULL, 10);
 }
 
 long long Cgroup::memory_peak() const {
-    string usage = get(CG_MEMORY, "memory.memsw.max_usage_in_bytes");
-    if (usage.empty()) usage = get(CG_MEMORY, "memory.max_usage_in_bytes");
-    return strconv::to_longlong(usage);
+    long long usage = counter_value(CNT_MEMSW_PEAK);
+    if (usage < 0) usage = counter_value(CNT_MEMORY_PEAK);
+    return usage > 0 ? usage : 0;
 }
 
 long long Cgroup::memory_limit() const {
+    if (version() == 2) {
+        string limit = get(CG_MEMORY, "memory.max");
+        return limit.compare(0, 3, "max") == 0 ? LLONG_MAX : strconv::to_longlong(limit);
+    }
+
     string limit = get(CG_MEMORY, "memory.memsw.limit_in_bytes");
     if (limit.empty()) limit = get(CG_MEMORY, "memory.limit_in_bytes");
     return strconv::to_longlong(limit);
 }
 
+// sum of "oom" and "oom_kill" in v2 memory.events
+static long long unified_oom_count(const string& events) {
+    long long count = 0;
+    for (const char *p = events.c_str(); p && *p;) {
+        // each line looks like "oom_kill 0"
+        char key[16];
+        long long value;
+        if (sscanf(p, "%15s %lld", key, &value) == 2 && (strcmp(key, "oom") == 0 || strcmp(key, "oom_kill") == 0)) {
+            count += value;
+        }
+        p = strchr(p, '\n');
+        if (p) ++p;
+    }
+    return count;
+}
+
+int Cgroup::oom_eventfd() {
+    if (version() == 2) {
+        // memory.events generates file modified events
+        int fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+        if (fd < 0) return -1;
+
+        string events_path = subsys_path(CG_MEMORY) + "/memory.events";
+        if (inotify_add_watch(fd, events_path.c_str(), IN_MODIFY) < 0) {
+            close(fd);
+            return -1;
+        }
+
+        // the cgroup may be reused, only count new oom events
+        oom_count_base_ = unified_oom_count(get(CG_MEMORY, "memory.events", 1023));
+        return fd;
+    }
+
+    int efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (efd < 0) return -1;
+
+    int cfd = open_property(CG_MEMORY, "memory.oom_control", O_RDONLY);
+    if (cfd < 0) {
+        close(efd);
+        return -1;
+    }
+
+    // "<event_fd> <fd of memory.oom_control>"
+    char buf[sizeof(int) * 6 + 2];
+    snprintf(buf, sizeof buf, "%d %d", efd, cfd);
+    int e = set(CG_MEMORY, "cgroup.event_control", buf);
+    close(cfd);
+
+    if (e) {
+        close(efd);
+        return -1;
+    }
+    return efd;
+}
+
+int Cgroup::read_oom_event(int fd) {
+    if (version() == 2) {
+        // drain inotify events, then check memory.events
+        char buf[sizeof(struct inotify_event) + NAME_MAX + 1];
+        while (read(fd, buf, sizeof buf) > 0);
+        return unified_oom_count(get(CG_MEMORY, "memory.events", 1023)) > oom_count_base_ ? 1 : 0;
+    }
+
+    uint64_t count = 0;
+    return (read(fd, &count, sizeof count) == sizeof count && count > 0) ? 1 : 0;
+}
+
 int Cgroup::set_memory_limit(long long bytes) {
+    if (version() == 2) {
+        // no swap, memory.swap.max may not exist if swap accounting is disabled
+        if (bytes <= 0) {
+            set(CG_MEMORY, "memory.swap.max", "max\n");
+            return set(CG_MEMORY, "memory.max", "max\n") ? -1 : 0;
+        } else {
+            set(CG_MEMORY, "memory.swap.max", "0\n");
+            return set(CG_MEMORY, "memory.max", strconv::from_longlong(bytes)) ? -1 : 0;
+        }
+    }
+
     int e = 1;
 
     if (bytes <= 0) {
@@ -426,13 +1168,77 @@ int Cgroup::set_memory_limit(long long bytes) {
         e *= inherit(CG_MEMORY, "memory.limit_in_bytes");
         e *= inherit(CG_MEMORY, "memory.memsw.limit_in_bytes");
     } else {
-        e *= set(CG_MEMORY, "memory.limit_in_bytes", strconv::from_longlong(bytes));
-        e *= set(CG_MEMORY, "memory.memsw.limit_in_bytes", strconv::from_longlong(bytes));
+        // memory.limit_in_bytes can not exceed memory.memsw.limit_in_bytes.
+        // a reused cgroup may have a lower limit, retry after raising memsw
+        string value = strconv::from_longlong(bytes);
+        int limit_e = set(CG_MEMORY, "memory.limit_in_bytes", value);
+        e *= set(CG_MEMORY, "memory.memsw.limit_in_bytes", value);
+        if (limit_e) limit_e = set(CG_MEMORY, "memory.limit_in_bytes", value);
+        e *= limit_e;
     }
 
     return e ? -1 : 0;
 }
 
+int Cgroup::reclaim_memory() {
+    if (version() == 1) return set(CG_MEMORY, "memory.force_empty", "0") ? -1 : 0;
+
+    // memory.reclaim fails with EAGAIN if less than asked is reclaimed
+    long long usage = counter_value(CNT_MEMORY_USAGE);
+    if (usage <= 0) return 0;
+    return (set(CG_MEMORY, "memory.reclaim", strconv::from_longlong(usage)) && errno != EAGAIN) ? -1 : 0;
+}
+
+int Cgroup::set_pids_limit(long long count) {
+    if (!has_subsys(CG_PIDS)) return -1;
+    return set(CG_PIDS, "pids.max", count > 0 ? strconv::from_longlong(count) : string("max\n")) ? -1 : 0;
+}
+
+int Cgroup::set_cpu_quota(double cpus) {
+    if (!has_subsys(CG_CPU)) return -1;
+
+    static const long long PERIOD_US = 100000;
+    string quota = cpus > 0 ? strconv::from_longlong((long long)(cpus * PERIOD_US)) : string(version() == 2 ? "max" : "-1");
+    if (version() == 2) return set(CG_CPU, "cpu.max", quota + " " + strconv::from_longlong(PERIOD_US) + "\n") ? -1 : 0;
+
+    int e = set(CG_CPU, "cpu.cfs_period_us", strconv::from_longlong(PERIOD_US));
+    e |= set(CG_CPU, "cpu.cfs_quota_us", quota);
+    return e ? -1 : 0;
+}
+
+int Cgroup::set_cpu_weight(int weight) {
+    if (!has_subsys(CG_CPU)) return -1;
+    if (weight <= 0) weight = 100;
+    if (version() == 2) return set(CG_CPU, "cpu.weight", strconv::from_long(weight)) ? -1 : 0;
+
+    // v1 default cpu.shares is 1024, minimal is 2
+    long shares = weight * 1024L / 100;
+    return set(CG_CPU, "cpu.shares", strconv::from_long(shares < 2 ? 2 : shares)) ? -1 : 0;
+}
+
+int Cgroup::set_cpuset(const string& cpus, const string& mems) {
+    if (!has_subsys(CG_CPUSET)) return -1;
+
+    // v2 uses parent's effective cpus and mems if they are empty. v1 does
+    // not allow tasks in a cpuset without cpus or mems, copy parent's
+    int e = 0;
+    if (version() == 2) {
+        e |= set(CG_CPUSET, "cpuset.cpus", cpus + "\n");
+        e |= set(CG_CPUSET, "cpuset.mems", mems + "\n");
+    } else {
+        e |= cpus.empty() ? inherit(CG_CPUSET, "cpuset.cpus") : set(CG_CPUSET, "cpuset.cpus", cpus);
+        e |= mems.empty() ? inherit(CG_CPUSET, "cpuset.mems") : set(CG_CPUSET, "cpuset.mems", mems);
+    }
+    return e ? -1 : 0;
+}
+
+string Cgroup::cpuset_cpus() const {
+    if (!has_subsys(CG_CPUSET)) return "";
+    string cpus = get(CG_CPUSET, version() == 2 ? "cpuset.cpus.effective" : "cpuset.effective_cpus");
+    if (!cpus.empty() && cpus[cpus.length() - 1] == '\n') cpus.erase(cpus.length() - 1);
+    return cpus;
+}
+
 // following functions are called by clone_main_fn
 
 __attribute__((unused)) static void do_set_sysctl() {
@@ -444,16 +1250,18 @@ __attribute__((unused)) static void do_set_sysctl() {
     fs::write("/proc/sys/kernel/dmesg_restrict", "1\n");
 }
 
-static void do_privatize_filesystem(__attribute__((unused)) const Cgroup::spawn_arg& arg) {
+static int do_privatize_filesystem(__attribute__((unused)) const Cgroup::spawn_arg& arg) {
     // make sure filesystem not be shared
     // ignore this step for old systems without these features
     int type = MS_PRIVATE | MS_REC;
     if (type && fs::mount_set_shared("/", MS_PRIVATE | MS_REC)) {
-        FATAL("can not mount --make-rprivate /");
+        ERROR("can not mount --make-rprivate /");
+        return -1;
     }
+    return 0;
 }
 
-static void do_remounts(const Cgroup::spawn_arg& arg) {
+static int do_remounts(const Cgroup::spawn_arg& arg) {
     FOR_EACH(p, arg.remount_list) {
         const string& dest = p.first;
         unsigned long flags = p.second;
@@ -464,13 +1272,17 @@ static void do_remounts(const Cgroup::spawn_arg& arg) {
         INFO("remount %s", dest.c_str());
         for (;;) {
             if (fs::remount(dest, flags) == 0) break;
-            if (flags & MS_BIND) FATAL("remount '%s' failed", dest.c_str());
+            if (flags & MS_BIND) {
+                ERROR("remount '%s' failed", dest.c_str());
+                return -1;
+            }
             flags |= MS_BIND;
         }
     }
+    return 0;
 }
 
-static void do_mount_bindfs(const Cgroup::spawn_arg& arg) {
+static int do_mount_bindfs(const Cgroup::spawn_arg& arg) {
     // bind fs mounts
     FOR_EACH(p, arg.bindfs_list) {
         const string& dest = p.first;
@@ -478,26 +1290,30 @@ static void do_mount_bindfs(const Cgroup::spawn_arg& arg) {
 
         INFO("mount bind %s -> %s", src.c_str(), dest.c_str());
         if (fs::mount_bind(src, dest)) {
-            FATAL("mount bind '%s' -> '%s' failed", src.c_str(), dest.c_str());
+            ERROR("mount bind '%s' -> '%s' failed", src.c_str(), dest.c_str());
+            return -1;
         }
     }
+    return 0;
 }
 
-static void do_chroot(const Cgroup::spawn_arg& arg) {
+static int do_chroot(const Cgroup::spawn_arg& arg) {
     // chroot to a prepared place
     if (!arg.chroot_path.empty()) {
         const string& path = arg.chroot_path;
 
         INFO("chroot %s", path.c_str());
         if (chroot(path.c_str())) {
-            FATAL("chroot '%s' failed", path.c_str());
+            ERROR("chroot '%s' failed", path.c_str());
+            return -1;
         }
     }
+    return 0;
 }
 
-static void do_umount_outside_chroot(const Cgroup::spawn_arg& arg) {
-    if (!arg.umount_outside) return;
-    if (arg.chroot_path.empty()) return;
+static int do_umount_outside_chroot(const Cgroup::spawn_arg& arg) {
+    if (!arg.umount_outside) return 0;
+    if (arg.chroot_path.empty()) return 0;
 
     std::map<string, fs::MountEntry> mounts = fs::get_mounts();
     list<string> umount_list;
@@ -515,6 +1331,7 @@ static void do_umount_outside_chroot(const Cgroup::spawn_arg& arg) {
             WARNING("cannot umount %s", dest.c_str());
         }
     }
+    return 0;
 }
 
 static bool should_mount_proc(const Cgroup::spawn_arg& arg) {
@@ -547,23 +1364,26 @@ static const char * get_proc_fs_type(const Cgroup::spawn_arg& arg) {
     }
 }
 
-static void do_mount_proc(const Cgroup::spawn_arg& arg) {
+static int do_mount_proc(const Cgroup::spawn_arg& arg) {
     // mount /proc if pid namespace is enabled and the directory exists
-    if (!should_mount_proc(arg)) return;
+    if (!should_mount_proc(arg)) return 0;
     string dest = fs::join(arg.chroot_path, fs::PROC_PATH);
     INFO("mount procfs at %s", dest.c_str());
     const char * mount_opts = should_hide_sensitive(arg) ? "hidepid=2" : NULL;
     if (mount(NULL, dest.c_str(), get_proc_fs_type(arg), MS_NOEXEC | MS_NOSUID, mount_opts)) {
-        FATAL("mount procfs failed");
+        ERROR("mount procfs failed");
+        return -1;
     }
+    return 0;
 }
 
-static void do_hide_sensitive(const Cgroup::spawn_arg& arg) {
-    if (!should_hide_sensitive(arg)) return;
+static int do_hide_sensitive(const Cgroup::spawn_arg& arg) {
+    if (!should_hide_sensitive(arg)) return 0;
     string proc_sys_path = fs::join(arg.chroot_path, "/proc/sys");
     if (fs::is_accessible(proc_sys_path, X_OK)) {
         mount(NULL, proc_sys_path.c_str(), "tmpfs", MS_NOSUID | MS_RDONLY, "size=0");
     }
+    return 0;
 }
 
 static list<int> get_fds() {
@@ -586,22 +1406,22 @@ static list<int> get_fds() {
     return fds;
 }
 
-static void do_set_uts(const Cgroup::spawn_arg& arg) {
+static int do_set_uts(const Cgroup::spawn_arg& arg) {
     int e;
     if (!arg.uts.domainname.empty()) {
         INFO("setdomainname: %s", arg.uts.domainname.c_str());
         e = setdomainname(arg.uts.domainname.c_str(), arg.uts.domainname.length());
         if (e == -1) {
-            FATAL("setdomainname '%s' failed", arg.uts.domainname.c_str());
-            exit(-1);
+            ERROR("setdomainname '%s' failed", arg.uts.domainname.c_str());
+            return -1;
         }
     }
     if (!arg.uts.nodename.empty()) {
         INFO("sethostname: %s", arg.uts.nodename.c_str());
         e = sethostname(arg.uts.nodename.c_str(), arg.uts.nodename.length());
         if (e == -1) {
-            FATAL("sethostname '%s' failed", arg.uts.nodename.c_str());
-            exit(-1);
+            ERROR("sethostname '%s' failed", arg.uts.nodename.c_str());
+            return -1;
         }
     }
 
@@ -624,30 +1444,29 @@ static void do_set_uts(const Cgroup::spawn_arg& arg) {
         fs::write("/proc/sys/utsmod/version", arg.uts.version);
     }
     // [[[end]]]
+    return 0;
 }
 
-static void do_fd_redirect(int fd_dst, int fd_src) {
+static int do_fd_redirect(int fd_dst, int fd_src) {
     if (fd_src >= 0 && fd_src != fd_dst) {
         INFO("dup2 %d %d", fd_src, fd_dst);
         int ret = dup2(fd_src, fd_dst);
         if (ret == -1) {
-            FATAL("cannot dup %d", fd_src);
+            ERROR("cannot dup %d", fd_src);
+            return -1;
         }
     }
+    return 0;
 }
 
-static void fd_set_cloexec(int fd, int enforce = 1) {
+static void fd_set_cloexec(int fd) {
     if (fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC)) {
-        if (enforce) {
-            FATAL("fcntl %d failed", fd);
-        } else {
-            // fd can become invalid across namespaces
-            close(fd);
-        }
+        // fd can become invalid across namespaces
+        close(fd);
     }
 }
 
-static void do_process_fds(const Cgroup::spawn_arg& arg) {
+static int do_process_fds(const Cgroup::spawn_arg& arg) {
     // this is for parent process
     close(arg.sockets[1]);
 
@@ -658,20 +1477,20 @@ static void do_process_fds(const Cgroup::spawn_arg& arg) {
     flog = fdopen(flog_fd, "a");
 #endif
 
-    do_fd_redirect(STDOUT_FILENO, arg.stdout_fd);
-    do_fd_redirect(STDERR_FILENO, arg.stderr_fd);
+    if (do_fd_redirect(STDIN_FILENO, arg.stdin_fd) || do_fd_redirect(STDOUT_FILENO, arg.stdout_fd) || do_fd_redirect(STDERR_FILENO, arg.stderr_fd)) return -1;
 
     INFO("applying FD_CLOEXEC");
     list<int> fds = get_fds();
     FOR_EACH(fd, fds) {
         if (fd != STDERR_FILENO && fd != STDIN_FILENO && fd != STDOUT_FILENO
                 && arg.keep_fds.count(fd) == 0) {
-            fd_set_cloexec(fd, 0 /* close that fd on error */);
+            fd_set_cloexec(fd);
         }
     }
+    return 0;
 }
 
-static void do_mount_tmpfs(const Cgroup::spawn_arg& arg) {
+static int do_mount_tmpfs(const Cgroup::spawn_arg& arg) {
     // setup other tmpfs mounts
     FOR_EACH(p, arg.tmpfs_list) {
         const char * dest = p.first.c_str();
@@ -687,20 +1506,25 @@ static void do_mount_tmpfs(const Cgroup::spawn_arg& arg) {
             e = mount(NULL, dest, "tmpfs", MS_NOSUID, ((string)("mode=0777,size=" + strconv::from_longlong(size))).c_str());
         }
         if (e) {
-            FATAL("mount tmpfs '%s' failed", dest);
+            ERROR("mount tmpfs '%s' failed", dest);
+            return -1;
         }
     }
+    return 0;
 }
 
-static void do_remount_dev(const Cgroup::spawn_arg& arg) {
-    if (!arg.remount_dev) return;
+static int do_remount_dev(const Cgroup::spawn_arg& arg) {
+    if (!arg.remount_dev) return 0;
 
     INFO("remount /dev");
 
     int e;
     // mount a minimal tmpfs to /dev
     e = mount(NULL, "/dev", "tmpfs", MS_NOSUID, "size=64,mode=0755,uid=0,gid=0");
-    if (e) FATAL("remount /dev failed");
+    if (e) {
+        ERROR("remount /dev failed");
+        return -1;
+    }
 
     // create basic devices
     for (size_t i = 0; i < sizeof(basic_devices) / sizeof(basic_devices[0]); ++i) {
@@ -708,32 +1532,39 @@ static void do_remount_dev(const Cgroup::spawn_arg& arg) {
         unsigned int minor = basic_devices[i].minor;
         e = mknod(path.c_str(), S_IFCHR | 0666 /* mode */, makedev(1 /* major */, minor));
         if (!e) e = chmod(path.c_str(), 0666);
-        if (e) FATAL("failed to create dev: '%s'", path.c_str());
+        if (e) {
+            ERROR("failed to create dev: '%s'", path.c_str());
+            return -1;
+        }
     }
+    return 0;
 }
 
-static void do_chdir(const Cgroup::spawn_arg& arg) {
+static int do_chdir(const Cgroup::spawn_arg& arg) {
     // chdir to a specified path
     if (!arg.chdir_path.empty()) {
         const string& path = arg.chdir_path;
 
         INFO("chdir %s", path.c_str());
         if (chdir(path.c_str())) {
-            FATAL("chdir '%s' failed", path.c_str());
+            ERROR("chdir '%s' failed", path.c_str());
+            return -1;
         }
     }
+    return 0;
 }
 
-static void do_commands(const Cgroup::spawn_arg& arg) {
+static int do_commands(const Cgroup::spawn_arg& arg) {
     // system commands
     FOR_EACH(cmd, arg.cmd_list) {
         INFO("system %s", cmd.c_str());
         int ret = system(cmd.c_str());
         if (ret) WARNING("system \"%s\" returns %d", cmd.c_str(), ret);
     }
+    return 0;
 }
 
-static void do_renice(const Cgroup::spawn_arg& arg) {
+static int do_renice(const Cgroup::spawn_arg& arg) {
     // nice
     if (arg.nice) {
         INFO("nice %d", (int)arg.nice);
@@ -741,25 +1572,67 @@ static void do_renice(const Cgroup::spawn_arg& arg) {
             WARNING("can not set nice to %d", arg.nice);
         }
     }
+    return 0;
 }
 
-static void do_set_umask(const Cgroup::spawn_arg& arg) {
+static int do_set_affinity(const Cgroup::spawn_arg& arg) {
+    // cpuset cgroup also limits cpus, this works without it
+    if (arg.cpu_affinity.empty()) return 0;
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    FOR_EACH_CONST(cpu, arg.cpu_affinity) {
+        if (cpu < CPU_SETSIZE) CPU_SET(cpu, &cpus);
+    }
+    INFO("set cpu affinity");
+    if (sched_setaffinity(0, sizeof cpus, &cpus)) {
+        ERROR("can not set cpu affinity");
+        return -1;
+    }
+    return 0;
+}
+
+static int do_reduce_variance(const Cgroup::spawn_arg& arg) {
+    // both are inherited by exec and children. a fixed address space layout
+    // and no huge page promotion make timing of runs more similar
+    if (arg.disable_aslr) {
+        INFO("disable ASLR");
+        int persona = personality(0xffffffff);
+        if (persona == -1 || personality(persona | ADDR_NO_RANDOMIZE) == -1) {
+            ERROR("can not disable ASLR");
+            return -1;
+        }
+    }
+    if (arg.disable_thp) {
+        INFO("disable transparent huge pages");
+        if (prctl(PR_SET_THP_DISABLE, 1, 0, 0, 0)) {
+            ERROR("can not disable transparent huge pages");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int do_set_umask(const Cgroup::spawn_arg& arg) {
     // set umask
     INFO("umask %d", arg.umask);
     umask(arg.umask);
+    return 0;
 }
 
-static void do_set_uid_gid(const Cgroup::spawn_arg& arg) {
+static int do_set_uid_gid(const Cgroup::spawn_arg& arg) {
     // setup uid, gid
     INFO("setgid %d, setuid %d", (int)arg.gid, (int)arg.uid);
     if (setgid(arg.gid) || setuid(arg.uid)) {
         // an interesting story about not checking setuid return value:
         // https://sites.google.com/site/fullycapable/Home/thesendmailcapabilitiesissue
-        FATAL("setgid(%d) or setuid(%d) failed", (int)arg.gid, (int)arg.uid);
+        ERROR("setgid(%d) or setuid(%d) failed", (int)arg.gid, (int)arg.uid);
+        return -1;
     }
+    return 0;
 }
 
-static void do_apply_rlimits(const Cgroup::spawn_arg& arg) {
+static int do_apply_rlimits(const Cgroup::spawn_arg& arg) {
     // apply rlimit, note NPROC limit should be applied after setuid
     FOR_EACH(p, arg.rlimits) {
         int resource = p.first;
@@ -810,24 +1683,32 @@ static void do_apply_rlimits(const Cgroup::spawn_arg& arg) {
             WARNING("can not set rlimit %d", resource);
         }
     }
+    return 0;
 }
 
-static void do_set_env(const Cgroup::spawn_arg& arg) {
+static int do_set_env(const Cgroup::spawn_arg& arg) {
     // prepare env
     if (arg.reset_env) {
         INFO("reset ENV");
-        if (clearenv()) FATAL("can not clear env");
+        if (clearenv()) {
+            ERROR("can not clear env");
+            return -1;
+        }
     }
 
     FOR_EACH(p, arg.env_list) {
         const char * name = p.first.c_str();
         const char * value = p.second.c_str();
 
-        if (setenv(name, value, 1)) FATAL("can not set env %s=%s", name, value);
+        if (setenv(name, value, 1)) {
+            ERROR("can not set env %s=%s", name, value);
+            return -1;
+        }
     }
+    return 0;
 }
 
-static void do_seccomp(const Cgroup::spawn_arg& arg) {
+static int do_seccomp(const Cgroup::spawn_arg& arg) {
     // syscall whitelist
     if (seccomp::supported() && arg.syscall_list.length() > 0) {
         // apply seccomp, it will set PR_SET_NO_NEW_PRIVS
@@ -838,17 +1719,18 @@ static void do_seccomp(const Cgroup::spawn_arg& arg) {
         seccomp::Rules rules(arg.syscall_action, (uint64_t)(void*)arg.args /* special case for execve arg1 */);
 
         if (rules.add_simple_filter(arg.syscall_list.c_str())) {
-            FATAL("failed to parse syscall filter string");
-            exit(-1);
+            ERROR("failed to parse syscall filter string");
+            return -1;
         }
         if (rules.apply()) {
-            FATAL("failed to apply seccomp rules");
-            exit(-1);
+            ERROR("failed to apply seccomp rules");
+            return -1;
         }
     }
+    return 0;
 }
 
-static void do_set_new_privs(const Cgroup::spawn_arg& arg) {
+static int do_set_new_privs(const Cgroup::spawn_arg& arg) {
     #ifndef PR_SET_NO_NEW_PRIVS
     # define PR_SET_NO_NEW_PRIVS 38
     #endif
@@ -865,11 +1747,12 @@ static void do_set_new_privs(const Cgroup::spawn_arg& arg) {
             INFO("prctl PR_SET_NO_NEW_PRIVS");
             int e = prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0);
             if (e) {
-                FATAL("prctl PR_SET_NO_NEW_PRIVS");
-                exit(-1);
+                ERROR("prctl PR_SET_NO_NEW_PRIVS");
+                return -1;
             }
         }
     }
+    return 0;
 }
 
 static void init_signal_handler(int signal) {
@@ -913,86 +1796,123 @@ static int clone_init_fn(void *) {
     return 0;
 }
 
-static int clone_main_fn(void * clone_arg) {
-    // kill us if parent dies
-    prctl(PR_SET_PDEATHSIG, SIGKILL);
-
-    // this is executed in child process after clone
-    // fs and uid settings should be done here
-    Cgroup::spawn_arg& arg = *(Cgroup::spawn_arg*)clone_arg;
-
-#ifdef SYSCTL_PER_NS_WORKS
-    // NOTE: Do not uncomment this until sysctl per namespace works.
-    // current kernel use global variables for vm.oom_kill_allocating_task,
-    // etc.
-    do_set_sysctl();
-#endif
-    do_set_uts(arg);
-    do_process_fds(arg);
-    do_privatize_filesystem(arg);
-    do_umount_outside_chroot(arg);
-    do_mount_proc(arg);
-    do_hide_sensitive(arg);
-    do_mount_bindfs(arg);
-    do_remounts(arg);
-    do_chroot(arg);
-    do_mount_tmpfs(arg);
-    do_remount_dev(arg);
-    do_chdir(arg);
-    do_commands(arg);
-    do_set_umask(arg);
-    do_set_uid_gid(arg);
-    do_apply_rlimits(arg);
-    do_set_env(arg);
-    do_renice(arg);
-    do_set_new_privs(arg);
-
-    // all prepared! blocking, wait for parent
+static int do_wait_parent(const Cgroup::spawn_arg& arg) {
+    // all prepared! wait for parent, it is usually ready
     INFO("waiting for parent");
     char buf[4];
-    int ret = read(arg.sockets[0], buf, sizeof buf);
-    (void)ret;
-
-    // let parent know we got the message, parent then can close fd without SIGPIPE child
-    INFO("got from parent: '%3s'. notify parent", buf);
-    strncpy(buf, "PRE", sizeof buf);
-    ret = write(arg.sockets[0], buf, sizeof buf);
-    (void)ret;
-
-    // not closing sockets[0] here, it will closed on exec
-    // if exec fails, it will be closed upon process exit (aka. this function returns)
-    fd_set_cloexec(arg.sockets[0]);
+    return read(arg.sockets[0], buf, sizeof buf) > 0 ? 0 : -1;
+}
 
+static int do_callback(const Cgroup::spawn_arg& arg) {
     // it's time for callback, write log first because fanotify may block us from
     // doing that
-    int callback_ret = 0;
     if (arg.callback_child) {
         INFO("will run callback and execvp %s ...", arg.args[0]);
-        callback_ret = arg.callback_child((void *) &arg);
+        return arg.callback_child((void *) &arg);
     } else {
         INFO("will execvp %s ...", arg.args[0]);
+        return 0;
     }
+}
 
-    if (callback_ret == 0) {
-        // exec target. syscall filter must be done just before execve because we need other
-        // syscalls in above code.
-        do_seccomp(arg);
-        execvp(arg.args[0], arg.args);
-        // if exec fails, write reason down (child knows more details than parent)
-        ERROR("exec '%s' failed", arg.args[0]);
+static int do_exec(const Cgroup::spawn_arg& arg) {
+    // exec target. syscall filter must be done just before execve because we need other
+    // syscalls in above code.
+    execvp(arg.args[0], arg.args);
+    // if exec fails, write reason down (child knows more details than parent)
+    ERROR("exec '%s' failed", arg.args[0]);
+    return -1;
+}
+
+typedef int spawn_step_func(const Cgroup::spawn_arg&);
+
+static const struct {
+    const char *name;
+    spawn_step_func *func;
+} spawn_steps[] = {
+    {"set_uts", do_set_uts},
+    {"process_fds", do_process_fds},
+    {"privatize_filesystem", do_privatize_filesystem},
+    {"umount_outside_chroot", do_umount_outside_chroot},
+    {"mount_proc", do_mount_proc},
+    {"hide_sensitive", do_hide_sensitive},
+    {"mount_bindfs", do_mount_bindfs},
+    {"remounts", do_remounts},
+    {"chroot", do_chroot},
+    {"mount_tmpfs", do_mount_tmpfs},
+    {"remount_dev", do_remount_dev},
+    {"chdir", do_chdir},
+    {"commands", do_commands},
+    {"set_umask", do_set_umask},
+    {"set_uid_gid", do_set_uid_gid},
+    {"apply_rlimits", do_apply_rlimits},
+    {"set_env", do_set_env},
+    {"renice", do_renice},
+    {"set_affinity", do_set_affinity},
+    {"reduce_variance", do_reduce_variance},
+    {"set_new_privs", do_set_new_privs},
+    {"wait_parent", do_wait_parent},
+    {"callback", do_callback},
+    {"seccomp", do_seccomp},
+    {"exec", do_exec},
+};
+
+static_assert(sizeof(spawn_steps) / sizeof(spawn_steps[0]) == Cgroup::SPAWN_STEP_COUNT, "spawn_steps does not match spawn_step_t");
+
+const char * Cgroup::spawn_step_name(int step) {
+    if (step < 0 || step >= SPAWN_STEP_COUNT) return "unknown";
+    return spawn_steps[step].name;
+}
+
+/**
+ * run spawn steps [first, end) in child, record progress in report.
+ * report.failed_step is the current step, or -1 when exec is called.
+ * @return  0           all steps succeeded (exec is not in range)
+ *         -1           a step failed, or exec failed
+ */
+static int run_spawn_steps(const Cgroup::spawn_arg& arg, Cgroup::spawn_report& report, int first, int end) {
+    double step_start = now();
+    for (int step = first; step < end; ++step) {
+        // the parent reads report after the socket to the parent is closed,
+        // either by exec (CLOEXEC) or by exit
+        report.failed_step = (step == Cgroup::STEP_EXEC) ? -1 : step;
+        int ret = spawn_steps[step].func(arg);
+        int saved_errno = errno;
+
+        double t = now();
+        report.step_time[step] = t - step_start;
+        step_start = t;
+        if (ret) {
+            report.failed_step = step;
+            report.error = saved_errno;
+            return -1;
+        }
     }
+    return 0;
+}
+
+struct clone_main_arg {
+    Cgroup::spawn_arg *arg;
+    Cgroup::spawn_report *report;   // shared with parent
+};
 
-    // exec or callback failed
-    // notify parent that exec failed
-    strncpy(buf, "ERR", sizeof buf);
-    ret = write(arg.sockets[0], buf, sizeof buf);
-    (void)ret;
+static int clone_main_fn(void * clone_arg) {
+    // kill us if parent dies
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
 
-    // wait parent
-    ret = read(arg.sockets[0], buf, sizeof buf);
-    (void)ret;
+    // this is executed in child process after clone
+    // fs and uid settings should be done here
+    Cgroup::spawn_arg& arg = *((clone_main_arg*)clone_arg)->arg;
+    Cgroup::spawn_report& report = *((clone_main_arg*)clone_arg)->report;
 
-    return -1;
+#ifdef SYSCTL_PER_NS_WORKS
+    // NOTE: Do not uncomment this until sysctl per namespace works.
+    // current kernel use global variables for vm.oom_kill_allocating_task,
+    // etc.
+    do_set_sysctl();
+#endif
+
+    return run_spawn_steps(arg, report, 0, Cgroup::SPAWN_STEP_COUNT);
 } // clone_main_fn
 
 static int is_setns_pidns_supported() {
@@ -1076,36 +1996,217 @@ static string clone_flags_to_str(int clone_flags) {
 }
 #endif
 
-pid_t Cgroup::spawn(spawn_arg& arg) {
-    // uid and gid should > 0
-    if (arg.uid <= 0 || arg.gid <= 0) {
-        WARNING("uid and gid can not <= 0. spawn rejected");
-        return -2;
+// older headers do not have clone3
+#ifndef __NR_clone3
+# define __NR_clone3 435
+#endif
+#ifndef CLONE_PIDFD
+# define CLONE_PIDFD 0x1000
+#endif
+#ifndef CLONE_INTO_CGROUP
+# define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+
+// struct clone_args, including the cgroup field (Linux >= 5.7)
+struct clone3_args {
+    uint64_t flags;
+    uint64_t pidfd;
+    uint64_t child_tid;
+    uint64_t parent_tid;
+    uint64_t exit_signal;
+    uint64_t stack;
+    uint64_t stack_size;
+    uint64_t tls;
+    uint64_t set_tid;
+    uint64_t set_tid_size;
+    uint64_t cgroup;
+};
+
+/**
+ * fork a child with clone3 and get its pidfd (Linux >= 5.3)
+ * @param   clone_flags     clone flags, the low byte is the exit signal
+ * @param   cgroup_fd       cgroup v2 directory fd to fork the child directly
+ *                          into (Linux >= 5.7), -1 to stay in current cgroup
+ * @param   pidfd           set to pidfd of the child
+ * @return  same as fork()
+ */
+static pid_t clone3_pidfd(int clone_flags, int cgroup_fd, int *pidfd) {
+    struct clone3_args args;
+    memset(&args, 0, sizeof args);
+    args.flags = (uint64_t)(clone_flags & ~CSIGNAL) | CLONE_PIDFD;
+    args.pidfd = (uint64_t)(uintptr_t)pidfd;
+    args.exit_signal = (uint64_t)(clone_flags & CSIGNAL);
+    if (cgroup_fd >= 0) {
+        args.flags |= CLONE_INTO_CGROUP;
+        args.cgroup = (uint64_t)cgroup_fd;
+    }
+    return (pid_t)syscall(__NR_clone3, &args, sizeof args);
+}
+
+// a request to the zygote, sent with [stdin, stdout, status socket]
+struct zygote_request {
+    int rlimit_count;  // -1: keep rlimits of spawn_arg
+    int resources[RLIMIT_NLIMITS];
+    rlim_t values[RLIMIT_NLIMITS];
+};
+
+// the reply, sent with the pidfds of the child and its init, if any
+struct zygote_reply {
+    int error;
+    int has_child;
+    int has_init;
+};
+
+/**
+ * create a new pid namespace and its dummy init for the next child, so
+ * killing the init kills everything the child started but not the zygote.
+ * children are still created by the zygote, with CLONE_PARENT
+ * @param   self_pidns_fd   pid namespace of the zygote
+ * @param   fds             fds the init should not hold
+ * @return  pidfd of init, -1 if failed and the next child is in the pid
+ *          namespace of the zygote
+ */
+static int zygote_spawn_init(int self_pidns_fd, const int *fds, int nfds) {
+    // unshare requires the namespace for children to be the zygote's own
+    if (self_pidns_fd < 0 || syscall(SYS_setns, self_pidns_fd, CLONE_NEWPID)) return -1;
+    if (unshare(CLONE_NEWPID)) return -1;
+
+    // the first process in a new pid namespace is its init
+    int pidfd = -1;
+    pid_t pid = clone3_pidfd(CLONE_PARENT, -1, &pidfd);
+    if (pid == 0) {
+        // /proc/self/fd may be missing in the chroot, see clone_init_fn
+        for (int i = 0; i < nfds; ++i) close(fds[i]);
+        close(self_pidns_fd);
+        _exit(clone_init_fn(NULL));
+    }
+    if (pid < 0) {
+        syscall(SYS_setns, self_pidns_fd, CLONE_NEWPID);
+        return -1;
+    }
+    return pidfd;
+}
+
+static int clone_zygote_fn(void * clone_arg) {
+    // kill us if parent dies
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+    Cgroup::spawn_arg& arg = *((clone_main_arg*)clone_arg)->arg;
+    Cgroup::spawn_report& report = *((clone_main_arg*)clone_arg)->report;
+
+    // opened before /proc is remounted. without pid namespace isolation,
+    // children share the pid namespace of the zygote
+    int self_pidns_fd = (arg.clone_flags & CLONE_NEWPID) ? open("/proc/self/ns/pid", O_RDONLY | O_CLOEXEC) : -1;
+
+    // namespace and filesystem setup is shared by all children
+    if (run_spawn_steps(arg, report, 0, Cgroup::STEP_SET_UMASK)) return 1;
+
+    report.failed_step = -1;
+    int sock = arg.sockets[0];
+    char buf[1] = {'R'};
+    if (send(sock, buf, sizeof buf, MSG_NOSIGNAL) < 0) return 1;
+
+    // each request is a zygote_request and [stdin, stdout, status socket],
+    // the reply is an errno, the pidfd of the child and the pidfd of its init
+    for (;;) {
+        zygote_request request;
+        int fds[3];
+        int nfds = 3;
+        ssize_t len = fdpass::recv(sock, &request, sizeof request, fds, &nfds);
+        if (len <= 0) break;  // parent closed the socket
+        if (nfds != 3 || len != (ssize_t)sizeof request || request.rlimit_count > RLIMIT_NLIMITS) {
+            for (int i = 0; i < nfds; ++i) close(fds[i]);
+            zygote_reply reply = {EINVAL, 0, 0};
+            fdpass::send(sock, &reply, sizeof reply);
+            continue;
+        }
+
+        int keep_out_fds[4] = {fds[0], fds[1], fds[2], sock};
+        int pidfds[2] = {-1, zygote_spawn_init(self_pidns_fd, keep_out_fds, 4)};
+
+        // CLONE_PARENT: the child is waited by lrun, not by the zygote
+        pid_t pid = clone3_pidfd(CLONE_PARENT, -1, &pidfds[0]);
+        if (pid == 0) {
+            prctl(PR_SET_PDEATHSIG, SIGKILL);
+            close(sock);
+            if (request.rlimit_count >= 0) {
+                arg.rlimits.clear();
+                for (int i = 0; i < request.rlimit_count; ++i) arg.rlimits[request.resources[i]] = request.values[i];
+            }
+            report.failed_step = Cgroup::STEP_PROCESS_FDS;
+            if (do_fd_redirect(STDIN_FILENO, fds[0]) || do_fd_redirect(STDOUT_FILENO, fds[1])) {
+                report.error = errno;
+                _exit(1);
+            }
+            if (fds[0] != STDIN_FILENO) close(fds[0]);
+            if (fds[1] != STDOUT_FILENO) close(fds[1]);
+            arg.sockets[0] = fds[2];
+            _exit(run_spawn_steps(arg, report, Cgroup::STEP_SET_UMASK, Cgroup::SPAWN_STEP_COUNT) ? 1 : 0);
+        }
+
+        zygote_reply reply;
+        reply.error = pid < 0 ? errno : 0;
+        reply.has_child = pid > 0;
+        reply.has_init = pidfds[1] >= 0;
+        for (int i = 0; i < nfds; ++i) close(fds[i]);
+
+        // the init is a child of lrun, which reaps it
+        int reply_fds[2];
+        int reply_nfds = 0;
+        for (int i = 0; i < 2; ++i) if (pidfds[i] >= 0) reply_fds[reply_nfds++] = pidfds[i];
+        fdpass::send(sock, &reply, sizeof reply, reply_fds, reply_nfds);
+        for (int i = 0; i < reply_nfds; ++i) close(reply_fds[i]);
     }
 
-    // stack size for cloned processes
+    return 0;
+} // clone_zygote_fn
+
+// stack size for cloned processes
+static long clone_stack_size() {
     long stack_size = sysconf(_SC_PAGESIZE);
     static const long MIN_STACK_SIZE = 8192;
     if (stack_size < MIN_STACK_SIZE) stack_size = MIN_STACK_SIZE;
+    return stack_size;
+}
 
-    // We need root permissions and drop root later, no CLONE_NEWUSER here
-    // CLONE_NEWNS is required for private mounts
-    // CLONE_NEWUSER is not used because new uid 0 may be non-root
-    int clone_flags = CLONE_NEWNS | SIGCHLD | arg.clone_flags;
-
+int Cgroup::spawn_init(spawn_arg& arg, int& clone_flags) {
     // older kernel (ex. Debian 7, 3.2.0) doesn't support setns(whatever, CLONE_PIDNS)
     // just do not create init process in that case.
     if (is_setns_pidns_supported() && (clone_flags & CLONE_NEWPID) == CLONE_NEWPID) {
+        long stack_size = clone_stack_size();
+
+        if (init_pid_) {
+            // spawned before, new processes would be created in the pid
+            // namespace of the previous init, which may be dead
+            string self_pidns_path = string(fs::PROC_PATH) + "/self/ns/pid";
+            int self_pidns_fd = open(self_pidns_path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (self_pidns_fd < 0 || syscall(SYS_setns, self_pidns_fd, CLONE_NEWPID)) {
+                ERROR("can not reset pid namespace");
+                if (self_pidns_fd >= 0) close(self_pidns_fd);
+                return -3;
+            }
+            close(self_pidns_fd);
+            if (init_pidfd_ >= 0) {
+                pidfd::reap(init_pidfd_);
+                close(init_pidfd_);
+            }
+            init_pidfd_ = -1;
+        }
+
         // create a dummy init process in a new namespace
         // CLONE_PTRACE: prevent the process being traced by another process
         INFO("spawning dummy init process");
-        int init_clone_flags = CLONE_NEWPID;
+        // CLONE_PARENT: init is a child of our parent, like the child
+        int init_clone_flags = CLONE_NEWPID | (clone_flags & CLONE_PARENT);
         init_pid_ = clone(clone_init_fn, (void*)((char*)alloca(stack_size) + stack_size), init_clone_flags, &arg);
         if (init_pid_ < 0) {
             ERROR("can not spawn init process");
             return -3;
         }
 
+        // used to wait for the pid namespace to be empty
+        init_pidfd_ = pidfd::open(init_pid_);
+
         // switch to that pid namespace for our next clone
         string pidns_path = string(fs::PROC_PATH) + "/" + strconv::from_ulong((unsigned long)init_pid_) + "/ns/pid";
         INFO("set pid ns to %s", pidns_path.c_str());
@@ -1126,65 +2227,138 @@ pid_t Cgroup::spawn(spawn_arg& arg) {
         clone_flags ^= CLONE_NEWPID;
     } // spawn init process
 
+    return 0;
+}
+
+pid_t Cgroup::spawn(spawn_arg& arg) {
+    // uid and gid should > 0
+    if (arg.uid <= 0 || arg.gid <= 0) {
+        WARNING("uid and gid can not <= 0. spawn rejected");
+        return -2;
+    }
+
+    long stack_size = clone_stack_size();
+
+    // We need root permissions and drop root later, no CLONE_NEWUSER here
+    // CLONE_NEWNS is required for private mounts
+    // CLONE_NEWUSER is not used because new uid 0 may be non-root
+    int clone_flags = CLONE_NEWNS | SIGCHLD | arg.clone_flags;
+
+    // the previous kill must finish before the new init and child join
+    // the cgroup
+    if (kill_pending_) {
+        wait_empty();
+        kill_pending_ = false;
+    }
+
+    int e = spawn_init(arg, clone_flags);
+    if (e) return e;
+
+    // the previous child is gone, do not leak its pidfd
+    if (child_pidfd_ >= 0) close(child_pidfd_);
+    child_pidfd_ = -1;
+
     DEBUG_DO {
         INFO("clone flags = 0x%x = %s", (int)clone_flags, clone_flags_to_str(clone_flags).c_str());
     }
 
-    // do sync use socket pair
-    if (socketpair(AF_LOCAL, SOCK_STREAM, 0, arg.sockets)) {
+    // do sync use socket pair. sockets fds should expire when exec
+    if (socketpair(AF_LOCAL, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, arg.sockets)) {
         ERROR("socketpair failed");
         return -1;
     }
 
-    // sockets fds should expire when exec
-    fd_set_cloexec(arg.sockets[0]);
-    fd_set_cloexec(arg.sockets[1]);
+    // the child reports its progress here, the parent reads it after the
+    // child execs or exits
+    clone_main_arg main_arg;
+    main_arg.arg = &arg;
+    main_arg.report = (spawn_report *)mmap(NULL, sizeof(spawn_report), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (main_arg.report == MAP_FAILED) {
+        ERROR("mmap failed");
+        close(arg.sockets[0]);
+        close(arg.sockets[1]);
+        return -1;
+    }
+    memset(main_arg.report, 0, sizeof(spawn_report));
+    main_arg.report->failed_step = STEP_SET_UTS;
+
+    pid_t child_pid = -1;
+    bool attached = false;
+
+    // the child is born in the cgroup with clone3, so resource counters
+    // count it from the first instruction and attach() is not needed
+    static std::atomic<bool> clone3_supported(true);
+    if (version() == 2 && clone3_supported.load()) {
+        int pidfd = -1;
+        child_pid = clone3_pidfd(clone_flags, subsys_fd(CG_CPUACCT), &pidfd);
+        if (child_pid == 0) {
+            // child, like what clone() does with clone_main_fn
+            _exit(clone_main_fn(&main_arg));
+        } else if (child_pid > 0) {
+            attached = true;
+            child_pidfd_ = pidfd;
+        } else {
+            INFO("clone3 failed, fallback to clone");
+            if (errno == ENOSYS || errno == E2BIG) clone3_supported.store(false);
+        }
+    }
 
-    pid_t child_pid;
-    child_pid = clone(clone_main_fn, (void*)((char*)alloca(stack_size) + stack_size), clone_flags, &arg);
-    char buf[4];
-    ssize_t ret;
+    if (child_pid < 0) {
+        child_pid = clone(clone_main_fn, (void*)((char*)alloca(stack_size) + stack_size), clone_flags, &main_arg);
+    }
 
     if (child_pid < 0) {
-        FATAL("clone failed");
+        ERROR("clone failed");
+        close(arg.sockets[0]);
         goto cleanup;
     }
 
     INFO("child pid = %lu", (unsigned long)child_pid);
+    if (init_pidfd_ >= 0 && child_pidfd_ < 0) child_pidfd_ = pidfd::open(child_pid);
 
-    // attach child to current cgroup. cpu and memory
-    // resource counter start to work from here
-    INFO("attach %lu", (unsigned long)child_pid);
-    attach(child_pid);
+    if (!attached) {
+        // attach child to current cgroup. cpu and memory
+        // resource counter start to work from here
+        INFO("attach %lu", (unsigned long)child_pid);
+        attach(child_pid);
+    }
 
-    // child is blocking, waiting us before exec
-    // it's time to let the child go
-    strncpy(buf, "RUN", sizeof buf);
     close(arg.sockets[0]);
-    ret = send(arg.sockets[1], buf, sizeof buf, MSG_NOSIGNAL);
-    if (ret < 0) {
-        WARNING("can not send let-go message to child");
-        goto cleanup;
-    }
+    e = finish_spawn(child_pid, arg.sockets[1], *main_arg.report);
+    // a failed child exits by itself, do not leave a zombie. with
+    // CLONE_PARENT, it is reaped by our parent
+    if (e < 0) waitpid(child_pid, NULL, __WALL);
+    child_pid = e;
+
+cleanup:
+    close(arg.sockets[1]);
+    munmap(main_arg.report, sizeof(spawn_report));
+
+    return child_pid;
+}
 
-    // wait for child response
-    INFO("reading from child");
+pid_t Cgroup::finish_spawn(pid_t child_pid, int sock, const spawn_report& report) {
+    // the child may still be doing setup. let it go once it is ready
+    char buf[1] = {'G'};
+    if (send(sock, buf, sizeof buf, MSG_NOSIGNAL) < 0) {
+        // the child has exited, the report tells why
+        INFO("can not send let-go message to child");
+    }
 
-    buf[0] = 0;
-    ret = read(arg.sockets[1], buf, sizeof buf);
+    // the child closes its end by exec or exit
+    INFO("waiting for child exec");
+    while (read(sock, buf, sizeof buf) < 0 && errno == EINTR);
 
-    INFO("from child, got '%3s'", buf);
-    if (buf[0] != 'P' || ret <= 0) {  // excepting "PRE"
-        // child has problem to start
-        child_pid = -3;
-        goto cleanup;
+    spawn_report_ = report;
+    DEBUG_DO {
+        for (int i = 0; i < SPAWN_STEP_COUNT; ++i) {
+            if (spawn_report_.step_time[i] > 0) INFO("spawn step %s: %.3f ms", spawn_step_name(i), spawn_report_.step_time[i] * 1000);
+        }
     }
 
-    // child exec may fail, confirm
-    if (read(arg.sockets[1], buf, sizeof buf) > 0 && buf[0] == 'E') {  // "ERR"
-        INFO("seems child exec failed");
-        child_pid = -4;
-        goto cleanup;
+    if (spawn_report_.failed_step >= 0) {
+        INFO("child failed at step %s", spawn_step_name(spawn_report_.failed_step));
+        return spawn_report_.failed_step < STEP_CALLBACK ? -3 : -4;
     }
 
     // the child has exec successfully
@@ -1195,8 +2369,188 @@ pid_t Cgroup::spawn(spawn_arg& arg) {
     INFO("disabling oom killer");
     if (set(CG_MEMORY, "memory.oom_control", "1\n")) INFO("can not set memory.oom_control");
 
-cleanup:
-    close(arg.sockets[1]);
     return child_pid;
 }
 
+const Cgroup::spawn_report& Cgroup::last_spawn_report() const {
+    return spawn_report_;
+}
+
+pid_t Cgroup::release_spawned(int& init_pidfd, int& child_pidfd) {
+    pid_t init_pid = init_pid_ > 0 ? init_pid_ : 0;
+    init_pidfd = init_pidfd_;
+    child_pidfd = child_pidfd_;
+    init_pid_ = 0;
+    init_pidfd_ = -1;
+    child_pidfd_ = -1;
+    return init_pid;
+}
+
+void Cgroup::adopt_spawned(pid_t init_pid, int init_pidfd, int child_pidfd) {
+    // the previous ones are done, like in spawn_init and spawn
+    if (init_pidfd_ >= 0) {
+        pidfd::reap(init_pidfd_);
+        close(init_pidfd_);
+    }
+    if (child_pidfd_ >= 0) close(child_pidfd_);
+    init_pid_ = init_pid;
+    init_pidfd_ = init_pidfd;
+    child_pidfd_ = child_pidfd;
+}
+
+int Cgroup::start_zygote(spawn_arg& arg) {
+    if (arg.uid <= 0 || arg.gid <= 0) {
+        WARNING("uid and gid can not <= 0. spawn rejected");
+        return -2;
+    }
+
+    long stack_size = clone_stack_size();
+    int clone_flags = CLONE_NEWNS | SIGCHLD | arg.clone_flags;
+    int e = spawn_init(arg, clone_flags);
+    if (e) return e;
+
+    if (socketpair(AF_LOCAL, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, arg.sockets)) {
+        ERROR("socketpair failed");
+        return -1;
+    }
+
+    // shared by the zygote and all its children
+    zygote_report_ = (spawn_report *)mmap(NULL, sizeof(spawn_report), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (zygote_report_ == MAP_FAILED) {
+        ERROR("mmap failed");
+        zygote_report_ = NULL;
+        close(arg.sockets[0]);
+        close(arg.sockets[1]);
+        return -1;
+    }
+    memset(zygote_report_, 0, sizeof(spawn_report));
+    zygote_report_->failed_step = STEP_SET_UTS;
+
+    // the zygote is not attached, only children running the program are
+    clone_main_arg main_arg;
+    main_arg.arg = &arg;
+    main_arg.report = zygote_report_;
+    INFO("spawning zygote");
+    zygote_pid_ = clone(clone_zygote_fn, (void*)((char*)alloca(stack_size) + stack_size), clone_flags, &main_arg);
+    close(arg.sockets[0]);
+    if (zygote_pid_ < 0) {
+        ERROR("clone failed");
+        close(arg.sockets[1]);
+        return -1;
+    }
+    zygote_sock_ = arg.sockets[1];
+
+    // wait for "ready", or EOF if a setup step failed
+    char buf[1];
+    ssize_t len;
+    while ((len = read(zygote_sock_, buf, sizeof buf)) < 0 && errno == EINTR);
+    spawn_report_ = *zygote_report_;
+    if (len <= 0) {
+        INFO("zygote failed at step %s", spawn_step_name(spawn_report_.failed_step));
+        stop_zygote();
+        return -3;
+    }
+
+    INFO("zygote pid = %lu", (unsigned long)zygote_pid_);
+    return 0;
+}
+
+pid_t Cgroup::spawn_from_zygote(int stdin_fd, int stdout_fd, const std::map<int, rlim_t> *rlimits) {
+    if (zygote_pid_ <= 0) return -1;
+
+    // the init of the previous child is no longer needed
+    stop_zygote_init();
+
+    // previous child may leave it disabled
+    if (set(CG_MEMORY, "memory.oom_control", "0\n")) INFO("can not set memory.oom_control");
+
+    int sockets[2];
+    if (socketpair(AF_LOCAL, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets)) {
+        ERROR("socketpair failed");
+        return -1;
+    }
+
+    memset(zygote_report_, 0, sizeof(spawn_report));
+    zygote_report_->failed_step = STEP_SET_UMASK;
+
+    zygote_request request;
+    memset(&request, 0, sizeof request);
+    request.rlimit_count = -1;
+    if (rlimits) {
+        request.rlimit_count = 0;
+        FOR_EACH(p, *rlimits) {
+            if (p.first < 0 || p.first >= RLIMIT_NLIMITS) continue;
+            request.resources[request.rlimit_count] = p.first;
+            request.values[request.rlimit_count++] = p.second;
+        }
+    }
+
+    int fds[3] = {stdin_fd, stdout_fd, sockets[0]};
+    zygote_reply reply;
+    int pidfds[2] = {-1, -1};
+    int nfds = 2;
+    if (fdpass::send(zygote_sock_, &request, sizeof request, fds, 3)
+            || fdpass::recv(zygote_sock_, &reply, sizeof reply, pidfds, &nfds) != (ssize_t)sizeof reply
+            || nfds != reply.has_child + reply.has_init) {
+        ERROR("can not talk to zygote");
+        for (int i = 0; i < nfds; ++i) close(pidfds[i]);
+        close(sockets[0]);
+        close(sockets[1]);
+        return -1;
+    }
+    close(sockets[0]);
+
+    int pidfd = reply.has_child ? pidfds[0] : -1;
+    if (reply.has_init) zygote_init_pidfd_ = pidfds[nfds - 1];
+
+    pid_t child_pid = pidfd >= 0 ? pidfd::get_pid(pidfd) : -1;
+    if (reply.error || child_pid <= 0) {
+        errno = reply.error;
+        ERROR("zygote can not fork");
+        if (pidfd >= 0) close(pidfd);
+        close(sockets[1]);
+        stop_zygote_init();
+        return -1;
+    }
+
+    INFO("child pid = %lu", (unsigned long)child_pid);
+    if (child_pidfd_ >= 0) close(child_pidfd_);
+    child_pidfd_ = pidfd;
+
+    INFO("attach %lu", (unsigned long)child_pid);
+    attach(child_pid);
+
+    child_pid = finish_spawn(child_pid, sockets[1], *zygote_report_);
+    close(sockets[1]);
+    return child_pid;
+}
+
+void Cgroup::stop_zygote_init() {
+    if (zygote_init_pidfd_ < 0) return;
+
+    // killing init kills its pid namespace. wait for it, it is our child
+    pidfd::send_signal(zygote_init_pidfd_, SIGKILL);
+    struct pollfd pfd;
+    pfd.fd = zygote_init_pidfd_;
+    pfd.events = POLLIN;
+    while (poll(&pfd, 1, -1) < 0 && errno == EINTR);
+    pidfd::reap(zygote_init_pidfd_);
+    close(zygote_init_pidfd_);
+    zygote_init_pidfd_ = -1;
+}
+
+void Cgroup::stop_zygote() {
+    stop_zygote_init();
+    if (zygote_pid_ <= 0) return;
+
+    // the zygote exits on EOF, kill it anyway in case it is stuck
+    close(zygote_sock_);
+    zygote_sock_ = -1;
+    kill(zygote_pid_, SIGKILL);
+    while (waitpid(zygote_pid_, NULL, 0) < 0 && errno == EINTR);
+    zygote_pid_ = -1;
+
+    munmap(zygote_report_, sizeof(spawn_report));
+    zygote_report_ = NULL;
+}
+
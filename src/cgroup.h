@@ -26,6 +26,7 @@
 #include <map>
 #include <set>
 #include <list>
+#include <vector>
 #include <sys/resource.h>
 #include "seccomp.h"
 
@@ -51,14 +52,31 @@ namespace lrun {
                 CG_MEMORY  = 1,
                 CG_DEVICES = 2,
                 CG_FREEZER = 3,
+                CG_PIDS    = 4,  // optional
+                CG_CPU     = 5,  // optional
+                CG_CPUSET  = 6,  // optional
             };
 
             /**
              * cgroup subsystem names
              */
-            static const char subsys_names[4][8];
+            static const char subsys_names[7][8];
             static const int SUBSYS_COUNT = sizeof(subsys_names) / sizeof(subsys_names[0]);
 
+            /**
+             * subsystems before this id must be available. optional ones
+             * are used if they are mounted (v1) or enabled (v2), and on v1,
+             * only joined if they are asked for by create()
+             */
+            static const int REQUIRED_SUBSYS_COUNT = CG_PIDS;
+
+            /**
+             * check if an optional subsystem can be used
+             * @param   subsys_id       cgroup subsystem id
+             * @return  true            available
+             */
+            static bool subsys_available(subsys_id_t subsys_id);
+
             /**
              * get cgroup subsystem id from name
              * @param   name            cgroup subsystem name
@@ -67,25 +85,56 @@ namespace lrun {
              */
             static int subsys_id_from_name(const char * const name);
 
+            /**
+             * get cgroup version, detected at runtime.
+             * v1 is used if all subsystems are mounted. otherwise, v2
+             * (unified hierarchy) is used if it has the memory controller.
+             * in v2, all subsystems share a same directory.
+             * @return  1 or 2
+             */
+            static int version();
+
             /**
              * get cgroup mounted path
              * @param   create_on_need  mount cgroup if not mounted
              * @return  cgroup mounted path (first one in mount table)
+             *          for v2, it is "lrun" directory in mounted path
              */
             static std::string base_path(subsys_id_t subsys_id, bool create_on_need = true);
 
+            /**
+             * detect the version and fill the caches of version(),
+             * base_path() and subsys_available(), once. after it succeeds
+             * they only read the caches and are safe to call from any
+             * thread. without it, the caches are filled on first use
+             * @return  0               success
+             *         <0               failed
+             */
+            static int init();
+
 
             /**
              * create a cgroup, use existing if possible
+             * @param   optional_subsys bits (1 << subsys_id) of optional
+             *                          subsystems to use. on v1, each one
+             *                          is a directory to create, attach to
+             *                          and remove, so only ask for used ones
              * @return  Cgroup object
              */
-            static Cgroup create(const std::string& name);
+            static Cgroup create(const std::string& name, int optional_subsys = 0);
 
             /**
+             * @param   optional_subsys see create()
              * @return  1           exist
              *          0           not exist
              */
-            static int exists(const std::string& name);
+            static int exists(const std::string& name, int optional_subsys = 0);
+
+            /**
+             * @return  true if an optional subsystem is available and asked
+             *          for by create()
+             */
+            bool has_subsys(subsys_id_t subsys_id) const;
 
             /**
              * @param   subsys_id   cgroup subsystem id
@@ -100,6 +149,12 @@ namespace lrun {
              */
             std::string subsys_path(subsys_id_t subsys_id = CG_CPUACCT) const;
 
+            /**
+             * Cgroup holds fds and is not copyable, but it can be moved
+             */
+            Cgroup(Cgroup&& other);
+            ~Cgroup();
+
             // Cgroup low level methods
 
             /**
@@ -153,6 +208,14 @@ namespace lrun {
             bool valid() const;
 
 
+            /**
+             * identify cgroup directories. a cgroup removed and created
+             * again with the same name has a different identity
+             * @return  string      inode numbers of cgroup directories,
+             *                      empty if fail
+             */
+            std::string identity() const;
+
             /**
              * scan group processes and update output usage
              */
@@ -170,6 +233,16 @@ namespace lrun {
              */
             std::list<pid_t> get_pids();
 
+            /**
+             * count threads (tasks) in the cgroup, using pids.current if
+             * the pids cgroup is used
+             * @return  count      number of threads, 0 if failed. without
+             *                     pids.current, at most THREAD_COUNT_MAX
+             */
+            int thread_count() const;
+
+            static const int THREAD_COUNT_MAX = 1024;
+
             // Cgroup high level methods
 
             /**
@@ -188,12 +261,22 @@ namespace lrun {
 
             /**
              * kill all tasks until no more tasks alive.
+             * use cgroup.kill (v2) or kill the pid namespace init if possible,
+             * otherwise fallback to freeze, kill and thaw loops.
              *
              * @param   confirm     true: block until all tasks are confirmed gone
              *                      false: just send kill, do not confirm
              */
             void killall(bool confirm = true);
 
+            /**
+             * kill all tasks except one, usually a fork server. use freeze,
+             * kill and thaw loops. block until other tasks are gone
+             *
+             * @param   keep_pid    the process to keep
+             */
+            void killall_except(pid_t keep_pid);
+
             /**
              * use freezer cgroup subsystem to freeze processes
              * if freeze is non-zero, the method will block until
@@ -232,6 +315,53 @@ namespace lrun {
              */
             double cpu_usage() const;
 
+            /**
+             * get cpu usage of each cpu (cgroup v1 only)
+             * @return  cpu usages in seconds, indexed by cpu.
+             *          empty if not available
+             */
+            std::vector<double> cpu_usage_percpu() const;
+
+            /**
+             * read a flat keyed file, ex. memory.stat, cpu.stat
+             * @param   subsys_id       cgroup subsystem id
+             * @param   property        file name
+             * @return  key value pairs. empty if the file can not be read
+             */
+            std::map<std::string, long long> get_stats(subsys_id_t subsys_id, const std::string& property) const;
+
+            /**
+             * get anonymous memory, page cache and swap charged to the
+             * cgroup, from memory.stat (and memory.swap.current on v2)
+             * @param   rss             bytes, -1 if not available
+             * @param   cache           bytes, -1 if not available
+             * @param   swap            bytes, -1 if swap is not accounted
+             */
+            void memory_stat(long long& rss, long long& cache, long long& swap) const;
+
+            /**
+             * get pressure stall information (cgroup v2)
+             * @param   resource        "cpu", "memory" or "io"
+             * @return  total seconds some tasks were stalled on the
+             *          resource, -1 if not available
+             */
+            double pressure_stall(const std::string& resource) const;
+
+            /**
+             * register an eventfd which will be notified when the memory
+             * cgroup is under oom, using cgroup.event_control
+             * @return  >=0         eventfd, the caller should close it
+             *          <0          failed
+             */
+            int oom_eventfd();
+
+            /**
+             * consume events from the fd returned by oom_eventfd
+             * @return  1           the cgroup has been under oom
+             *          0           otherwise
+             */
+            int read_oom_event(int fd);
+
             /**
              * set memory usage limit
              * @param   bytes       limit, no limit if bytes <= 0
@@ -240,6 +370,72 @@ namespace lrun {
              */
             int set_memory_limit(long long bytes);
 
+            /**
+             * reclaim memory charged to the cgroup, mostly page cache,
+             * using memory.reclaim (v2) or memory.force_empty (v1, only
+             * works if the cgroup has no tasks)
+             * @return  0           success
+             *         <0           failed
+             */
+            int reclaim_memory();
+
+            /**
+             * set pids.max, the number of tasks (processes and threads)
+             * the cgroup can have. fork and clone fail with EAGAIN when
+             * the limit is reached
+             * @param   count       limit, no limit if count <= 0
+             * @return  0           success
+             *         <0           failed or pids is not available
+             */
+            int set_pids_limit(long long count);
+
+            /**
+             * limit cpu bandwidth using cpu.cfs_quota_us (v1) or
+             * cpu.max (v2), with a 100ms period
+             * @param   cpus        cpu time per real time, ex. 1.0 for one
+             *                      core's worth. no limit if cpus <= 0
+             * @return  0           success
+             *         <0           failed or cpu is not available
+             */
+            int set_cpu_quota(double cpus);
+
+            /**
+             * set the share of cpu time under contention, using
+             * cpu.weight (v2) or cpu.shares (v1)
+             * @param   weight      1 to 10000, default (100) if weight <= 0
+             * @return  0           success
+             *         <0           failed or cpu is not available
+             */
+            int set_cpu_weight(int weight);
+
+            /**
+             * set cpuset.cpus and cpuset.mems
+             * @param   cpus        cpu list like "0-3,8", empty: same as
+             *                      the parent
+             * @param   mems        NUMA node list, empty: same as the parent
+             * @return  0           success
+             *         <0           failed or cpuset is not available
+             */
+            int set_cpuset(const std::string& cpus, const std::string& mems);
+
+            /**
+             * get cpus the cgroup can use, after restrictions from parents
+             * @return  cpu list like "0-3,8", empty if not available
+             */
+            std::string cpuset_cpus() const;
+
+            /**
+             * get the number of tasks in the cgroup
+             * @return  count, -1 if pids is not available
+             */
+            long long pids_current() const;
+
+            /**
+             * get how many times fork or clone failed because of pids.max
+             * @return  count, -1 if pids is not available
+             */
+            long long pids_limit_hits() const;
+
             /**
              * restart cpuacct and memory max_usage_in_bytes
              * @return  0           success
@@ -274,11 +470,14 @@ namespace lrun {
                 mode_t umask;               // umask
                 int nice;                   // nice
                 bool no_new_privs;          // prctl PR_SET_NO_NEW_PRIVS
+                bool disable_aslr;          // personality ADDR_NO_RANDOMIZE
+                bool disable_thp;           // prctl PR_SET_THP_DISABLE
                 bool umount_outside;        // umount things outside chroot
                 int sockets[2];             // for sync between child and parent
                 std::string chroot_path;    // chroot path, empty if not need to chroot
                 std::string chdir_path;     // chdir path, empty if not need to chdir
                 std::string syscall_list;   // syscall whitelist or blacklist
+                int stdin_fd;               // redirect stdin from
                 int stdout_fd;              // redirect stdout to
                 int stderr_fd;              // redirect stderr to
                 struct {                    // set uts namespace strings
@@ -303,6 +502,7 @@ namespace lrun {
                 std::set<int> keep_fds;     // Do not close these fd
                 std::map<int, rlim_t> rlimits;
                                             // [resource, value] rlimit list
+                std::vector<int> cpu_affinity;  // sched_setaffinity, empty: unchanged
                 int reset_env;              // Do not inherit env
                 int remount_dev;            // Recreate a minimal dev
                 std::list<std::pair<std::string, std::string> > env_list;
@@ -312,18 +512,188 @@ namespace lrun {
                                             // run in the context of child process
             };
 
+            /**
+             * setup steps done by spawned child, in order
+             */
+            enum spawn_step_t {
+                STEP_SET_UTS = 0,
+                STEP_PROCESS_FDS,
+                STEP_PRIVATIZE_FILESYSTEM,
+                STEP_UMOUNT_OUTSIDE_CHROOT,
+                STEP_MOUNT_PROC,
+                STEP_HIDE_SENSITIVE,
+                STEP_MOUNT_BINDFS,
+                STEP_REMOUNTS,
+                STEP_CHROOT,
+                STEP_MOUNT_TMPFS,
+                STEP_REMOUNT_DEV,
+                STEP_CHDIR,
+                STEP_COMMANDS,
+                STEP_SET_UMASK,
+                STEP_SET_UID_GID,
+                STEP_APPLY_RLIMITS,
+                STEP_SET_ENV,
+                STEP_RENICE,
+                STEP_SET_AFFINITY,
+                STEP_REDUCE_VARIANCE,
+                STEP_SET_NEW_PRIVS,
+                STEP_WAIT_PARENT,
+                STEP_CALLBACK,
+                STEP_SECCOMP,
+                STEP_EXEC,
+                SPAWN_STEP_COUNT,
+            };
+
+            /**
+             * @return  step name, ex. "chroot"
+             */
+            static const char * spawn_step_name(int step);
+
+            /**
+             * written by spawned child before exec
+             */
+            struct spawn_report {
+                int failed_step;            // spawn_step_t, -1 if all steps succeeded
+                int error;                  // errno of the failed step, 0 if the
+                                            // child was killed
+                double step_time[SPAWN_STEP_COUNT];
+                                            // seconds used by each step
+            };
+
             /**
              * spawn child process and exec inside cgroup
              * child process is in other namespace in FS, PID, UTS, IPC, NET
              * child process is attached to cgroup just before exec
+             * with CLONE_PARENT in arg.clone_flags, the child and its dummy
+             * init are children of our parent, see release_spawned
              * @param   arg         swapn arg, @see struct spawn_arg
              * @return  pid         child pid, negative if failed
+             *         -3           a setup step failed, see last_spawn_report
+             *         -4           callback, seccomp or exec failed
              */
             pid_t spawn(spawn_arg& arg);
 
+            /**
+             * @return  report of the last spawn
+             */
+            const spawn_report& last_spawn_report() const;
+
+            /**
+             * give up the dummy init and the child of the last spawn, done
+             * with CLONE_PARENT for our parent. the pidfds are owned by the
+             * caller, usually passed to adopt_spawned in the parent
+             * @param   init_pidfd  set to pidfd of init, -1 if there is none
+             * @param   child_pidfd set to pidfd of the child, -1 if there is none
+             * @return  pid of init, 0 if there is none
+             */
+            pid_t release_spawned(int& init_pidfd, int& child_pidfd);
+
+            /**
+             * take over the dummy init and the child given up by
+             * release_spawned of the same cgroup. killall and wait_empty
+             * handle them as if spawn had created them
+             */
+            void adopt_spawned(pid_t init_pid, int init_pidfd, int child_pidfd);
+
+            /**
+             * start a zygote: a privileged template process which does the
+             * namespace and filesystem setup steps (up to STEP_COMMANDS)
+             * once, then forks children for spawn_from_zygote. the zygote
+             * is not attached to the cgroup
+             * @param   arg         spawn arg, @see struct spawn_arg
+             * @return  0           success
+             *         <0           failed, see last_spawn_report
+             */
+            int start_zygote(spawn_arg& arg);
+
+            /**
+             * spawn a child from the zygote. the child is attached to the
+             * cgroup, does the remaining steps and execs. its parent is
+             * the caller, so it can be waited as usual. if possible, the
+             * child runs in its own pid namespace so killall does not need
+             * to freeze the cgroup
+             * @param   stdin_fd    fd to use as stdin
+             * @param   stdout_fd   fd to use as stdout
+             * @param   rlimits     replace rlimits given to start_zygote,
+             *                      NULL to keep them
+             * @return  pid         child pid, negative if failed (same as spawn)
+             */
+            pid_t spawn_from_zygote(int stdin_fd, int stdout_fd, const std::map<int, rlim_t> *rlimits = NULL);
+
+            /**
+             * stop the zygote. processes left in the cgroup are killed by
+             * killall as usual
+             */
+            void stop_zygote();
+
         private:
 
             Cgroup();
+            Cgroup(const Cgroup&);
+            Cgroup& operator=(const Cgroup&);
+
+            /**
+             * counters which are read frequently, their fds are kept open
+             */
+            enum counter_id_t {
+                CNT_CPU_USAGE       = 0,  // cpuacct.usage
+                CNT_MEMSW_USAGE     = 1,  // memory.memsw.usage_in_bytes
+                CNT_MEMORY_USAGE    = 2,  // memory.usage_in_bytes
+                CNT_MEMSW_PEAK      = 3,  // memory.memsw.max_usage_in_bytes
+                CNT_MEMORY_PEAK     = 4,  // memory.max_usage_in_bytes
+                CNT_MEMORY_STAT     = 5,  // memory.stat
+                CNT_CPU_PRESSURE    = 6,  // cpu.pressure, v2 only
+                CNT_MEMORY_PRESSURE = 7,  // memory.pressure, v2 only
+                CNT_IO_PRESSURE     = 8,  // io.pressure, v2 only
+                CNT_SWAP_USAGE      = 9,  // memory.swap.current, v2 only
+                CNT_PIDS_CURRENT    = 10, // pids.current
+                CNT_PIDS_EVENTS     = 11, // pids.events
+            };
+            static const int COUNTER_COUNT = 12;
+
+            /**
+             * open a file in subsystem directory
+             * @return  fd          fd opened with O_CLOEXEC, negative if failed
+             */
+            int open_property(subsys_id_t subsys_id, const char *property, int flags) const;
+
+            /**
+             * @return  fd          subsystem directory fd
+             */
+            int subsys_fd(subsys_id_t subsys_id) const;
+
+            /**
+             * read a counter using its cached fd, open it on first use
+             * @param   buf         buffer, will be '\0' terminated
+             * @return  >=0         bytes read
+             *          <0          failed
+             */
+            ssize_t read_counter(counter_id_t counter_id, char *buf, size_t size) const;
+
+            /**
+             * read a counter as an integer
+             * @return  value       value, -1 if failed
+             */
+            long long counter_value(counter_id_t counter_id) const;
+
+            /**
+             * block until the cgroup is empty, after processes are killed.
+             * wait for cgroup.events (v2) or pid namespace init pidfd
+             * notifications instead of sleeping if possible
+             */
+            void wait_empty();
+
+            /**
+             * open subsystem directories
+             * @return  0           success
+             *         <0           failed
+             */
+            int open_fds();
+
+            /**
+             * close directory and counter fds
+             */
+            void close_fds();
 
             /**
              * cgroup directory name
@@ -340,10 +710,115 @@ namespace lrun {
              */
             pid_t init_pid_;
 
+            /**
+             * pidfd of init process, -1 if not available
+             */
+            int init_pidfd_;
+
+            /**
+             * pidfd of spawned child, -1 if not available.
+             * it is not a child of init and has to be reaped by us before
+             * init can exit
+             */
+            int child_pidfd_;
+
+            /**
+             * cgroup.kill was used without waiting for the cgroup to be
+             * empty. spawn waits first, a child cloned into the cgroup
+             * while the kill is in progress would be killed too
+             */
+            bool kill_pending_;
+
+            /**
+             * report of the last spawn
+             */
+            spawn_report spawn_report_;
+
+            /**
+             * zygote pid and the socket to talk to it, -1 if not started
+             */
+            pid_t zygote_pid_;
+            int zygote_sock_;
+
+            /**
+             * pidfd of the init process of the last zygote child, -1 if
+             * the child is in the pid namespace of the zygote
+             */
+            int zygote_init_pidfd_;
+
+            /**
+             * kill and reap zygote_init_pidfd_
+             */
+            void stop_zygote_init();
+
+            /**
+             * shared with the zygote and its children, see spawn_report
+             */
+            spawn_report *zygote_report_;
+
+            /**
+             * create the dummy init process and switch to its pid namespace
+             * @return  0           success
+             *         <0           failed
+             */
+            int spawn_init(spawn_arg& arg, int& clone_flags);
+
+            /**
+             * let the spawned child go and wait for it to exec
+             * @param   sock        parent end of the sync socket
+             * @param   report      written by the child
+             * @return  child_pid   success
+             *         -3, -4       failed, same as spawn
+             */
+            pid_t finish_spawn(pid_t child_pid, int sock, const spawn_report& report);
+
+            /**
+             * subsystem directory fds
+             */
+            int subsys_fds_[SUBSYS_COUNT];
+
+            /**
+             * counter fds, -1: not opened, -2: not available
+             */
+            mutable int counter_fds_[COUNTER_COUNT];
+
+            /**
+             * v2 only: cpu.stat can not be reset, remember the value at
+             * reset time instead. it is in a shared mapping so that a cloned
+             * process (ex. fs tracer) can reset it.
+             */
+            long long *cpu_usage_base_;
+
+            /**
+             * v2 only: oom count in memory.events when oom_eventfd is called
+             */
+            long long oom_count_base_;
+
+            /**
+             * optional_subsys passed to create()
+             */
+            int optional_subsys_;
+
+            /**
+             * whether the cgroup has a directory for the subsystem
+             */
+            bool has_directory(int subsys_id) const;
+
+            /**
+             * cached version
+             */
+            static int version_;
+
             /**
              * cached paths
              */
             static std::string subsys_base_paths_[SUBSYS_COUNT];
+
+            /**
+             * cached availability of optional subsystems,
+             * 0: unknown, 1: no, 2: yes
+             */
+            static int subsys_available_[SUBSYS_COUNT];
     };
 }
 
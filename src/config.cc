@@ -27,6 +27,8 @@
 #include <vector>
 #include "utils/fs.h"
 #include "utils/for_each.h"
+#include "utils/stats.h"
+#include "utils/strconv.h"
 #include "config.h"
 
 
@@ -40,13 +42,31 @@ MainConfig::MainConfig() {
     this->real_time_limit = -1;
     this->memory_limit = -1;
     this->output_limit = -1;
+    this->process_limit = -1;
+    this->cpu_quota = -1;
+    this->cpu_weight = -1;
+    this->repeat = 1;
+    this->repeat_statistic = "median";
+    this->quiet_machine = false;
+    this->exclusive_core = false;
+    this->idle_sibling = false;
+    this->exclusive_core_wait = -1;
     this->enable_devices_whitelist = false;
     this->enable_network = true;
     this->enable_pidns = true;
     this->interval = (useconds_t)(0.02 * 1000000);
+    this->telemetry_fd = -1;
+    this->telemetry_interval = 0.1;
+    this->status_board_interval = 0;
     this->active_cgroup = NULL;
     this->pass_exitcode = false;
+    this->async_cleanup = false;
+    this->cgroup_pool_size = 0;
+    this->batch_workers = 1;
+    this->batch_fail_fast = false;
     this->write_result_to_3 = fs::is_accessible("/proc/self/fd/3", F_OK);
+    this->report_format = "text";
+    this->memory_accounting = "total";
 
     // arg settings
     this->arg.nice = 0;
@@ -58,8 +78,11 @@ MainConfig::MainConfig() {
     this->arg.remount_dev = 0;
     this->arg.reset_env = 0;
     this->arg.no_new_privs = true;
+    this->arg.disable_aslr = false;
+    this->arg.disable_thp = false;
     this->arg.umount_outside = false;
     this->arg.clone_flags = 0;
+    this->arg.stdin_fd = STDIN_FILENO;
     this->arg.stdout_fd = STDOUT_FILENO;
     this->arg.stderr_fd = STDERR_FILENO;
     this->arg.callback_child = NULL;
@@ -118,7 +141,8 @@ void MainConfig::check() {
     int is_root = (getuid() == 0);
     std::vector<string> error_messages;
 
-    if (this->arg.uid == 0) {
+    // the daemon does not run commands itself, jobs are checked
+    if (this->arg.uid == 0 && this->daemon_socket.empty()) {
         error_messages.push_back(
                 "For security reason, running commands with uid = 0 is not allowed.\n"
                 "Please specify a user ID using `--uid`.");
@@ -127,7 +151,7 @@ void MainConfig::check() {
                 "For security reason, setting uid to other user requires root.");
     }
 
-    if (this->arg.gid == 0) {
+    if (this->arg.gid == 0 && this->daemon_socket.empty()) {
         error_messages.push_back(
                 "For security reason, running commands with gid = 0 is not allowed.\n"
                 "Please specify a group ID using `--gid`.");
@@ -136,12 +160,96 @@ void MainConfig::check() {
                 "For security reason, setting gid to other group requires root.");
     }
 
-    if (this->arg.argc <= 0) {
+    if (this->arg.argc <= 0 && this->batch_manifest.empty() && this->daemon_socket.empty()) {
         error_messages.push_back(
                 "command_args cannot be empty. "
                 "Use `--help` to see full options.");
     }
 
+    if (!this->fork_server.empty() && this->testcases.empty() && this->repeat <= 1) {
+        error_messages.push_back(
+                "`--fork-server` requires `--testcase` or `--repeat`.");
+    }
+
+    if (this->report_format != "text" && this->report_format != "json" && this->report_format != "binary") {
+        error_messages.push_back(
+                "`--report-format` must be one of text, json, binary.");
+    }
+
+    if (this->memory_accounting != "total" && this->memory_accounting != "rss" && this->memory_accounting != "anon+swap") {
+        error_messages.push_back(
+                "`--memory-accounting` must be one of total, rss, anon+swap.");
+    }
+
+    // the kernel requires at least 1ms per 100ms period
+    if (this->cpu_quota > 0 && this->cpu_quota < 0.01) {
+        error_messages.push_back(
+                "`--cpu-quota` must be at least 0.01.");
+    }
+
+    if (!this->cpus.empty() && this->arg.cpu_affinity.empty()) {
+        error_messages.push_back(
+                "`--cpus` is not a valid cpu list.");
+    }
+
+    if (this->mems == "local" ? this->cpus.empty() : (!this->mems.empty() && strconv::to_int_list(this->mems).empty())) {
+        error_messages.push_back(
+                "`--mems` must be a NUMA node list, or `local` with `--cpus`.");
+    }
+
+    if (this->cpu_weight > 10000) {
+        error_messages.push_back(
+                "`--cpu-weight` must be between 1 and 10000.");
+    }
+
+    if (this->process_limit != -1 && this->process_limit <= 0) {
+        error_messages.push_back(
+                "`--max-processes` must be positive.");
+    }
+
+    if (this->repeat < 1) {
+        error_messages.push_back(
+                "`--repeat` must be at least 1.");
+    }
+
+    if (this->repeat > 1 && (!this->testcases.empty() || !this->batch_manifest.empty())) {
+        error_messages.push_back(
+                "`--repeat` conflicts with `--testcase` and `--batch`.");
+    }
+
+    if (!stats::is_statistic(this->repeat_statistic)) {
+        error_messages.push_back(
+                "`--repeat-statistic` must be one of min, median, mean, p95, max.");
+    }
+
+    if (this->batch_workers < 1) {
+        error_messages.push_back(
+                "`--batch-workers` must be at least 1.");
+    }
+
+    if (!this->daemon_socket.empty() && !is_root) {
+        error_messages.push_back(
+                "`--daemon` must be started by root.");
+    }
+
+    // pool slots are locked by their state files, not by the cgroup lock
+    if (this->cgname.compare(0, 9, "lrun-pool") == 0) {
+        error_messages.push_back(
+                "`--cgname` can not start with `lrun-pool`, which is used by `--cgroup-pool`.");
+    }
+
+    if (!this->batch_manifest.empty()) {
+        if (!this->testcases.empty()) {
+            error_messages.push_back(
+                    "`--batch` conflicts with `--testcase`.");
+        }
+
+        if (this->batch_workers > 1 && !this->cgname.empty()) {
+            error_messages.push_back(
+                    "`--batch-workers` > 1 conflicts with `--cgname`.");
+        }
+    }
+
     if (!is_root) {
         if (this->arg.cmd_list.size() > 0) {
             error_messages.push_back(
@@ -29,22 +29,55 @@
 
 namespace lrun {
 
+    // limits that can be given per --testcase or --batch item
+    struct RunLimits {
+        double cpu_time;
+        double real_time;
+        long long memory;
+        long long output;
+    };
+
     struct MainConfig {
         Cgroup::spawn_arg arg;
         double cpu_time_limit;
         double real_time_limit;
         long long memory_limit;
         long long output_limit;
+        long long process_limit;
+        double cpu_quota;
+        int cpu_weight;
+        std::string cpus;
+        std::string mems;
+        int repeat;
+        std::string repeat_statistic;
+        bool quiet_machine;
+        bool exclusive_core;
+        bool idle_sibling;
+        double exclusive_core_wait;
         bool enable_devices_whitelist;
         bool enable_network;
         bool enable_pidns;
         bool pass_exitcode;
         bool write_result_to_3;
+        std::string report_format;
+        std::string memory_accounting;
+        bool async_cleanup;
+        int cgroup_pool_size;
+        std::string fork_server;
+        std::string batch_manifest;
+        int batch_workers;
+        bool batch_fail_fast;
+        std::string daemon_socket;
         useconds_t interval;
+        int telemetry_fd;
+        double telemetry_interval;
+        double status_board_interval;
         std::string cgname;
         Cgroup* active_cgroup;
 
         std::vector<gid_t> groups;
+        std::vector<std::pair<std::string, std::string> > testcases;
+        std::vector<RunLimits> testcase_limits;  // one per testcase
         std::map<std::pair<Cgroup::subsys_id_t, std::string>, std::string> cgroup_options;
 
         MainConfig();
@@ -0,0 +1,728 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2012-2015 Jun Wu <quark@zju.edu.cn>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "liblrun.h"
+#include "../cgroup.h"
+#include "../seccomp.h"
+#include "../utils/checkpoint.h"
+#include "../utils/fdpass.h"
+#include "../utils/for_each.h"
+#include "../utils/fs.h"
+#include "../utils/log.h"
+#include "../utils/now.h"
+#include "../utils/pidfd.h"
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mount.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+
+using lrun::Cgroup;
+using std::string;
+
+// polling interval for things without notifications, same as lrun --interval
+static const double POLL_INTERVAL = 0.02;
+
+// same as lrun defaults
+static void set_default_spawn_arg(Cgroup::spawn_arg& arg) {
+    arg.clone_flags = CLONE_NEWNET;
+    arg.nice = 0;
+    arg.uid = 0;
+    arg.gid = 0;
+    arg.umask = 022;
+    arg.remount_dev = 0;
+    arg.reset_env = 0;
+    arg.no_new_privs = true;
+    arg.disable_aslr = false;
+    arg.disable_thp = false;
+    arg.umount_outside = false;
+    arg.stdin_fd = STDIN_FILENO;
+    arg.stdout_fd = STDOUT_FILENO;
+    arg.stderr_fd = STDERR_FILENO;
+    arg.callback_child = NULL;
+    arg.rlimits[RLIMIT_NOFILE] = 256;
+    arg.rlimits[RLIMIT_NPROC] = 2048;
+    arg.rlimits[RLIMIT_RTPRIO] = 0;
+    arg.rlimits[RLIMIT_CORE] = 0;
+    arg.syscall_action = lrun::seccomp::action_t::OTHERS_EPERM;
+}
+
+struct lrun_sandbox {
+    Cgroup cg;
+    string name;
+    Cgroup::spawn_arg arg;
+    lrun_limits limits;
+    string error;
+
+    // the running command, 0 if none
+    pid_t pid;
+    double start_time;
+
+    // fd returned by lrun_sandbox_fd, an epoll fd watching the fds below
+    int epfd;
+    int child_fd;
+    int deadline_fd;
+    int checkpoint_fd;
+    int oom_fd;
+    bool oom_triggered;
+
+    // used to compute cpu usage rate
+    double last_cpu_time_usage;
+    double last_check_time;
+
+    lrun_sandbox(Cgroup&& cg, const string& name) : cg(std::move(cg)), name(name), pid(0), epfd(-1), child_fd(-1), deadline_fd(-1), checkpoint_fd(-1), oom_fd(-1) {
+        memset(&limits, 0, sizeof limits);
+        set_default_spawn_arg(arg);
+    }
+};
+
+static int close_fd(int fd) {
+    if (fd >= 0) close(fd);
+    return -1;
+}
+
+static int watch_fd(int epfd, int fd) {
+    if (fd < 0) return -1;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof ev);
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) return close_fd(fd);
+    return fd;
+}
+
+static int set_timerfd(int fd, double seconds) {
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof spec);
+    spec.it_value.tv_sec = (time_t)seconds;
+    spec.it_value.tv_nsec = (long)((seconds - (time_t)seconds) * 1e9);
+    // all zero disarms the timer
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) spec.it_value.tv_nsec = 1;
+    return timerfd_settime(fd, 0, &spec, NULL);
+}
+
+static int open_timerfd(double seconds) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (fd < 0) return -1;
+    if (set_timerfd(fd, seconds)) return close_fd(fd);
+    return fd;
+}
+
+static void drain_timerfd(int fd) {
+    uint64_t count;
+    if (fd >= 0 && read(fd, &count, sizeof count) < 0) return;
+}
+
+static void close_watches(lrun_sandbox *sb) {
+    sb->oom_fd = close_fd(sb->oom_fd);
+    sb->checkpoint_fd = close_fd(sb->checkpoint_fd);
+    sb->deadline_fd = close_fd(sb->deadline_fd);
+    sb->child_fd = close_fd(sb->child_fd);
+    sb->epfd = close_fd(sb->epfd);
+}
+
+// commands are spawned by a process forked by lrun_init, which has one
+// thread. the child of a clone runs spawn steps which allocate memory and
+// take other locks, possibly held by other threads of the caller at the
+// time of the clone. the spawner creates commands and their dummy inits
+// with CLONE_PARENT, so they are children of the caller all the same
+static int spawner_sock = -1;
+static std::mutex spawner_mutex;
+
+// same limit as lrun --daemon requests
+static const size_t SPAWNER_MAX_REQUEST = 65536;
+
+// a request to the spawner, sent with [stdin, stdout, stderr, working
+// directory], followed by NUL separated strings: cgroup name, chroot path,
+// chdir path, syscall filter, bind_count pairs of bind dest and src,
+// readonly_count read-only dests, then argv
+struct spawner_request {
+    uid_t uid;
+    gid_t gid;
+    int clone_flags;
+    int syscall_action;
+    int bind_count;
+    int readonly_count;
+    int rlimit_count;
+    int resources[RLIMIT_NLIMITS];
+    rlim_t values[RLIMIT_NLIMITS];
+};
+
+// the reply, sent with the pidfds of init and the child, if any
+struct spawner_reply {
+    pid_t pid;                      // same as Cgroup::spawn
+    pid_t init_pid;
+    int has_init;
+    int has_child;
+    Cgroup::spawn_report report;
+};
+
+static void append_string(string& buf, const string& str) {
+    buf.append(str.c_str(), str.length() + 1);
+}
+
+/**
+ * encode the spawn arg of a sandbox, see spawner_request
+ * @return  0           success
+ *         <0           the request is too long
+ */
+static int encode_request(const lrun_sandbox *sb, char * const argv[], string& buf) {
+    const Cgroup::spawn_arg& arg = sb->arg;
+    spawner_request request;
+    memset(&request, 0, sizeof request);
+    request.uid = arg.uid;
+    request.gid = arg.gid;
+    request.clone_flags = arg.clone_flags;
+    request.syscall_action = (int)arg.syscall_action;
+    request.bind_count = (int)arg.bindfs_list.size();
+    // liblrun only remounts binds, read-only
+    request.readonly_count = (int)arg.remount_list.size();
+    FOR_EACH_CONST(p, arg.rlimits) {
+        request.resources[request.rlimit_count] = p.first;
+        request.values[request.rlimit_count++] = p.second;
+    }
+
+    buf.assign((const char *)&request, sizeof request);
+    append_string(buf, sb->name);
+    append_string(buf, arg.chroot_path);
+    append_string(buf, arg.chdir_path);
+    append_string(buf, arg.syscall_list);
+    FOR_EACH_CONST(p, arg.bindfs_list) {
+        append_string(buf, p.first);
+        append_string(buf, p.second);
+    }
+    FOR_EACH_CONST(p, arg.remount_list) append_string(buf, p.first);
+    for (int i = 0; argv[i]; ++i) append_string(buf, argv[i]);
+    return buf.length() <= SPAWNER_MAX_REQUEST ? 0 : -1;
+}
+
+/**
+ * spawn a command in the spawner
+ * @param   fds             stdin, stdout, stderr and working directory
+ * @param   self_pidns_fd   pid namespace of the spawner
+ * @param   pidfds          set to pidfds of init and the child, or -1
+ */
+static void spawner_handle(char *buf, size_t len, const int fds[4], int self_pidns_fd, spawner_reply& reply, int pidfds[2]) {
+    spawner_request request;
+    if (len <= sizeof request || buf[len - 1] != '\0') return;
+    memcpy(&request, buf, sizeof request);
+
+    std::vector<char *> strings;
+    for (size_t pos = sizeof request; pos < len; pos += strlen(buf + pos) + 1) strings.push_back(buf + pos);
+    if (request.bind_count < 0 || request.readonly_count < 0 || request.rlimit_count < 0 || request.rlimit_count > RLIMIT_NLIMITS) return;
+    size_t argv_pos = 4 + 2 * (size_t)request.bind_count + (size_t)request.readonly_count;
+    if (strings.size() <= argv_pos) return;
+
+    Cgroup cg = Cgroup::create(strings[0]);
+    if (!cg.valid()) return;
+
+    Cgroup::spawn_arg arg;
+    set_default_spawn_arg(arg);
+    arg.uid = request.uid;
+    arg.gid = request.gid;
+    // the command and its init are children of the caller, which waits them
+    arg.clone_flags = request.clone_flags | CLONE_PARENT;
+    arg.syscall_action = (lrun::seccomp::action_t)request.syscall_action;
+    arg.rlimits.clear();
+    for (int i = 0; i < request.rlimit_count; ++i) arg.rlimits[request.resources[i]] = request.values[i];
+    arg.chroot_path = strings[1];
+    arg.chdir_path = strings[2];
+    arg.syscall_list = strings[3];
+    for (int i = 0; i < request.bind_count; ++i) {
+        const char *dest = strings[4 + 2 * i];
+        arg.bindfs_list.push_back(make_pair(string(dest), string(strings[5 + 2 * i])));
+        arg.bindfs_dest_set.insert(dest);
+    }
+    for (int i = 0; i < request.readonly_count; ++i) arg.remount_list[strings[4 + 2 * request.bind_count + i]] |= MS_RDONLY;
+    std::vector<char *> argv(strings.begin() + argv_pos, strings.end());
+    argv.push_back(NULL);
+    arg.args = &argv[0];
+    arg.argc = (int)argv.size() - 1;
+    arg.stdin_fd = fds[0];
+    arg.stdout_fd = fds[1];
+    arg.stderr_fd = fds[2];
+
+    // paths are relative to the working directory of the caller
+    if (fchdir(fds[3])) {
+        reply.report.failed_step = Cgroup::STEP_CHDIR;
+        reply.report.error = errno;
+        return;
+    }
+
+    reply.pid = cg.spawn(arg);
+    reply.report = cg.last_spawn_report();
+    reply.init_pid = cg.release_spawned(pidfds[0], pidfds[1]);
+
+    // spawn moved the next children of the spawner to the pid namespace of
+    // the command, the next init must not be created in it
+    if (syscall(SYS_setns, self_pidns_fd, CLONE_NEWPID)) {
+        ERROR("can not reset pid namespace");
+        _exit(1);
+    }
+}
+
+/**
+ * close fds inherited from the caller, so the spawner does not keep them
+ * open, ex. the write end of a pipe the caller reads until EOF
+ */
+static void close_inherited_fds(int keep_fd) {
+    std::vector<int> fds;
+    DIR *dir = opendir("/proc/self/fd");
+    if (!dir) return;
+    for (struct dirent *ent = readdir(dir); ent; ent = readdir(dir)) {
+        int fd = atoi(ent->d_name);
+        if (fd > STDERR_FILENO && fd != keep_fd && fd != dirfd(dir)) fds.push_back(fd);
+    }
+    closedir(dir);
+    FOR_EACH(fd, fds) close(fd);
+}
+
+/**
+ * serve spawn requests until the caller exits. never returns
+ */
+static void spawner_main(int sock) {
+    close_inherited_fds(sock);
+
+    // stderr is kept for logs
+    int null_fd = open("/dev/null", O_RDWR);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        if (null_fd > STDERR_FILENO) close(null_fd);
+    }
+
+    // handlers of the caller, ex. of a language runtime, can not run here.
+    // commands inherit the mask, so unblock everything
+    struct sigaction action;
+    memset(&action, 0, sizeof action);
+    action.sa_handler = SIG_DFL;
+    for (int signal = 1; signal < NSIG; ++signal) sigaction(signal, &action, NULL);
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+
+    int self_pidns_fd = open("/proc/self/ns/pid", O_RDONLY | O_CLOEXEC);
+    if (self_pidns_fd < 0) {
+        ERROR("can not open pid namespace");
+        _exit(1);
+    }
+
+    static char buf[SPAWNER_MAX_REQUEST];
+    for (;;) {
+        int fds[4];
+        int nfds = 4;
+        ssize_t len = fdpass::recv(sock, buf, sizeof buf, fds, &nfds);
+        if (len <= 0) break;  // the caller has exited
+
+        spawner_reply reply;
+        memset(&reply, 0, sizeof reply);
+        reply.pid = -1;
+        reply.report.failed_step = -1;
+        int pidfds[2] = {-1, -1};
+        if (nfds == 4) spawner_handle(buf, (size_t)len, fds, self_pidns_fd, reply, pidfds);
+        for (int i = 0; i < nfds; ++i) close(fds[i]);
+
+        int reply_fds[2];
+        int reply_nfds = 0;
+        reply.has_init = pidfds[0] >= 0;
+        reply.has_child = pidfds[1] >= 0;
+        for (int i = 0; i < 2; ++i) if (pidfds[i] >= 0) reply_fds[reply_nfds++] = pidfds[i];
+        fdpass::send(sock, &reply, sizeof reply, reply_fds, reply_nfds);
+        for (int i = 0; i < reply_nfds; ++i) close(reply_fds[i]);
+    }
+
+    // not exit: atexit handlers and destructors belong to the caller
+    _exit(0);
+}
+
+static int start_spawner() {
+    int sockets[2];
+    if (socketpair(AF_LOCAL, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets)) return -1;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(sockets[0]);
+        spawner_main(sockets[1]);
+    }
+    close(sockets[1]);
+    if (pid < 0) {
+        close(sockets[0]);
+        return -1;
+    }
+    INFO("spawner pid = %lu", (unsigned long)pid);
+    spawner_sock = sockets[0];
+    return 0;
+}
+
+/**
+ * let the spawner spawn the command of a sandbox and take over the
+ * processes it created
+ * @return  same as Cgroup::spawn, the report is filled if it is known
+ */
+static pid_t request_spawn(lrun_sandbox *sb, char * const argv[], Cgroup::spawn_report& report) {
+    if (spawner_sock < 0) {
+        sb->error = "lrun_init was not called";
+        return -1;
+    }
+
+    string request;
+    if (encode_request(sb, argv, request)) {
+        sb->error = "command is too long";
+        return -1;
+    }
+
+    // a closed stdio fd is not redirected, the command inherits ours
+    const Cgroup::spawn_arg& arg = sb->arg;
+    int stdio_fds[3] = {arg.stdin_fd, arg.stdout_fd, arg.stderr_fd};
+    int fds[4];
+    for (int i = 0; i < 3; ++i) fds[i] = stdio_fds[i] >= 0 ? stdio_fds[i] : i;
+    fds[3] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+    spawner_reply reply;
+    int pidfds[2];
+    int npidfds = 2;
+    ssize_t len = -1;
+    if (fds[3] >= 0) {
+        // the spawner serves one request at a time
+        std::lock_guard<std::mutex> lock(spawner_mutex);
+        if (fdpass::send(spawner_sock, request.data(), request.length(), fds, 4) == 0) {
+            len = fdpass::recv(spawner_sock, &reply, sizeof reply, pidfds, &npidfds);
+        }
+        close(fds[3]);
+    }
+    if (len != (ssize_t)sizeof reply || npidfds != reply.has_init + reply.has_child) {
+        for (int i = 0; i < npidfds; ++i) close(pidfds[i]);
+        sb->error = "can not talk to spawner";
+        return -1;
+    }
+
+    int init_pidfd = reply.has_init ? pidfds[0] : -1;
+    int child_pidfd = reply.has_child ? pidfds[npidfds - 1] : -1;
+    if (reply.pid <= 0 && child_pidfd >= 0) {
+        // a failed child exits by itself, do not leave a zombie
+        struct pollfd pfd;
+        pfd.fd = child_pidfd;
+        pfd.events = POLLIN;
+        while (poll(&pfd, 1, -1) < 0 && errno == EINTR);
+        pidfd::reap(child_pidfd);
+        close(child_pidfd);
+        child_pidfd = -1;
+    }
+    sb->cg.adopt_spawned(reply.init_pid, init_pidfd, child_pidfd);
+    report = reply.report;
+    return reply.pid;
+}
+
+/**
+ * kill remaining processes and stop watching
+ * @param   reaped      the command has been reaped by the caller
+ */
+static void stop(lrun_sandbox *sb, bool reaped) {
+    sb->cg.killall();
+    // killall may have reaped it
+    if (!reaped) waitpid(sb->pid, NULL, __WALL);
+    close_watches(sb);
+    sb->pid = 0;
+}
+
+static int init_result = -1;
+
+static void init_once() {
+    // the spawner inherits the filled caches
+    if (Cgroup::init() == 0 && start_spawner() == 0) init_result = 0;
+}
+
+int lrun_init(void) {
+    static std::once_flag once;
+    std::call_once(once, init_once);
+    return init_result;
+}
+
+lrun_sandbox *lrun_sandbox_create(const char *name) {
+    if (!name || !*name) return NULL;
+    Cgroup cg = Cgroup::create(name);
+    if (!cg.valid()) return NULL;
+
+    // some cgroup options, fail quietly
+    cg.set(Cgroup::CG_MEMORY, "memory.swappiness", "0\n");
+    return new lrun_sandbox(std::move(cg), name);
+}
+
+void lrun_sandbox_destroy(lrun_sandbox *sb) {
+    if (!sb) return;
+    if (sb->pid > 0) stop(sb, false);
+    sb->cg.destroy();
+    delete sb;
+}
+
+int lrun_sandbox_set_user(lrun_sandbox *sb, uid_t uid, gid_t gid) {
+    if (uid == 0 || gid == 0) return -1;
+    sb->arg.uid = uid;
+    sb->arg.gid = gid;
+    return 0;
+}
+
+int lrun_sandbox_set_limits(lrun_sandbox *sb, const struct lrun_limits *limits) {
+    if (!limits) return -1;
+    sb->limits = *limits;
+    return 0;
+}
+
+int lrun_sandbox_set_chroot(lrun_sandbox *sb, const char *chroot_path, const char *chdir_path) {
+    sb->arg.chroot_path = chroot_path ? chroot_path : "";
+    sb->arg.chdir_path = chdir_path ? chdir_path : "";
+    return 0;
+}
+
+int lrun_sandbox_bind(lrun_sandbox *sb, const char *dest, const char *src, int readonly) {
+    if (!dest || !src) return -1;
+    sb->arg.bindfs_list.push_back(make_pair(string(dest), string(src)));
+    sb->arg.bindfs_dest_set.insert(dest);
+    if (readonly) sb->arg.remount_list[dest] |= MS_RDONLY;
+    return 0;
+}
+
+int lrun_sandbox_set_syscalls(lrun_sandbox *sb, const char *filter) {
+    // same syntax as lrun --syscalls
+    if (!filter || !*filter) {
+        sb->arg.syscall_action = lrun::seccomp::action_t::OTHERS_EPERM;
+        sb->arg.syscall_list = "";
+        return 0;
+    }
+    if (!lrun::seccomp::supported()) return -1;
+
+    sb->arg.syscall_action = lrun::seccomp::action_t::DEFAULT_EPERM;
+    switch (filter[0]) {
+        case '!': case '-':
+            sb->arg.syscall_action = lrun::seccomp::action_t::OTHERS_EPERM;
+            sb->arg.syscall_list = string(filter + 1);
+            break;
+        case '=': case '+':
+            sb->arg.syscall_list = string(filter + 1);
+            break;
+        default:
+            sb->arg.syscall_list = filter;
+    }
+    return 0;
+}
+
+int lrun_sandbox_set_network(lrun_sandbox *sb, int enabled) {
+    if (enabled) {
+        sb->arg.clone_flags &= ~CLONE_NEWNET;
+    } else {
+        sb->arg.clone_flags |= CLONE_NEWNET;
+    }
+    return 0;
+}
+
+int lrun_sandbox_set_stdio(lrun_sandbox *sb, int stdin_fd, int stdout_fd, int stderr_fd) {
+    sb->arg.stdin_fd = stdin_fd;
+    sb->arg.stdout_fd = stdout_fd;
+    sb->arg.stderr_fd = stderr_fd;
+    return 0;
+}
+
+pid_t lrun_sandbox_spawn(lrun_sandbox *sb, char * const argv[]) {
+    sb->error = "";
+    if (sb->pid > 0) {
+        sb->error = "a command is running";
+        return -1;
+    }
+
+    int argc = 0;
+    while (argv && argv[argc]) ++argc;
+    if (argc == 0) {
+        sb->error = "empty command";
+        return -1;
+    }
+
+    // enable oom killer now, spawn disables it, see lrun configure_cgroup
+    Cgroup& cg = sb->cg;
+    cg.set(Cgroup::CG_MEMORY, "memory.oom_control", "0\n");
+    cg.killall();
+    // clearing the limit fails quietly if there is no memory controller
+    if ((cg.set_memory_limit(sb->limits.memory) && sb->limits.memory > 0) || cg.reset_usages()) {
+        sb->error = "can not configure cgroup";
+        return -1;
+    }
+
+    Cgroup::spawn_arg& arg = sb->arg;
+    arg.clone_flags |= CLONE_NEWPID | CLONE_NEWIPC;
+    if (sb->limits.cpu_time > 0) {
+        arg.rlimits[RLIMIT_CPU] = (int)(ceil(sb->limits.cpu_time));
+    } else {
+        arg.rlimits.erase(RLIMIT_CPU);
+    }
+
+    Cgroup::spawn_report report;
+    report.failed_step = -1;
+    pid_t pid = request_spawn(sb, argv, report);
+
+    if (pid <= 0) {
+        if (report.failed_step >= 0) {
+            sb->error = string(Cgroup::spawn_step_name(report.failed_step)) + ": " + strerror(report.error);
+        } else if (sb->error.empty()) {
+            sb->error = "can not spawn";
+        }
+        cg.killall();
+        return -1;
+    }
+
+    sb->pid = pid;
+    sb->start_time = now();
+    sb->last_cpu_time_usage = 0;
+    sb->last_check_time = sb->start_time;
+    sb->oom_triggered = false;
+
+    // the epoll fd is readable when any of these is
+    sb->epfd = epoll_create1(EPOLL_CLOEXEC);
+    sb->child_fd = watch_fd(sb->epfd, pidfd::open(pid));
+    sb->deadline_fd = sb->limits.real_time > 0 ? watch_fd(sb->epfd, open_timerfd(sb->limits.real_time)) : -1;
+    sb->oom_fd = sb->limits.memory > 0 ? watch_fd(sb->epfd, cg.oom_eventfd()) : -1;
+
+    // cpu time and output have no notifications
+    bool need_polling = sb->limits.output > 0 || sb->child_fd < 0
+        || (sb->limits.real_time > 0 && sb->deadline_fd < 0)
+        || (sb->limits.memory > 0 && sb->oom_fd < 0);
+    if (sb->limits.cpu_time > 0 || need_polling) {
+        double wait = need_polling ? POLL_INTERVAL : checkpoint::MIN_CPU_INTERVAL;
+        sb->checkpoint_fd = watch_fd(sb->epfd, open_timerfd(wait));
+    }
+
+    INFO("sandbox spawned %d, fd %d", (int)pid, sb->epfd);
+    return pid;
+}
+
+int lrun_sandbox_fd(const lrun_sandbox *sb) {
+    return sb->pid > 0 ? sb->epfd : -1;
+}
+
+int lrun_sandbox_update(lrun_sandbox *sb, struct lrun_result *result) {
+    if (sb->pid <= 0) return -1;
+
+    Cgroup& cg = sb->cg;
+    const lrun_limits& limits = sb->limits;
+
+    // consume events so the epoll fd is not readable again because of them
+    drain_timerfd(sb->deadline_fd);
+    drain_timerfd(sb->checkpoint_fd);
+    if (sb->oom_fd >= 0 && cg.read_oom_event(sb->oom_fd)) sb->oom_triggered = true;
+
+    int stat = 0;
+    int exceed = LRUN_EXCEED_NONE;
+    bool exited = false;
+    if (waitpid(sb->pid, &stat, WNOHANG | __WALL) == sb->pid && (WIFEXITED(stat) || WIFSIGNALED(stat))) {
+        exited = true;
+    } else {
+        stat = 0;
+    }
+
+    double cpu_time_usage = cg.cpu_usage();
+    double real_time_usage = now() - sb->start_time;
+    if (!exited) {
+        // an oom event is exact, processes under oom are stuck or being killed
+        if (sb->oom_triggered) {
+            exceed = LRUN_EXCEED_MEMORY;
+        } else if (limits.cpu_time > 0 && cpu_time_usage >= limits.cpu_time) {
+            exceed = LRUN_EXCEED_CPU_TIME;
+        } else if (limits.real_time > 0 && real_time_usage >= limits.real_time) {
+            exceed = LRUN_EXCEED_REAL_TIME;
+        } else if (limits.memory > 0 && cg.memory_peak() >= limits.memory) {
+            exceed = LRUN_EXCEED_MEMORY;
+        } else if (limits.output > 0) {
+            cg.update_output_count();
+            if (cg.output_usage() > limits.output) exceed = LRUN_EXCEED_OUTPUT;
+        }
+    }
+
+    if (!exited && exceed == LRUN_EXCEED_NONE) {
+        // still running, arm the next checkpoint
+        if (sb->checkpoint_fd >= 0) {
+            double wait = POLL_INTERVAL;
+            if (limits.cpu_time > 0) {
+                double check_time = now();
+                double observed_rate = check_time > sb->last_check_time ? (cpu_time_usage - sb->last_cpu_time_usage) / (check_time - sb->last_check_time) : 0;
+                sb->last_cpu_time_usage = cpu_time_usage;
+                sb->last_check_time = check_time;
+                static long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+                double cpu_wait = checkpoint::next_cpu(limits.cpu_time - cpu_time_usage, observed_rate, cg.thread_count(), cpu_count < 1 ? 1 : cpu_count);
+                bool need_polling = limits.output > 0 || sb->child_fd < 0;
+                if (!need_polling || cpu_wait < wait) wait = cpu_wait;
+            }
+            set_timerfd(sb->checkpoint_fd, wait);
+        }
+        return 0;
+    }
+
+    // the child may be killed by the kernel oom killer before we read the event
+    if (sb->oom_fd >= 0 && !sb->oom_triggered) sb->oom_triggered = cg.read_oom_event(sb->oom_fd);
+
+    // collect stats before killing, same as lrun
+    long long memory_usage = cg.memory_peak();
+    cpu_time_usage = cg.cpu_usage();
+    real_time_usage = now() - sb->start_time;
+    stop(sb, exited);
+
+    if (limits.memory > 0 && (sb->oom_triggered || memory_usage >= limits.memory)) {
+        memory_usage = limits.memory;
+        exceed = LRUN_EXCEED_MEMORY;
+    }
+    if ((WIFSIGNALED(stat) && WTERMSIG(stat) == SIGXCPU) || (limits.cpu_time > 0 && cpu_time_usage >= limits.cpu_time)) {
+        if (limits.cpu_time > 0) cpu_time_usage = limits.cpu_time;
+        exceed = LRUN_EXCEED_CPU_TIME;
+    }
+    if (WIFSIGNALED(stat) && WTERMSIG(stat) == SIGXFSZ) exceed = LRUN_EXCEED_OUTPUT;
+    if (limits.real_time > 0 && real_time_usage >= limits.real_time) {
+        real_time_usage = limits.real_time;
+        exceed = LRUN_EXCEED_REAL_TIME;
+    }
+
+    if (result) {
+        result->status = stat;
+        result->exceed = exceed;
+        result->memory = memory_usage;
+        result->cpu_time = cpu_time_usage;
+        result->real_time = real_time_usage;
+    }
+    return 1;
+}
+
+void lrun_sandbox_kill(lrun_sandbox *sb) {
+    if (sb->pid > 0) stop(sb, false);
+}
+
+const char *lrun_sandbox_error(const lrun_sandbox *sb) {
+    return sb->error.c_str();
+}
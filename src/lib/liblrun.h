@@ -0,0 +1,199 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2012-2015 Jun Wu <quark@zju.edu.cn>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+// liblrun: run commands in lrun sandboxes from a long-running process.
+//
+// A sandbox owns a cgroup and runs one command at a time. Sandboxes do not
+// share state, so a process may run many of them, supervised in one event
+// loop or each used by one thread at a time. The caller must be root.
+//
+// Commands are spawned one at a time by a helper process with one thread,
+// forked by lrun_init, so spawning is safe while other threads run. Call
+// lrun_init early: the helper shares the memory pages the process has at
+// that time.
+//
+// Typical use:
+//
+//   lrun_init();
+//   lrun_sandbox *sb = lrun_sandbox_create("judge1");
+//   lrun_sandbox_set_user(sb, 65534, 65534);
+//   lrun_sandbox_set_limits(sb, &limits);
+//   lrun_sandbox_spawn(sb, argv);
+//   // wait until lrun_sandbox_fd(sb) is readable (poll, epoll, ...), then
+//   while (lrun_sandbox_update(sb, &result) == 0) { wait again }
+//   lrun_sandbox_destroy(sb);
+//
+// The spawned command is a child of the calling process. Do not reap it
+// using wait(-1) or waitpid(-1, ...), and do not ignore SIGCHLD. It is
+// killed if the thread which called lrun_init exits. The pid namespace for
+// new children of the calling threads is not changed.
+// Errors and debug messages are written to stderr.
+
+#pragma once
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct lrun_sandbox lrun_sandbox;
+
+/**
+ * resource limits, a value <= 0 means no limit
+ */
+struct lrun_limits {
+    double cpu_time;            // seconds
+    double real_time;           // seconds
+    long long memory;           // bytes
+    long long output;           // bytes
+};
+
+/**
+ * which limit was exceeded
+ */
+enum lrun_exceed {
+    LRUN_EXCEED_NONE = 0,
+    LRUN_EXCEED_CPU_TIME,
+    LRUN_EXCEED_REAL_TIME,
+    LRUN_EXCEED_MEMORY,
+    LRUN_EXCEED_OUTPUT,
+};
+
+/**
+ * resource usages and exit status of a finished run
+ */
+struct lrun_result {
+    int status;                 // wait status, 0 if killed by exceeding a limit
+    int exceed;                 // enum lrun_exceed
+    long long memory;           // peak memory usage in bytes
+    double cpu_time;            // seconds
+    double real_time;           // seconds
+};
+
+/**
+ * detect and mount cgroups and start the helper process which spawns
+ * commands. call it before using sandboxes, from a thread which lives as
+ * long as them. only the first call does the work, later ones return its
+ * result. commands inherit the environment and rlimits of the process at
+ * the time of this call
+ * @return  0           success
+ *         <0           failed
+ */
+int lrun_init(void);
+
+/**
+ * create a sandbox, using an existing cgroup with the same name if possible
+ * @param   name        cgroup name
+ * @return  sandbox     NULL if failed
+ */
+lrun_sandbox *lrun_sandbox_create(const char *name);
+
+/**
+ * kill the running command and remove the cgroup
+ */
+void lrun_sandbox_destroy(lrun_sandbox *sb);
+
+/**
+ * set uid and gid of commands, both must be set and not 0
+ * @return  0           success
+ *         <0           failed
+ */
+int lrun_sandbox_set_user(lrun_sandbox *sb, uid_t uid, gid_t gid);
+
+/**
+ * set resource limits for the next spawn
+ * @return  0           success
+ *         <0           failed
+ */
+int lrun_sandbox_set_limits(lrun_sandbox *sb, const struct lrun_limits *limits);
+
+/**
+ * set chroot and chdir paths (see lrun --chroot, --chdir), NULL to unset
+ * @return  0           success
+ */
+int lrun_sandbox_set_chroot(lrun_sandbox *sb, const char *chroot_path, const char *chdir_path);
+
+/**
+ * bind mount src to dest (see lrun --bindfs, --bindfs-ro)
+ * @return  0           success
+ */
+int lrun_sandbox_bind(lrun_sandbox *sb, const char *dest, const char *src, int readonly);
+
+/**
+ * set syscall filter (see lrun --syscalls), NULL to unset
+ * @return  0           success
+ *         <0           seccomp is not supported
+ */
+int lrun_sandbox_set_syscalls(lrun_sandbox *sb, const char *filter);
+
+/**
+ * allow network access, which is disabled by default
+ * @return  0           success
+ */
+int lrun_sandbox_set_network(lrun_sandbox *sb, int enabled);
+
+/**
+ * set fds used as stdin, stdout and stderr of commands. they are not
+ * closed by the sandbox. default: 0, 1, 2
+ * @return  0           success
+ */
+int lrun_sandbox_set_stdio(lrun_sandbox *sb, int stdin_fd, int stdout_fd, int stderr_fd);
+
+/**
+ * start a command. remaining processes of the last command are killed
+ * and usages are reset
+ * @param   argv        NULL terminated, argv[0] is searched in PATH
+ * @return  pid         the command is running
+ *         <0           failed, see lrun_sandbox_error
+ */
+pid_t lrun_sandbox_spawn(lrun_sandbox *sb, char * const argv[]);
+
+/**
+ * @return  fd          readable when lrun_sandbox_update should be called,
+ *                      -1 if nothing is running. do not read or close it
+ */
+int lrun_sandbox_fd(const lrun_sandbox *sb);
+
+/**
+ * check the running command without blocking. once it exits or exceeds a
+ * limit, its processes are killed and result is filled
+ * @return  1           finished, result is filled
+ *          0           still running
+ *         <0           nothing is running
+ */
+int lrun_sandbox_update(lrun_sandbox *sb, struct lrun_result *result);
+
+/**
+ * kill the running command without collecting the result
+ */
+void lrun_sandbox_kill(lrun_sandbox *sb);
+
+/**
+ * @return  message     why the last spawn failed, ex. "chroot: No such file
+ *                      or directory". empty if it did not fail
+ */
+const char *lrun_sandbox_error(const lrun_sandbox *sb);
+
+#ifdef __cplusplus
+}
+#endif
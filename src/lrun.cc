@@ -24,26 +24,48 @@
 #include <cstring>
 #include <cstdlib>
 #include <cmath>
+#include <algorithm>
+#include <map>
 #include <vector>
 #include <string>
 #include <stropts.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/file.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/resource.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
 #include <grp.h>
+#include <pwd.h>
+#include <time.h>
+#include "utils/checkpoint.h"
 #include "utils/ensure.h"
+#include "utils/fdpass.h"
 #include "utils/for_each.h"
 #include "utils/fs.h"
 #include "utils/linux_only.h"
 #include "utils/log.h"
 #include "utils/now.h"
+#include "utils/pidfd.h"
+#include "utils/stats.h"
 #include "utils/strconv.h"
+#include "utils/topology.h"
 #include "version.h"
+#include "report_writer.h"
+#include "status_board.h"
 #include "options/options.h"
 #include "config.h"
 #include "cgroup.h"
@@ -71,9 +93,59 @@ static void become_root() {
     if (e) ERROR("setgroups failed");
 }
 
+/**
+ * fork a detached reaper process which inherits the cgroup lock
+ * @return  true in the original process, false in the reaper or if
+ *          fork fails (the caller should clean up synchronously)
+ */
+static bool fork_reaper() {
+    // new processes are created in the pid namespace of the sandbox (see
+    // Cgroup::spawn), which is dead after killall. switch back to ours
+    int pidns_fd = open("/proc/self/ns/pid", O_RDONLY | O_CLOEXEC);
+    if (pidns_fd >= 0) {
+        if (syscall(SYS_setns, pidns_fd, CLONE_NEWPID)) WARNING("can not reset pid namespace");
+        close(pidns_fd);
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        ERROR("can not fork reaper, cleaning synchronously");
+        return false;
+    }
+
+    if (pid > 0) {
+        // the intermediate process exits immediately
+        int status;
+        waitpid(pid, &status, __WALL);
+        return true;
+    }
+
+    // double fork so the reaper is not our child and won't become a zombie
+    setsid();
+    if (fork() > 0) _exit(0);
+
+    // do not keep pipes of the caller open
+    int null_fd = open("/dev/null", O_RDWR);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        if (null_fd > STDERR_FILENO) close(null_fd);
+    }
+    if (config.write_result_to_3) close(3);
+
+    return false;
+}
+
 static void clean_cg_exit(Cgroup& cg, int exit_code) {
     INFO("cleaning and exiting with code = %d", exit_code);
 
+    cg.stop_zygote();
+
+    // the reaper holds the cgroup lock until the cgroup is cleaned, so other
+    // lrun processes won't reuse it too early
+    if (config.async_cleanup && fork_reaper()) exit(exit_code);
+
     if (options::fstracer::started()) {
         // pre-kill
         cg.killall(false /* confirm */);
@@ -89,20 +161,13 @@ static void clean_cg_exit(Cgroup& cg, int exit_code) {
     exit(exit_code);
 }
 
-static char get_process_state(pid_t pid) {
-    FILE * fstatus = fopen((string(fs::PROC_PATH) + "/" + strconv::from_ulong((unsigned long)pid) + "/status").c_str(), "r");
-    char state = 0;
-    if (!fstatus) return 0;
-    int ret = fscanf(fstatus, "%*[^\n] State: %c", &state);
-    (void)ret;
-    fclose(fstatus);
-    return state;
-}
-
 static void signal_handler(int signal) {
     signal_triggered = signal;
 }
 
+static void noop_signal_handler(int) {
+}
+
 #ifndef NDEBUG
 # ifndef NLIBSEGFAULT
 // compile with -ldl
@@ -123,14 +188,16 @@ static void setup_signal_handlers() {
     struct sigaction action;
 
     sigemptyset(&action.sa_mask);
-    action.sa_flags = 0;
-    action.sa_handler = SIG_IGN;
+    action.sa_flags = SA_RESTART;
+    action.sa_handler = noop_signal_handler;
 
     // ignore SIGPIPE so that a program reading fd 3 via a pipe may
-    // close it earlier and lrun continues to do cleaning work
+    // close it earlier and lrun continues to do cleaning work.
+    // not SIG_IGN, which would be inherited by children spawned later
     sigaction(SIGPIPE, &action, NULL);
     sigaction(SIGALRM, &action, NULL);
 
+    action.sa_flags = 0;
     action.sa_handler = signal_handler;
     sigaction(SIGHUP, &action, NULL);
     sigaction(SIGINT, &action, NULL);
@@ -142,17 +209,258 @@ static void setup_signal_handlers() {
     sigaction(SIGTRAP, &action, NULL);
 }
 
+// event sources of the main loop, stored in epoll_event.data.u32
+enum watch_tag_t {
+    WATCH_SIGNAL = 1,
+    WATCH_CHILD,
+    WATCH_TRACER,
+    WATCH_DEADLINE,
+    WATCH_OOM,
+};
+
+static int add_watch(int epfd, int fd, watch_tag_t tag) {
+    if (fd < 0) return -1;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof ev);
+    ev.events = EPOLLIN;
+    ev.data.u32 = tag;
+
+    int e = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    if (e) ERROR("can not watch fd %d", fd);
+    return e;
+}
+
+static int close_fd(int fd) {
+    if (fd >= 0) close(fd);
+    return -1;
+}
+
+static void get_signalfd_mask(sigset_t *mask) {
+    sigemptyset(mask);
+    sigaddset(mask, SIGCHLD);
+    sigaddset(mask, SIGHUP);
+    sigaddset(mask, SIGINT);
+    sigaddset(mask, SIGTERM);
+    sigaddset(mask, SIGQUIT);
+}
+
+static int open_signalfd() {
+    // asynchronous signals are read from signalfd instead of interrupting
+    // the main loop. SIGCHLD is also here in case pidfd is not supported.
+    // note: blocked signals are inherited, call this after spawn
+    sigset_t mask;
+    get_signalfd_mask(&mask);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL)) return -1;
+    return signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+}
+
+static int close_signalfd(int fd) {
+    // unblock so that children spawned later do not inherit the mask.
+    // pending signals go to signal_handler
+    if (fd < 0) return -1;
+    sigset_t mask;
+    get_signalfd_mask(&mask);
+    close(fd);
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    return -1;
+}
+
+static void read_signalfd(int fd) {
+    struct signalfd_siginfo info;
+    while (read(fd, &info, sizeof info) == sizeof info) {
+        INFO("got signal %d from signalfd", (int)info.ssi_signo);
+        if (info.ssi_signo != SIGCHLD) signal_triggered = info.ssi_signo;
+    }
+}
+
+static int open_timerfd(double seconds) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (fd < 0) return -1;
+
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof spec);
+    spec.it_value.tv_sec = (time_t)seconds;
+    spec.it_value.tv_nsec = (long)((seconds - (time_t)seconds) * 1e9);
+    // all zero disarms the timer
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) spec.it_value.tv_nsec = 1;
+
+    if (timerfd_settime(fd, 0, &spec, NULL)) return close_fd(fd);
+    return fd;
+}
+
+// state files shared by lrun processes, see --cgroup-pool and --exclusive-core
+static const char STATE_DIR[] = "/run/lrun";
+
+/**
+ * create STATE_DIR if needed. state files decide what setup to skip and
+ * which slots are taken, only trust a private directory
+ * @param   feature     used in the warning message
+ * @return  true if the directory can be used
+ */
+static bool check_state_dir(const char *feature) {
+    mkdir(STATE_DIR, 0700);
+    struct stat st;
+    if (lstat(STATE_DIR, &st) || !S_ISDIR(st.st_mode) || st.st_uid != 0 || (st.st_mode & 077)) {
+        WARNING("'%s' is not a private directory, %s is disabled", STATE_DIR, feature);
+        return false;
+    }
+    return true;
+}
+
+// pre-configured cgroups, see --cgroup-pool. each slot has a state file
+// holding the slot lock and settings applied to the slot cgroup
+static int pool_state_fd = -1;
+static string pool_fingerprint;
+static bool pool_slot_configured = false;
+
+/**
+ * claim a free cgroup pool slot without waiting
+ * @return  slot cgroup name, empty if no slot is free.
+ *          pool_state_fd is set to the locked state file
+ */
+static string claim_pool_slot() {
+    if (!check_state_dir("cgroup pool")) return "";
+
+    for (int i = 0; i < config.cgroup_pool_size; ++i) {
+        // start from different slots to reduce contention
+        int slot = (int)((getpid() + i) % config.cgroup_pool_size);
+        string name = "lrun-pool" + strconv::from_ulong((unsigned long)slot);
+        string path = string(STATE_DIR) + "/" + name;
+
+        // the lock is inherited by the async cleanup reaper
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+        if (fd < 0) continue;
+        if (flock(fd, LOCK_EX | LOCK_NB)) {
+            close(fd);
+            continue;
+        }
+        pool_state_fd = fd;
+        return name;
+    }
+
+    return "";
+}
+
+static string get_pool_fingerprint(const Cgroup& cg) {
+    // settings written once by configure_cgroup. memory limit is not
+    // included, it is cancelled by killall and set every time
+    string result = cg.identity() + "\n";
+    result += string("devices ") + (config.enable_devices_whitelist ? "1" : "0") + "\n";
+    FOR_EACH(p, config.cgroup_options) {
+        result += "option " + strconv::from_long(p.first.first) + " " + p.first.second + " " + p.second + "\n";
+    }
+    return result;
+}
+
+static string read_pool_state() {
+    char buf[4096];
+    ssize_t len = pread(pool_state_fd, buf, sizeof buf, 0);
+    return len > 0 ? string(buf, len) : "";
+}
+
+static void write_pool_state(const string& state) {
+    if (ftruncate(pool_state_fd, 0) || (state.size() > 0 && pwrite(pool_state_fd, state.c_str(), state.size(), 0) != (ssize_t)state.size())) {
+        WARNING("can not write cgroup pool state");
+    }
+}
+
+/**
+ * optional cgroups used by options. on v1, each one is a directory to
+ * create, attach to and remove for every sandbox
+ * @return  optional_subsys for Cgroup::create
+ */
+static int used_optional_subsys() {
+    int subsys = 0;
+    if (config.process_limit > 0) subsys |= 1 << Cgroup::CG_PIDS;
+    if (config.cpu_quota > 0 || config.cpu_weight > 0) subsys |= 1 << Cgroup::CG_CPU;
+    if (!config.cpus.empty() || !config.mems.empty() || config.exclusive_core) subsys |= 1 << Cgroup::CG_CPUSET;
+    return subsys;
+}
+
+/**
+ * use a pool slot as the active cgroup
+ * @return  true if a slot is used
+ */
+static bool use_pool_slot() {
+    string cgname = claim_pool_slot();
+    if (cgname.empty()) return false;
+    INFO("cgname = '%s' (pool)", cgname.c_str());
+
+    Cgroup *new_cg = new Cgroup(Cgroup::create(cgname, used_optional_subsys()));
+    string state = read_pool_state();
+    if (new_cg->valid() && state != get_pool_fingerprint(*new_cg)) {
+        // configured differently or unknown, start over with a new cgroup
+        INFO("cgroup pool slot settings changed, recreating");
+        write_pool_state("");
+        if (new_cg->destroy()) WARNING("can not destroy cgroup");
+        delete new_cg;
+        new_cg = new Cgroup(Cgroup::create(cgname, used_optional_subsys()));
+    }
+
+    if (!new_cg->valid()) {
+        WARNING("can not create cgroup '%s'", cgname.c_str());
+        delete new_cg;
+        close(pool_state_fd);
+        pool_state_fd = -1;
+        return false;
+    }
+
+    pool_fingerprint = get_pool_fingerprint(*new_cg);
+    pool_slot_configured = (state == pool_fingerprint);
+    // a pool slot is kept like a named cgroup
+    config.cgname = cgname;
+    config.active_cgroup = new_cg;
+    return true;
+}
+
 static void create_cgroup() {
-    // pick an unique name and create a cgroup in filesystem
-    string cgname = config.cgname;
-    if (cgname.empty()) cgname = "lrun" + strconv::from_ulong((unsigned long)getpid());
-    INFO("cgname = '%s'", cgname.c_str());
+    // lock the cgroup so other lrun process with same cgname will wait.
+    // the lock is released at exit, or by the reaper if cleanup is async
+    static fs::ScopedFileLock *cg_lock = NULL;
 
-    // create or reuse group
-    static Cgroup new_cg = Cgroup::create(cgname);
+    if (config.cgname.empty() && config.cgroup_pool_size > 0) {
+        if (use_pool_slot()) return;
+        INFO("no free cgroup pool slot");
+    }
 
-    if (!new_cg.valid()) FATAL("can not create cgroup '%s'", cgname.c_str());
-    config.active_cgroup = &new_cg;
+    for (int attempt = 0; attempt < 16; ++attempt) {
+        // pick an unique name and create a cgroup in filesystem
+        string cgname = config.cgname;
+        bool auto_name = cgname.empty();
+        if (auto_name) {
+            cgname = "lrun" + strconv::from_ulong((unsigned long)getpid());
+            // an async cleanup reaper may still hold "lrun<pid>" created by a
+            // previous lrun process with the same pid. do not wait for it
+            if (attempt > 0) cgname += "-" + strconv::from_ulong((unsigned long)attempt);
+        }
+        INFO("cgname = '%s'", cgname.c_str());
+
+        // create or reuse group
+        Cgroup *new_cg = new Cgroup(Cgroup::create(cgname, used_optional_subsys()));
+        if (!new_cg->valid()) {
+            // it may be removed by a reaper between creation and use
+            WARNING("can not create cgroup '%s'", cgname.c_str());
+            delete new_cg;
+            continue;
+        }
+
+        cg_lock = new fs::ScopedFileLock(new_cg->subsys_path().c_str(), !auto_name);
+
+        // the cgroup may be destroyed by the lock holder while we are
+        // waiting for the lock. retry, it will be created again
+        if (!cg_lock->locked() || !new_cg->valid()) {
+            INFO("cgroup '%s' is busy", cgname.c_str());
+            delete cg_lock;
+            delete new_cg;
+            continue;
+        }
+
+        config.active_cgroup = new_cg;
+        return;
+    }
+
+    FATAL("can not create and lock a cgroup");
 }
 
 static int cgroup_callback_child(void * /* args */) {
@@ -162,9 +470,59 @@ static int cgroup_callback_child(void * /* args */) {
     return ret;
 }
 
-static void configure_cgroup() {
-    Cgroup& cg = *config.active_cgroup;
+// --exclusive-core: each physical core has a state file, its lock is held
+// until exit, or by the async cleanup reaper. the kernel releases the lock
+// if lrun crashes
+static int core_slot_fd = -1;
+
+/**
+ * claim a physical core which is not used by other lrun processes with
+ * --exclusive-core. waits up to --exclusive-core-wait seconds
+ * @return  cpus to run on, empty if no core is free
+ */
+static std::vector<int> claim_core_slot() {
+    std::vector<int> cpus;
+    if (!check_state_dir("exclusive core")) return cpus;
+
+    // with --cpus, only cores inside it are used. --quiet-machine prefers
+    // cpus isolated from the scheduler (isolcpus)
+    std::vector<std::vector<int> > cores, all_cores = topology::cores();
+    std::vector<int> allowed = config.arg.cpu_affinity;
+    if (allowed.empty() && config.quiet_machine) allowed = topology::isolated_cpus();
+    FOR_EACH_CONST(core, all_cores) {
+        bool inside = true;
+        FOR_EACH_CONST(cpu, core) {
+            if (!allowed.empty() && !std::binary_search(allowed.begin(), allowed.end(), cpu)) inside = false;
+        }
+        if (inside) cores.push_back(core);
+    }
+    if (cores.empty()) return cpus;
+
+    // flock can not wait for any of several files, poll instead
+    double deadline = config.exclusive_core_wait >= 0 ? now() + config.exclusive_core_wait : -1;
+    for (;;) {
+        for (size_t i = 0; i < cores.size(); ++i) {
+            // start from different cores to reduce contention
+            const std::vector<int>& core = cores[(getpid() + i) % cores.size()];
+            string path = string(STATE_DIR) + "/core" + strconv::from_long(core[0]);
+            int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+            if (fd < 0) continue;
+            if (flock(fd, LOCK_EX | LOCK_NB)) {
+                close(fd);
+                continue;
+            }
+            core_slot_fd = fd;
+            // an idle sibling does not slow down the command
+            if (config.idle_sibling) cpus.push_back(core[0]);
+            else cpus = core;
+            return cpus;
+        }
+        if (deadline >= 0 && now() >= deadline) return cpus;
+        usleep(10000);
+    }
+}
 
+static void configure_new_cgroup(Cgroup& cg) {
     // assume cg is created just now and nobody has used it before.
     // initialize settings
     // device limits
@@ -186,10 +544,6 @@ static void configure_cgroup() {
     // some cgroup options, fail quietly
     cg.set(Cgroup::CG_MEMORY, "memory.swappiness", "0\n");
 
-    // enable oom killer now so our buggy code won't freeze.
-    // we will disable it later.
-    cg.set(Cgroup::CG_MEMORY, "memory.oom_control", "0\n");
-
     // other cgroup options
     FOR_EACH(p, config.cgroup_options) {
         if (cg.set(p.first.first, p.first.second, p.second)) {
@@ -197,6 +551,73 @@ static void configure_cgroup() {
             clean_cg_exit(cg, 7);
         }
     }
+}
+
+static void configure_cgroup() {
+    Cgroup& cg = *config.active_cgroup;
+
+    // a pool slot which has the same settings only needs a memory limit
+    // update and a counter reset
+    if (pool_slot_configured) {
+        INFO("skip configured cgroup settings");
+        if (cg.set_memory_limit(config.memory_limit)) {
+            ERROR("can not set memory limit");
+            clean_cg_exit(cg, 2);
+        }
+    } else {
+        configure_new_cgroup(cg);
+    }
+
+    // process limit, also resets pids.max of a reused cgroup
+    if (cg.set_pids_limit(config.process_limit) && config.process_limit > 0) {
+        WARNING("pids cgroup is not available, use RLIMIT_NPROC for --max-processes");
+        // keep a lower --max-nprocess
+        if (!config.arg.rlimits.count(RLIMIT_NPROC) || config.arg.rlimits[RLIMIT_NPROC] > (rlim_t)config.process_limit) {
+            config.arg.rlimits[RLIMIT_NPROC] = config.process_limit;
+        }
+    }
+
+    // a core only used by this sandbox, it decides --cpus
+    if (config.exclusive_core && core_slot_fd < 0) {
+        std::vector<int> cpus = claim_core_slot();
+        if (cpus.empty()) {
+            ERROR("no free core for --exclusive-core");
+            clean_cg_exit(cg, 2);
+        }
+        config.arg.cpu_affinity = cpus;
+        config.cpus = strconv::from_int_list(cpus);
+        INFO("exclusive core, cpus = %s", config.cpus.c_str());
+    }
+
+    // cpuset, also reset for a reused cgroup. without the cpuset cgroup,
+    // --cpus still works using cpu affinity
+    string mems = config.mems;
+    if (mems == "local") {
+        mems = strconv::from_int_list(topology::local_nodes(config.arg.cpu_affinity));
+        if (mems.empty()) WARNING("can not find NUMA nodes of --cpus");
+    }
+    if (cg.set_cpuset(config.cpus, mems) && (!config.cpus.empty() || !mems.empty())) {
+        if (cg.has_subsys(Cgroup::CG_CPUSET) || !mems.empty()) {
+            ERROR("can not set cpuset");
+            clean_cg_exit(cg, 2);
+        }
+        WARNING("cpuset cgroup is not available, use cpu affinity for --cpus");
+    }
+
+    // cpu bandwidth and weight, also reset for a reused cgroup
+    if (cg.set_cpu_quota(config.cpu_quota) && config.cpu_quota > 0) {
+        ERROR("can not set cpu quota");
+        clean_cg_exit(cg, 2);
+    }
+    if (cg.set_cpu_weight(config.cpu_weight) && config.cpu_weight > 0) {
+        ERROR("can not set cpu weight");
+        clean_cg_exit(cg, 2);
+    }
+
+    // enable oom killer now so our buggy code won't freeze.
+    // we will disable it later. since spawn disables it, a reused pool
+    // slot also needs this.
+    cg.set(Cgroup::CG_MEMORY, "memory.oom_control", "0\n");
 
     // reset cpu / memory usage and killall existing processes
     // not needed if cg can be guarnteed that is newly created
@@ -207,6 +628,8 @@ static void configure_cgroup() {
         clean_cg_exit(cg, 4);
     }
 
+    if (pool_state_fd >= 0 && !pool_slot_configured) write_pool_state(pool_fingerprint);
+
     // rlimit time
     if (config.cpu_time_limit > 0) {
         config.arg.rlimits[RLIMIT_CPU] = (int)(ceil(config.cpu_time_limit));
@@ -219,9 +642,100 @@ static void configure_cgroup() {
     config.arg.callback_child = &cgroup_callback_child;
 }
 
-static int run_command() {
-    Cgroup& cg = *config.active_cgroup;
+// --fork-server: the command is started once with a preloaded shim, which
+// stops it before main and forks a copy per testcase. see utils/libforkserver
+static const char FORK_SERVER_FD_ENV[] = "LRUN_FORK_SERVER_FD";
+static pid_t fork_server_pid = 0;
+static int fork_server_sock = -1;
+
+// set when a run starts to be set up, to report setup_time
+static double setup_start_time;
+
+// counters when the current run started
+static cgroup_counters counters_base;
+
+static bool detailed_report() {
+    return config.write_result_to_3 && config.report_format != "text";
+}
+
+static long long stat_value(const std::map<string, long long>& stats, const char *key) {
+    std::map<string, long long>::const_iterator it = stats.find(key);
+    return it == stats.end() ? -1 : it->second;
+}
+
+static void read_counters(const Cgroup& cg, cgroup_counters& counters) {
+    std::map<string, long long> memory_stats = cg.get_stats(Cgroup::CG_MEMORY, "memory.stat");
+    long long faults, major_faults;
+
+    if (Cgroup::version() == 2) {
+        std::map<string, long long> cpu_stats = cg.get_stats(Cgroup::CG_CPUACCT, "cpu.stat");
+        long long user = stat_value(cpu_stats, "user_usec"), system = stat_value(cpu_stats, "system_usec");
+        long long throttled = stat_value(cpu_stats, "throttled_usec");
+        counters.user_time = user < 0 ? -1 : user / 1e6;
+        counters.system_time = system < 0 ? -1 : system / 1e6;
+        counters.throttled_periods = stat_value(cpu_stats, "nr_throttled");
+        counters.throttled_time = throttled < 0 ? -1 : throttled / 1e6;
+        faults = stat_value(memory_stats, "pgfault");
+        major_faults = stat_value(memory_stats, "pgmajfault");
+    } else {
+        // cpuacct.stat is in USER_HZ
+        std::map<string, long long> cpu_stats = cg.get_stats(Cgroup::CG_CPUACCT, "cpuacct.stat");
+        long long user = stat_value(cpu_stats, "user"), system = stat_value(cpu_stats, "system");
+        double hz = (double)sysconf(_SC_CLK_TCK);
+        counters.user_time = user < 0 ? -1 : user / hz;
+        counters.system_time = system < 0 ? -1 : system / hz;
+        // the cpu controller is optional, its throttled_time is in ns
+        std::map<string, long long> bandwidth_stats = cg.get_stats(Cgroup::CG_CPU, "cpu.stat");
+        long long throttled = stat_value(bandwidth_stats, "throttled_time");
+        counters.throttled_periods = stat_value(bandwidth_stats, "nr_throttled");
+        counters.throttled_time = throttled < 0 ? -1 : throttled / 1e9;
+        faults = stat_value(memory_stats, "total_pgfault");
+        major_faults = stat_value(memory_stats, "total_pgmajfault");
+    }
+
+    // pgfault counts major faults too
+    counters.minor_faults = (faults < 0 || major_faults < 0) ? -1 : faults - major_faults;
+    counters.major_faults = major_faults;
+}
+
+// sampled when the current run started
+static environment_sample environment_base;
+
+static void read_environment(environment_sample& sample) {
+    sample.cpu_mhz = sample.cpu_pressure = -1;
+    sample.runnable_tasks = -1;
+
+    // cpus of the command, all if not restricted
+    const std::vector<int>& cpus = config.arg.cpu_affinity;
+    string cpuinfo = fs::read("/proc/cpuinfo", 1 << 20);
+    double mhz_sum = 0;
+    int mhz_count = 0, processor = -1;
+    for (const char *line = cpuinfo.c_str(); line && *line; line = strchr(line, '\n')) {
+        if (*line == '\n') ++line;
+        double mhz;
+        if (sscanf(line, "processor : %d", &processor) == 1) continue;
+        if (sscanf(line, "cpu MHz : %lf", &mhz) != 1) continue;
+        if (cpus.empty() || std::binary_search(cpus.begin(), cpus.end(), processor)) {
+            mhz_sum += mhz;
+            ++mhz_count;
+        }
+    }
+    if (mhz_count > 0) sample.cpu_mhz = mhz_sum / mhz_count;
+
+    string stat = fs::read("/proc/stat", 1 << 16);
+    const char *running = strstr(stat.c_str(), "\nprocs_running ");
+    if (running) sample.runnable_tasks = atoll(running + strlen("\nprocs_running ")) - 1;
+
+    string pressure = fs::read("/proc/pressure/cpu");
+    if (sscanf(pressure.c_str(), "some avg10=%lf", &sample.cpu_pressure) != 1) sample.cpu_pressure = -1;
+}
+
+template <typename T> static T counter_delta(T end, T start) {
+    return (end < 0 || start < 0) ? -1 : end - start;
+}
+
 
+static void prepare_run(Cgroup& cg) {
     // fd 3 should not be inherited by child process
     if (fcntl(3, F_SETFD, FD_CLOEXEC)) {
         // ignore bad fd error
@@ -235,37 +749,373 @@ static int run_command() {
     lrun::options::fstracer::setup(cg, config.arg.chroot_path);
     lrun::options::fstracer::start();
 
-    // spawn child
-    pid_t pid = 0;
-
     int& clone_flags = config.arg.clone_flags;
     if (!config.enable_network) clone_flags |= CLONE_NEWNET;
     if (config.enable_pidns) clone_flags |= CLONE_NEWPID | CLONE_NEWIPC;
+}
 
-    pid = cg.spawn(config.arg);
+// --telemetry-fd: resource usage samples written while supervising a run
+static const char * const telemetry_stalls[] = {"cpu", "memory", "io"};
+static const int TELEMETRY_STALL_COUNT = sizeof(telemetry_stalls) / sizeof(telemetry_stalls[0]);
+
+// written before each sample, ex. "testcase=1 "
+static string telemetry_label;
+
+// values the supervisor has already read in this iteration, -1: not read
+struct usage_sample {
+    double cpu_time;
+    long long output;
+    int tasks;
+};
+
+/**
+ * write one sample in one line, in one write
+ * @param   elapsed     seconds since the command started
+ * @param   stall_base  pressure stall seconds when the command started,
+ *                      -1 if not available
+ */
+static void write_telemetry(const Cgroup& cg, double elapsed, const usage_sample& sample, const double stall_base[]) {
+    long long rss, cache, swap;
+    cg.memory_stat(rss, cache, swap);
+
+    char buf[512];
+    int len = snprintf(buf, sizeof buf, "%st=%.3f cpu=%.3f mem=%lld rss=%lld cache=%lld tasks=%d",
+            telemetry_label.c_str(), elapsed,
+            sample.cpu_time >= 0 ? sample.cpu_time : cg.cpu_usage(),
+            cg.memory_current(), rss, cache,
+            sample.tasks >= 0 ? sample.tasks : cg.thread_count());
+    if (config.output_limit > 0 && len < (int)sizeof buf) {
+        // output is only counted with an output limit
+        len += snprintf(buf + len, sizeof buf - len, " out=%lld", sample.output >= 0 ? sample.output : cg.output_usage());
+    }
+    for (int i = 0; i < TELEMETRY_STALL_COUNT && len < (int)sizeof buf; ++i) {
+        if (stall_base[i] < 0) continue;
+        len += snprintf(buf + len, sizeof buf - len, " %s_stall=%.3f", telemetry_stalls[i], cg.pressure_stall(telemetry_stalls[i]) - stall_base[i]);
+    }
+    if (len < (int)sizeof buf - 1) {
+        buf[len++] = '\n';
+        int ret = write(config.telemetry_fd, buf, len);
+        (void)ret;
+    }
+}
+
+// --status-board: live counters of this process published to a host-wide
+// shared file, see status_board.h
+static struct lrun_board *board = NULL;
+static struct lrun_board_slot *board_slot = NULL;
+
+static struct lrun_board *open_board() {
+    // /run is only writable by root. check the owner anyway
+    int fd = open(LRUN_BOARD_PATH, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0644);
+    if (fd < 0) return NULL;
+
+    void *addr = MAP_FAILED;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_uid == 0
+            && ((st.st_mode & 0777) == 0644 || fchmod(fd, 0644) == 0)
+            && (st.st_size >= (off_t)sizeof(struct lrun_board) || ftruncate(fd, sizeof(struct lrun_board)) == 0)) {
+        addr = mmap(NULL, sizeof(struct lrun_board), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (addr == MAP_FAILED) return NULL;
+
+    struct lrun_board *new_board = (struct lrun_board *)addr;
+    if (new_board->magic != LRUN_BOARD_MAGIC) {
+        // concurrent initializers write the same values
+        new_board->version = LRUN_BOARD_VERSION;
+        new_board->slot_size = sizeof(struct lrun_board_slot);
+        new_board->slot_count = LRUN_BOARD_SLOTS;
+        __sync_synchronize();
+        new_board->magic = LRUN_BOARD_MAGIC;
+    } else if (new_board->version != LRUN_BOARD_VERSION || new_board->slot_size != sizeof(struct lrun_board_slot)) {
+        munmap(addr, sizeof(struct lrun_board));
+        return NULL;
+    }
+    return new_board;
+}
 
+static void release_board_slot() {
+    // atexit handlers are inherited by forked workers, which have their own slots
+    if (!board_slot || board_slot->pid != getpid()) return;
+    __sync_fetch_and_add(&board_slot->seq, 1);
+    board_slot->state = LRUN_BOARD_IDLE;
+    board_slot->child_pid = 0;
+    __sync_fetch_and_add(&board_slot->seq, 1);
+    __sync_bool_compare_and_swap(&board_slot->pid, getpid(), 0);
+    board_slot = NULL;
+}
+
+/**
+ * @return  start time of a process in clock ticks since boot, field 22
+ *          of /proc/<pid>/stat. 0 if unknown
+ */
+static unsigned long long process_start_time(pid_t pid) {
+    string stat = fs::read("/proc/" + strconv::from_ulong((unsigned long)pid) + "/stat");
+    // comm (field 2) may contain spaces and ')'
+    size_t pos = stat.rfind(')');
+    if (pos == string::npos) return 0;
+    const char *p = stat.c_str() + pos + 1;
+    for (int field = 3; field < 22 && *p; ++field) {
+        while (*p == ' ') ++p;
+        while (*p && *p != ' ') ++p;
+    }
+    return strtoull(p, NULL, 10);
+}
+
+/**
+ * @return  true if the owner of a slot is alive, not a process reusing
+ *          its pid
+ */
+static bool is_slot_owner_alive(const struct lrun_board_slot *slot, int32_t owner) {
+    if (owner == 0 || (kill(owner, 0) && errno == ESRCH)) return false;
+    // the start time is not written yet right after the slot is claimed
+    if (slot->owner_start_pid != owner) return true;
+    __sync_synchronize();
+    return slot->owner_start_time == process_start_time(owner);
+}
+
+/**
+ * claim a free slot, or a slot left by a dead lrun process
+ * @return  the slot, NULL if the board is full
+ */
+static struct lrun_board_slot *claim_board_slot() {
+    pid_t self = getpid();
+    unsigned long long start_time = process_start_time(self);
+    for (int i = 0; i < LRUN_BOARD_SLOTS; ++i) {
+        // start from different slots to reduce contention
+        struct lrun_board_slot *slot = &board->slots[(self + i) % LRUN_BOARD_SLOTS];
+        int32_t owner = slot->pid;
+        if (is_slot_owner_alive(slot, owner)) continue;
+        if (!__sync_bool_compare_and_swap(&slot->pid, owner, self)) continue;
+
+        slot->owner_start_time = start_time;
+        __sync_synchronize();
+        slot->owner_start_pid = self;
+
+        // the dead owner may have stopped in the middle of a write
+        if (slot->seq & 1) __sync_fetch_and_add(&slot->seq, 1);
+        return slot;
+    }
+    return NULL;
+}
+
+/**
+ * update the status board slot of this process, claim one if needed
+ * @param   state       enum lrun_board_state, -1 to keep the state
+ * @param   sample      counters, NULL to keep them
+ */
+static void publish_status(const Cgroup& cg, int state, pid_t child_pid, const usage_sample *sample) {
+    if (config.status_board_interval <= 0) return;
+    if (!board_slot || board_slot->pid != getpid()) {
+        if (!board && !(board = open_board())) {
+            WARNING("can not open status board, disabled");
+            config.status_board_interval = 0;
+            return;
+        }
+        board_slot = claim_board_slot();
+        if (!board_slot) {
+            WARNING("status board is full");
+            config.status_board_interval = 0;
+            return;
+        }
+        atexit(release_board_slot);
+    }
+
+    struct lrun_board_slot& slot = *board_slot;
+    double time = now();
+    __sync_fetch_and_add(&slot.seq, 1);
+    if (state >= 0) {
+        if (state == LRUN_BOARD_SETUP) {
+            strncpy(slot.cgname, fs::basename(cg.subsys_path()).c_str(), sizeof(slot.cgname) - 1);
+            slot.cgname[sizeof(slot.cgname) - 1] = '\0';
+            slot.cpu_time_limit = config.cpu_time_limit;
+            slot.real_time_limit = config.real_time_limit;
+            slot.memory_limit = config.memory_limit;
+            slot.output_limit = config.output_limit;
+            slot.cpu_time = 0;
+            slot.memory = 0;
+            slot.output = -1;
+        } else if (state == LRUN_BOARD_TEARDOWN) {
+            ++slot.runs;
+        }
+        slot.state = state;
+        slot.start_time = time;
+        slot.child_pid = child_pid;
+    }
+    if (sample) {
+        slot.cpu_time = sample->cpu_time >= 0 ? sample->cpu_time : cg.cpu_usage();
+        slot.memory = cg.memory_current();
+        // output is only counted with an output limit
+        slot.output = sample->output >= 0 ? sample->output : (config.output_limit > 0 ? cg.output_usage() : -1);
+        slot.update_time = time;
+    }
+    __sync_fetch_and_add(&slot.seq, 1);
+}
+
+// --memory-accounting: peaks of memory.stat values sampled by the
+// supervisor. -1 if not available
+struct memory_peaks {
+    long long rss;
+    long long anon_swap;
+    long long cache;        // the last sample, not the peak
+};
+
+static void sample_memory(const Cgroup& cg, memory_peaks& peaks) {
+    long long rss, cache, swap;
+    cg.memory_stat(rss, cache, swap);
+    long long anon_swap = rss < 0 ? -1 : rss + (swap > 0 ? swap : 0);
+    if (rss > peaks.rss) peaks.rss = rss;
+    if (anon_swap > peaks.anon_swap) peaks.anon_swap = anon_swap;
+    peaks.cache = cache;
+}
+
+/**
+ * @return  peak memory usage counted as --memory-accounting says
+ */
+static long long accounted_memory(const Cgroup& cg, const memory_peaks& peaks) {
+    if (config.memory_accounting == "rss") return peaks.rss;
+    if (config.memory_accounting == "anon+swap") return peaks.anon_swap;
+    return cg.memory_peak();
+}
+
+/**
+ * for actions repeated in the supervisor loop
+ * @param   next        when the action is due, advanced if it is due.
+ *                      missed ones are not caught up
+ * @param   wait        shortened to wake up for the next one
+ * @return  true if the action is due now
+ */
+static bool is_due(double& next, double interval, double time, double& wait) {
+    bool due = time >= next;
+    if (due) {
+        next += interval;
+        if (next < time) next = time + interval;
+    }
+    double left = next - time;
+    if (wait < 0 || left < wait) wait = left;
+    return due;
+}
+
+/**
+ * call before spawning a run
+ */
+static void start_run(Cgroup& cg) {
+    // --quiet-machine: page cache left by previous runs is dropped so every
+    // run starts the same. the peak is reset again after that
+    if (config.quiet_machine && cg.reclaim_memory() == 0) cg.reset_usages();
+    if (detailed_report()) {
+        read_counters(cg, counters_base);
+        read_environment(environment_base);
+    }
+    publish_status(cg, LRUN_BOARD_SETUP, 0, NULL);
+}
+
+static void check_spawn_result(Cgroup& cg, pid_t pid) {
     if (pid <= 0) {
         // error messages are printed before, by child
+        const Cgroup::spawn_report& report = cg.last_spawn_report();
+        if (report.failed_step >= 0) {
+            errno = report.error;
+            ERROR("can not start child: %s failed", Cgroup::spawn_step_name(report.failed_step));
+        }
         clean_cg_exit(cg, 10 - pid);
     }
+}
 
-    // prepare signal handlers and make lrun "higher priority"
-    setup_signal_handlers();
-    if (nice(-5) == -1) ERROR("can not renice");
-
+/**
+ * watch the child until it exits or exceeds a limit
+ * @param   result      filled with resource usages, except teardown_time
+ */
+static void supervise(Cgroup& cg, pid_t pid, run_result& result) {
     INFO("entering main loop, watching pid %d", (int)pid);
 
     // monitor its cpu_usage and real time usage and memory usage
     double start_time = now();
     double deadline = config.real_time_limit > 0 ? start_time + config.real_time_limit : -1;
 
-    // child process stat (set by waitpid)
+    // child process stat and rusage (set by wait4)
     int stat = 0;
+    struct rusage usage;
+    memset(&usage, 0, sizeof usage);
+    usage.ru_maxrss = -1;
 
     // which limit exceed
     string exceeded_limit = "";
 
-    for (bool running = true; running;) {
+    // the main loop sleeps in epoll_wait and only wakes up on events: signals,
+    // child exit, fs tracer exit, real time deadline and memory cgroup oom.
+    // cpu time has no notification, wake up at computed checkpoints instead.
+    // if some event source is not available, fallback to polling.
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        ERROR("can not create epoll fd");
+        clean_cg_exit(cg, 5);
+    }
+
+    int signal_fd = open_signalfd();
+    int child_fd = pidfd::open(pid);
+    int tracer_fd = options::fstracer::started() ? pidfd::open(options::fstracer::pid()) : -1;
+    int deadline_fd = deadline > 0 ? open_timerfd(config.real_time_limit) : -1;
+    int oom_fd = config.memory_limit > 0 ? cg.oom_eventfd() : -1;
+
+    if (add_watch(epfd, signal_fd, WATCH_SIGNAL)) signal_fd = close_fd(signal_fd);
+    if (add_watch(epfd, child_fd, WATCH_CHILD)) child_fd = close_fd(child_fd);
+    if (add_watch(epfd, tracer_fd, WATCH_TRACER)) tracer_fd = close_fd(tracer_fd);
+    if (add_watch(epfd, deadline_fd, WATCH_DEADLINE)) deadline_fd = close_fd(deadline_fd);
+    if (add_watch(epfd, oom_fd, WATCH_OOM)) oom_fd = close_fd(oom_fd);
+
+    INFO("watching fds: signal %d, child %d, tracer %d, deadline %d, oom %d",
+         signal_fd, child_fd, tracer_fd, deadline_fd, oom_fd);
+
+    // memory.stat has no peak, sample it
+    bool need_memory_stat = config.memory_accounting != "total" || detailed_report();
+    memory_peaks peaks = {-1, -1, -1};
+
+    // with --max-processes, pids.current has no peak on v1 or older
+    // kernels, sample it. pids.events counts since the cgroup was created
+    long long pids_hits_base = (detailed_report() && config.process_limit > 0) ? cg.pids_limit_hits() : -1;
+    long long processes_peak = pids_hits_base >= 0 ? cg.pids_current() : -1;
+
+    // tasks in the sandbox, sampled whenever the supervisor wakes up.
+    // cgroups have no counter of created tasks
+    long long tasks_peak = detailed_report() ? 1 : -1;
+
+    // polling is required for things without notifications
+    bool need_polling = (config.output_limit > 0)
+        || (config.memory_accounting != "total")
+        || (pids_hits_base >= 0)
+        || (signal_fd < 0 && child_fd < 0)
+        || (options::fstracer::started() && tracer_fd < 0)
+        || (config.memory_limit > 0 && oom_fd < 0);
+#ifndef NDEBUG
+    if (DEBUG_PROGRESS) need_polling = true;
+#endif
+
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpu_count < 1) cpu_count = 1;
+
+    // used to compute cpu usage rate
+    double last_cpu_time_usage = 0, last_check_time = start_time;
+
+    // --telemetry-fd, the first sample is taken right now
+    double next_sample = config.telemetry_fd >= 0 ? start_time : -1;
+    double stall_base[TELEMETRY_STALL_COUNT];
+    for (int i = 0; i < TELEMETRY_STALL_COUNT; ++i) stall_base[i] = next_sample >= 0 ? cg.pressure_stall(telemetry_stalls[i]) : -1;
+    usage_sample sample;
+
+    // --status-board, counters are first published right now
+    publish_status(cg, LRUN_BOARD_RUNNING, pid, NULL);
+    double next_publish = config.status_board_interval > 0 ? start_time : -1;
+
+    // set by events
+    bool child_gone = false;
+    bool deadline_reached = false;
+    bool oom_triggered = false;
+
+    // when the memory limit was hit, relative to start_time
+    double memory_limit_time = -1;
+
+    for (;;) {
         // check signal
         if (signal_triggered) {
             fprintf(stderr, "Receive signal %d, exiting...\n", signal_triggered);
@@ -281,7 +1131,7 @@ static int run_command() {
         }
 
         // check stat
-        int e = waitpid(pid, &stat, WNOHANG);
+        int e = wait4(pid, &stat, WNOHANG, &usage);
 
         if (e == pid) {
             // stat available
@@ -289,51 +1139,55 @@ static int run_command() {
                 INFO("child exited");
                 break;
             }
-        } else if (e == -1) {
-            // see what's wrong
-            if (errno == ECHILD) {
-                // strangely, this happens at the beginning (?)
-                usleep(config.interval);
-            }
+        } else if (e == -1 && child_gone) {
+            // pidfd says the child is gone but waitpid does not agree.
+            // something goes wrong, give up
+            clean_cg_exit(cg, 6);
         }
 
         // clean stat
         stat = 0;
 
+        sample.cpu_time = sample.output = sample.tasks = -1;
+
+        // processes under oom are stuck in the kernel (v1) or being killed
+        // by the kernel (v2), stop them before checking anything else
+        if (oom_triggered) {
+            exceeded_limit = "MEMORY";
+            break;
+        }
+
         // check time limit exceed
-        if (config.cpu_time_limit > 0 && cg.cpu_usage() >= config.cpu_time_limit) {
+        double cpu_time_usage = config.cpu_time_limit > 0 ? cg.cpu_usage() : 0;
+        if (config.cpu_time_limit > 0) sample.cpu_time = cpu_time_usage;
+        if (config.cpu_time_limit > 0 && cpu_time_usage >= config.cpu_time_limit) {
             exceeded_limit = "CPU_TIME";
             break;
         }
 
         // check realtime exceed
-        if (deadline > 0 && now() >= deadline) {
+        if (deadline_reached || (deadline > 0 && now() >= deadline)) {
             exceeded_limit = "REAL_TIME";
             break;
         }
 
-        // check memory limit
-        if (cg.memory_peak() >= config.memory_limit && config.memory_limit > 0) {
-            exceeded_limit = "MEMORY";
-            break;
+        if (pids_hits_base >= 0) {
+            long long processes = cg.pids_current();
+            if (processes > processes_peak) processes_peak = processes;
         }
 
-        // in case SIGCHILD is unreliable
-        // check zombie manually here instead of waiting SIGCHILD
-        if (get_process_state(pid) == 'Z') {
-            INFO("child becomes zombie");
-            running = false;
-            // check waitpid again
-            e = waitpid(pid, &stat, WNOHANG);
-            if (e == -1) {
-                // something goes wrong, give up
-                clean_cg_exit(cg, 6);
-            }
+        // check memory limit, without oom notifications
+        if (need_memory_stat) sample_memory(cg, peaks);
+        if (config.memory_limit > 0 && accounted_memory(cg, peaks) >= config.memory_limit) {
+            memory_limit_time = now() - start_time;
+            exceeded_limit = "MEMORY";
+            break;
         }
 
         if (config.output_limit > 0) {
             cg.update_output_count();
             long long output_bytes = cg.output_usage();
+            sample.output = output_bytes;
 
             if (output_bytes > config.output_limit) {
                 exceeded_limit = "OUTPUT";
@@ -347,21 +1201,112 @@ static int run_command() {
             cg.cpu_usage(), now() - start_time, cg.memory_current() / 1.e6, cg.memory_peak() / 1.e6);
         }
 
-        // sleep for a while
-        usleep(config.interval);
+        // compute how long we can sleep
+        double wait = -1;
+        if (config.cpu_time_limit > 0) {
+            double check_time = now();
+            double observed_rate = check_time > last_check_time ? (cpu_time_usage - last_cpu_time_usage) / (check_time - last_check_time) : 0;
+            last_cpu_time_usage = cpu_time_usage;
+            last_check_time = check_time;
+
+            sample.tasks = cg.thread_count();
+            wait = checkpoint::next_cpu(config.cpu_time_limit - cpu_time_usage, observed_rate, sample.tasks, cpu_count);
+        }
+        if (tasks_peak >= 0) {
+            if (sample.tasks < 0) sample.tasks = cg.thread_count();
+            if (sample.tasks > tasks_peak) tasks_peak = sample.tasks;
+        }
+        if (next_sample >= 0 || next_publish >= 0) {
+            double check_time = now();
+            if (next_sample >= 0 && is_due(next_sample, config.telemetry_interval, check_time, wait)) {
+                write_telemetry(cg, check_time - start_time, sample, stall_base);
+            }
+            if (next_publish >= 0 && is_due(next_publish, config.status_board_interval, check_time, wait)) {
+                publish_status(cg, -1, pid, &sample);
+            }
+        }
+        if (deadline > 0 && deadline_fd < 0) {
+            double left = deadline - now();
+            if (wait < 0 || left < wait) wait = left;
+        }
+        if (need_polling && (wait < 0 || wait > config.interval / 1e6)) {
+            wait = config.interval / 1e6;
+        }
+
+        int timeout = wait < 0 ? -1 : (int)ceil(wait * 1000);
+        if (wait >= 0 && timeout <= 0) timeout = 1;
+
+        // sleep until something happens
+        struct epoll_event events[8];
+        int n = epoll_wait(epfd, events, sizeof(events) / sizeof(events[0]), timeout);
+        if (n < 0 && errno != EINTR) {
+            ERROR("epoll_wait failed");
+            clean_cg_exit(cg, 5);
+        }
+
+        for (int i = 0; i < n; ++i) {
+            switch (events[i].data.u32) {
+                case WATCH_SIGNAL:
+                    read_signalfd(signal_fd);
+                    break;
+                case WATCH_CHILD:
+                    INFO("child is gone");
+                    child_gone = true;
+                    break;
+                case WATCH_TRACER:
+                    // fs tracer is checked at the beginning of the loop
+                    // stop watching so the loop won't spin
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, tracer_fd, NULL);
+                    break;
+                case WATCH_DEADLINE:
+                    deadline_reached = true;
+                    break;
+                case WATCH_OOM:
+                    if (cg.read_oom_event(oom_fd)) {
+                        INFO("memory cgroup is under oom");
+                        oom_triggered = true;
+                        memory_limit_time = now() - start_time;
+                    }
+                    break;
+            }
+        }
+    }
+
+    // the child may be killed by the kernel oom killer before we read the
+    // event. the time it happened is unknown then, memory_limit_time stays -1
+    if (oom_fd >= 0 && !oom_triggered) oom_triggered = cg.read_oom_event(oom_fd);
+
+    // the last sample, at exit
+    if (next_sample >= 0) {
+        sample.cpu_time = sample.output = sample.tasks = -1;
+        write_telemetry(cg, now() - start_time, sample, stall_base);
     }
 
+    close_fd(oom_fd);
+    close_fd(deadline_fd);
+    close_fd(tracer_fd);
+    close_fd(child_fd);
+    close_signalfd(signal_fd);
+    close_fd(epfd);
+
     PROGRESS_INFO("\nOUT OF RUNNING LOOP\n");
 
     // collect stats
-    long long memory_usage = cg.memory_peak();
-    if (config.memory_limit > 0 && memory_usage >= config.memory_limit) {
+    if (need_memory_stat) sample_memory(cg, peaks);
+    // tasks left behind by the command are still there
+    if (tasks_peak >= 0) tasks_peak = std::max(tasks_peak, (long long)cg.thread_count());
+    long long memory_usage = accounted_memory(cg, peaks);
+    if (memory_usage < 0) memory_usage = 0;
+    if (config.memory_limit > 0 && (oom_triggered || memory_usage >= config.memory_limit)) {
         memory_usage = config.memory_limit;
         exceeded_limit = "MEMORY";
     }
 
     double cpu_time_usage = cg.cpu_usage();
+    // how much cpu time was used beyond the limit before we noticed
+    double cpu_time_overshoot = 0;
     if ((WIFSIGNALED(stat) && WTERMSIG(stat) == SIGXCPU) || (config.cpu_time_limit > 0 && cpu_time_usage >= config.cpu_time_limit)) {
+        if (cpu_time_usage > config.cpu_time_limit) cpu_time_overshoot = cpu_time_usage - config.cpu_time_limit;
         cpu_time_usage = config.cpu_time_limit;
         exceeded_limit = "CPU_TIME";
     }
@@ -370,57 +1315,890 @@ static int run_command() {
         exceeded_limit = "OUTPUT";
     }
 
-    double real_time_usage = now() - start_time;
+    double run_time = now() - start_time;
+    double real_time_usage = run_time;
     if (config.real_time_limit > 0 && real_time_usage >= config.real_time_limit) {
         real_time_usage = config.real_time_limit;
         exceeded_limit = "REAL_TIME";
     }
 
-    char status_report[4096];
-
-    snprintf(status_report, sizeof status_report,
-            "MEMORY   %lld\n"
-            "CPUTIME  %.3f\n"
-            "REALTIME %.3f\n"
-            "SIGNALED %d\n"
-            "EXITCODE %d\n"
-            "TERMSIG  %d\n"
-            "EXCEED   %s\n",
-            memory_usage, cpu_time_usage, real_time_usage,
-            WIFSIGNALED(stat) ? 1 : 0,
-            WEXITSTATUS(stat),
-            WTERMSIG(stat),
-            exceeded_limit.empty() ? "none" : exceeded_limit.c_str());
-
-    if (config.write_result_to_3) {
-        int ret = write(3, status_report, strlen(status_report));
-        (void)ret;
+    result.stat = stat;
+    result.memory_usage = memory_usage;
+    result.cpu_time_usage = cpu_time_usage;
+    result.cpu_time_overshoot = cpu_time_overshoot;
+    result.real_time_usage = real_time_usage;
+    result.teardown_time = 0;
+    result.exceeded_limit = exceeded_limit;
+    result.usage = usage;
+    result.memory_limit_time = memory_limit_time;
+    result.memory_total = cg.memory_peak();
+    result.memory_rss = peaks.rss;
+    result.memory_anon_swap = peaks.anon_swap;
+    result.detailed = false;
+
+    if (detailed_report()) {
+        result.detailed = true;
+        result.setup_time = start_time - setup_start_time;
+        result.run_time = run_time;
+
+        cgroup_counters counters;
+        read_counters(cg, counters);
+        result.counters.user_time = counter_delta(counters.user_time, counters_base.user_time);
+        result.counters.system_time = counter_delta(counters.system_time, counters_base.system_time);
+        result.counters.minor_faults = counter_delta(counters.minor_faults, counters_base.minor_faults);
+        result.counters.major_faults = counter_delta(counters.major_faults, counters_base.major_faults);
+        result.counters.throttled_periods = counter_delta(counters.throttled_periods, counters_base.throttled_periods);
+        result.counters.throttled_time = counter_delta(counters.throttled_time, counters_base.throttled_time);
+
+        result.page_cache = peaks.cache;
+        result.cpu_usage_percpu = cg.cpu_usage_percpu();
+        // cpuacct.usage_percpu is reset with cpuacct.usage, no need to
+        // subtract. it is not available on v2
+        result.processes = std::max(tasks_peak, processes_peak);
+        result.process_limit_hits = counter_delta(cg.pids_limit_hits(), pids_hits_base);
+        // the peak was missed if it only lasted between samples
+        if (result.process_limit_hits > 0 && config.process_limit > processes_peak) processes_peak = config.process_limit;
+        result.processes_peak = processes_peak;
+        result.cpus = cg.cpuset_cpus();
+        if (result.cpus.empty()) result.cpus = strconv::from_int_list(config.arg.cpu_affinity);
+
+        environment_sample& environment = result.environment;
+        read_environment(environment);
+        if (environment.cpu_mhz >= 0 && environment_base.cpu_mhz >= 0) environment.cpu_mhz = (environment.cpu_mhz + environment_base.cpu_mhz) / 2;
+        if (environment_base.runnable_tasks > environment.runnable_tasks) environment.runnable_tasks = environment_base.runnable_tasks;
+
+    }
+}
+
+
+/**
+ * @param   pid         the command, reaped here if it still runs
+ * @param   last        no more runs in this sandbox
+ */
+static void teardown(Cgroup& cg, pid_t pid, run_result& result, bool last) {
+    // kill remaining processes before reporting, so the sandbox is ready
+    // to be reused once the report is read. with async cleanup, only send
+    // signals here and let the reaper wait for them
+    double teardown_start = now();
+    publish_status(cg, LRUN_BOARD_TEARDOWN, 0, NULL);
+
+    // the command still runs if it exceeded a limit. it is our child,
+    // reap it first for its rusage
+    if (result.usage.ru_maxrss < 0 && kill(pid, SIGKILL) == 0) {
+        int killed_stat;
+        while (wait4(pid, &killed_stat, __WALL, &result.usage) < 0 && errno == EINTR);
+    }
+
+    if (!last && fork_server_pid > 0) {
+        cg.killall_except(fork_server_pid);
+    } else if (last && config.async_cleanup) {
+        cg.killall(false /* confirm */);
+    } else {
+        if (last && options::fstracer::started()) {
+            // pre-kill, see clean_cg_exit
+            cg.killall(false /* confirm */);
+            options::fstracer::stop();
+        }
+        cg.killall();
+    }
+    result.teardown_time = now() - teardown_start;
+}
+
+// results are only written if fd 3 is open
+static void write_result(const run_result& result, const char *label = NULL, size_t index = 0) {
+    if (config.write_result_to_3) report::write_result(config.report_format, result, label, index);
+}
+
+static void write_run_error(const char *label, size_t index, const string& message) {
+    if (config.write_result_to_3) report::write_error(config.report_format, label, index, message);
+}
+
+/**
+ * @return  why the last spawn failed, for write_run_error
+ */
+static string spawn_error_message(Cgroup& cg) {
+    const Cgroup::spawn_report& report = cg.last_spawn_report();
+    string message = "can not start child";
+    if (report.failed_step >= 0) message += string(": ") + Cgroup::spawn_step_name(report.failed_step) + " failed";
+    return message;
+}
+
+/**
+ * use limits of a testcase or batch item for the next run
+ */
+static void apply_run_limits(Cgroup& cg, const RunLimits& limits) {
+    // limits are read by supervise and configure_cgroup from config
+    config.cpu_time_limit = limits.cpu_time;
+    config.real_time_limit = limits.real_time;
+    config.memory_limit = limits.memory;
+    config.output_limit = limits.output;
+    if (limits.cpu_time > 0) {
+        config.arg.rlimits[RLIMIT_CPU] = (int)(ceil(limits.cpu_time));
+    } else {
+        config.arg.rlimits.erase(RLIMIT_CPU);
+    }
+    if (limits.output > 0) {
+        config.arg.rlimits[RLIMIT_FSIZE] = limits.output;
+    } else {
+        config.arg.rlimits.erase(RLIMIT_FSIZE);
+    }
+
+    // killall of the previous run cancels the memory limit
+    if (cg.set_memory_limit(config.memory_limit) && config.memory_limit > 0) WARNING("can not set memory limit");
+}
+
+static int run_command() {
+    Cgroup& cg = *config.active_cgroup;
+
+    prepare_run(cg);
+    start_run(cg);
+
+    // spawn child
+    pid_t pid = cg.spawn(config.arg);
+    check_spawn_result(cg, pid);
+
+    // prepare signal handlers and make lrun "higher priority"
+    setup_signal_handlers();
+    if (nice(-5) == -1) ERROR("can not renice");
+
+    run_result result;
+    supervise(cg, pid, result);
+    teardown(cg, pid, result, true /* last */);
+    write_result(result);
+
+    // close output earlier (before clean_cg_exit)
+    // so the process read the status can start to do other things.
+    if (config.write_result_to_3) close(3);
+
+    return config.pass_exitcode ? WEXITSTATUS(result.stat) : EXIT_SUCCESS;
+}
+
+// the user running lrun, saved before become_root
+static uid_t real_uid;
+static gid_t real_gid;
+
+/**
+ * open a user specified file as the real user, lrun is setuid root
+ * @return  same as open()
+ */
+static int open_as_user(const string& path, int flags) {
+    gid_t egid = getegid();
+    if (setegid(real_gid) || seteuid(real_uid)) FATAL("can not drop privileges");
+
+    int fd = open(path.c_str(), flags | O_CLOEXEC, 0644);
+    int saved_errno = errno;
+
+    if (seteuid(0) || setegid(egid)) FATAL("can not restore privileges");
+    errno = saved_errno;
+    return fd;
+}
+
+// [(stdin fd, stdout fd)], opened before running anything. -1 if a file
+// can not be opened, the testcase is reported as an error
+static std::vector<std::pair<int, int> > testcase_fds;
+
+static void open_testcases() {
+    FOR_EACH(p, config.testcases) {
+        int stdin_fd = open_as_user(p.first, O_RDONLY);
+        if (stdin_fd < 0) ERROR("can not open %s", p.first.c_str());
+        int stdout_fd = open_as_user(p.second, O_WRONLY | O_CREAT | O_TRUNC);
+        if (stdout_fd < 0) ERROR("can not open %s", p.second.c_str());
+        testcase_fds.push_back(make_pair(stdin_fd, stdout_fd));
+    }
+}
+
+/**
+ * ask the fork server for a copy. the reply comes from the sandbox, so it
+ * is checked: the copy must be our child (libforkserver uses CLONE_PARENT)
+ * and in the cgroup. the copy waits for a byte on go_sock before main
+ * @return  pid         pid of the copy, -1 if failed
+ */
+static pid_t request_copy(Cgroup& cg, int stdin_fd, int stdout_fd, int& go_sock) {
+    int sockets[2];
+    if (socketpair(AF_LOCAL, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets)) {
+        ERROR("socketpair failed");
+        return -1;
+    }
+
+    int fds[3] = {stdin_fd, stdout_fd, sockets[1]};
+    char buf[1] = {'F'};
+    int err = 0;
+    int pidfd = -1;
+    int nfds = 1;
+    pid_t pid = -1;
+    if (fdpass::send(fork_server_sock, buf, sizeof buf, fds, 3) == 0
+            && fdpass::recv(fork_server_sock, &err, sizeof err, &pidfd, &nfds) == (ssize_t)sizeof err
+            && nfds == 1) {
+        pid = pidfd::get_pid(pidfd);
+        if (pid > 0 && (pid == fork_server_pid || !pidfd::is_child(pidfd) || !cg.has_pid(pid))) {
+            WARNING("fork server replied with pid %lu, which is not a copy", (unsigned long)pid);
+            pid = -1;
+            err = 0;
+        }
+        close(pidfd);
+    }
+    close(sockets[1]);
+    if (pid <= 0) {
+        errno = err;
+        ERROR("fork server can not fork");
+        close(sockets[0]);
+        return -1;
+    }
+
+    go_sock = sockets[0];
+    return pid;
+}
+
+static void start_fork_server(Cgroup& cg) {
+    int sockets[2];
+    if (socketpair(AF_LOCAL, SOCK_SEQPACKET, 0, sockets) || fcntl(sockets[0], F_SETFD, FD_CLOEXEC)) {
+        ERROR("can not create fork server socket");
+        clean_cg_exit(cg, 5);
+    }
+    config.arg.keep_fds.insert(sockets[1]);
+    config.arg.env_list.push_back(make_pair(string("LD_PRELOAD"), config.fork_server));
+    config.arg.env_list.push_back(make_pair(string(FORK_SERVER_FD_ENV), strconv::from_long(sockets[1])));
+
+    // the server never runs main. if it does (ex. a static binary does not
+    // load the shim), it reads no testcase input and exits early
+    int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    Cgroup::spawn_arg arg = config.arg;
+    if (null_fd >= 0) arg.stdin_fd = arg.stdout_fd = null_fd;
+    fork_server_pid = cg.spawn(arg);
+    close(sockets[1]);
+    check_spawn_result(cg, fork_server_pid);
+    fork_server_sock = sockets[0];
+
+    // the shim replies before dynamic initialization, wait for a short time
+    // instead of the real time limit
+    static const int READY_TIMEOUT_MS = 2000;
+    struct pollfd pfds[2];
+    pfds[0].fd = fork_server_sock;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = pidfd::open(fork_server_pid);
+    pfds[1].events = POLLIN;
+    int timeout = READY_TIMEOUT_MS;
+    if (config.real_time_limit > 0 && config.real_time_limit * 1000 < timeout) timeout = (int)ceil(config.real_time_limit * 1000);
+    char buf[1];
+    int ready = poll(pfds, 2, timeout) > 0 && recv(fork_server_sock, buf, sizeof buf, MSG_DONTWAIT) == 1;
+    close_fd(pfds[1].fd);
+    if (!ready) {
+        errno = 0;
+        ERROR("fork server is not ready. is the command dynamically linked and the shim path inside the chroot?");
+        clean_cg_exit(cg, 11);
+    }
+
+    // fork a copy and drop it, so a --syscalls filter which blocks the
+    // server fails here instead of in every testcase
+    int go_sock = -1;
+    pid_t probe_pid = null_fd >= 0 ? request_copy(cg, null_fd, null_fd, go_sock) : 0;
+    close_fd(null_fd);
+    if (probe_pid < 0) {
+        errno = 0;
+        ERROR("fork server can not fork copies. --syscalls must allow clone, pidfd_open, recvmsg and sendmsg");
+        clean_cg_exit(cg, 11);
+    }
+    if (probe_pid > 0) {
+        // the copy exits without running main
+        close(go_sock);
+        while (waitpid(probe_pid, NULL, __WALL) < 0 && errno == EINTR);
+    }
+
+    INFO("fork server pid = %lu", (unsigned long)fork_server_pid);
+}
+
+static pid_t fork_from_server(Cgroup& cg, int stdin_fd, int stdout_fd) {
+    int go_sock = -1;
+    pid_t pid = request_copy(cg, stdin_fd, stdout_fd, go_sock);
+    if (pid < 0) return -1;
+
+    // the copy inherits rlimits of the server, use those of this testcase.
+    // like Cgroup::spawn, the hard limit is higher to get SIGXCPU and SIGXFSZ
+    static const int resources[] = {RLIMIT_CPU, RLIMIT_FSIZE};
+    for (size_t i = 0; i < sizeof(resources) / sizeof(resources[0]); ++i) {
+        struct rlimit limit;
+        limit.rlim_cur = limit.rlim_max = RLIM_INFINITY;
+        if (config.arg.rlimits.count(resources[i])) {
+            limit.rlim_cur = config.arg.rlimits[resources[i]];
+            limit.rlim_max = limit.rlim_cur + 1;
+        }
+        if (prlimit(pid, (enum __rlimit_resource)resources[i], &limit, NULL)) INFO("can not set rlimit %d of copy", resources[i]);
+    }
+
+    // counters are reset, let the copy run main
+    char buf[1] = {'G'};
+    if (send(go_sock, buf, sizeof buf, MSG_NOSIGNAL) < 0) INFO("can not send let-go message to copy");
+    close(go_sock);
+
+    INFO("child pid = %lu", (unsigned long)pid);
+    return pid;
+}
+
+/**
+ * set up the sandbox once, for runs forked by spawn_shared
+ */
+static void start_shared_sandbox(Cgroup& cg) {
+    prepare_run(cg);
+
+    if (!config.fork_server.empty()) {
+        start_fork_server(cg);
+    } else {
+        int e = cg.start_zygote(config.arg);
+        if (e) check_spawn_result(cg, e);
+    }
+
+    setup_signal_handlers();
+    if (nice(-5) == -1) ERROR("can not renice");
+}
+
+/**
+ * fork a fresh child from the shared sandbox
+ * @param   index       run index, used to reset counters and for telemetry
+ * @param   label       "testcase" or "repeat"
+ * @return  pid         child pid, <= 0 if failed, see check_spawn_result
+ */
+static pid_t spawn_shared(Cgroup& cg, size_t index, const char *label, int stdin_fd, int stdout_fd) {
+    // the first run is set up since lrun started
+    if (index > 0) setup_start_time = now();
+    telemetry_label = string(label) + "=" + strconv::from_ulong((unsigned long)index) + " ";
+
+    // counters of previous runs, or the fork server startup
+    if ((index > 0 || fork_server_pid > 0) && cg.reset_usages()) WARNING("can not reset cgroup counters");
+    start_run(cg);
+
+    // rlimits may differ between testcases
+    return fork_server_pid > 0
+        ? fork_from_server(cg, stdin_fd, stdout_fd)
+        : cg.spawn_from_zygote(stdin_fd, stdout_fd, &config.arg.rlimits);
+}
+
+static void stop_shared_sandbox(Cgroup& cg) {
+    // the zygote holds fd 3 too
+    cg.stop_zygote();
+    if (config.write_result_to_3) close(3);
+}
+
+static int run_testcases() {
+    Cgroup& cg = *config.active_cgroup;
+
+    // the sandbox is set up once, each testcase forks a fresh child from it
+    start_shared_sandbox(cg);
+
+    run_result result;
+    for (size_t i = 0; i < testcase_fds.size(); ++i) {
+        int stdin_fd = testcase_fds[i].first;
+        int stdout_fd = testcase_fds[i].second;
+        if (stdin_fd < 0 || stdout_fd < 0) {
+            write_run_error("testcase", i, "can not open stdin or stdout");
+            close_fd(stdin_fd);
+            close_fd(stdout_fd);
+            continue;
+        }
+
+        if (i < config.testcase_limits.size()) apply_run_limits(cg, config.testcase_limits[i]);
+        pid_t pid = spawn_shared(cg, i, "testcase", stdin_fd, stdout_fd);
+        close(stdin_fd);
+        close(stdout_fd);
+
+        // other testcases can still run
+        if (pid <= 0) {
+            write_run_error("testcase", i, spawn_error_message(cg));
+            cg.killall();
+            continue;
+        }
+
+        supervise(cg, pid, result);
+        teardown(cg, pid, result, i + 1 == testcase_fds.size());
+        write_result(result, "testcase", i);
+    }
+
+    stop_shared_sandbox(cg);
+
+    return config.pass_exitcode ? WEXITSTATUS(result.stat) : EXIT_SUCCESS;
+}
+
+/**
+ * @return  the verdict from the --repeat-statistic of samples, same values
+ *          as run_result::exceeded_limit
+ */
+static string repeat_verdict(const repeat_samples& samples) {
+    const string& statistic = config.repeat_statistic;
+    if (samples.output_exceeded) return "OUTPUT";
+    if (config.memory_limit > 0
+            && stats::get(stats::summarize(samples.memory), statistic) >= config.memory_limit) {
+        return "MEMORY";
+    }
+    if (config.cpu_time_limit > 0
+            && stats::get(stats::summarize(samples.cpu_time), statistic) >= config.cpu_time_limit) {
+        return "CPU_TIME";
+    }
+    if (config.real_time_limit > 0
+            && stats::get(stats::summarize(samples.real_time), statistic) >= config.real_time_limit) {
+        return "REAL_TIME";
+    }
+    return "";
+}
+
+/**
+ * @return  true if more runs can not change the verdict: a limit is
+ *          decided to be exceeded, or all limits are decided not to be
+ */
+static bool repeat_decided(const repeat_samples& samples) {
+    if (samples.output_exceeded) return true;
+
+    struct { double limit; const std::vector<double> *values; } limits[] = {
+        { (double)config.memory_limit, &samples.memory },
+        { config.cpu_time_limit, &samples.cpu_time },
+        { config.real_time_limit, &samples.real_time },
+    };
+
+    bool limited = false, all_under = true;
+    for (size_t i = 0; i < sizeof(limits) / sizeof(limits[0]); ++i) {
+        if (limits[i].limit <= 0) continue;
+        limited = true;
+        int d = stats::decide(*limits[i].values, config.repeat, config.repeat_statistic, limits[i].limit);
+        if (d == 1) return true;
+        if (d != 0) all_under = false;
+    }
+    return limited && all_under;
+}
+
+static int run_repeats() {
+    Cgroup& cg = *config.active_cgroup;
 
-        // close output earlier (before clean_cg_exit)
-        // so the process read the status can start to do other things.
-        close(3);
+    // like --testcase, the sandbox is set up once and shared by runs
+    start_shared_sandbox(cg);
+
+    run_result result;
+    repeat_samples samples;
+    samples.output_exceeded = false;
+    for (int i = 0; i < config.repeat; ++i) {
+        // every run reads the same input, if stdin can be rewound
+        if (i > 0 && lseek(config.arg.stdin_fd, 0, SEEK_SET) < 0 && errno != ESPIPE) INFO("can not rewind stdin");
+        pid_t pid = spawn_shared(cg, i, "repeat", config.arg.stdin_fd, config.arg.stdout_fd);
+        check_spawn_result(cg, pid);
+        supervise(cg, pid, result);
+
+        samples.cpu_time.push_back(result.cpu_time_usage);
+        samples.real_time.push_back(result.real_time_usage);
+        samples.memory.push_back((double)result.memory_usage);
+        if (result.exceeded_limit == "OUTPUT") samples.output_exceeded = true;
+
+        bool last = i + 1 == config.repeat || repeat_decided(samples);
+        teardown(cg, pid, result, last);
+        write_result(result, "repeat", i);
+        if (last) {
+            if (i + 1 < config.repeat) INFO("verdict decided after %d runs", i + 1);
+            break;
+        }
     }
 
-    return config.pass_exitcode ? WEXITSTATUS(stat) : EXIT_SUCCESS;
+    if (config.write_result_to_3) report::write_repeat_summary(config.report_format, samples, config.repeat, config.repeat_statistic, repeat_verdict(samples));
+    stop_shared_sandbox(cg);
+
+    return config.pass_exitcode ? WEXITSTATUS(result.stat) : EXIT_SUCCESS;
+}
+
+// --batch: items of a manifest, each with its own stdin, stdout, limits
+// and optionally its own command
+static std::vector<options::batch_item> batch_items;
+
+// shared by batch workers
+struct batch_state {
+    volatile int next_item;
+    volatile int failed;
+};
+
+static void read_batch_manifest() {
+    int fd = open_as_user(config.batch_manifest, O_RDONLY);
+    if (fd < 0) FATAL("can not open %s", config.batch_manifest.c_str());
+
+    string content;
+    char buf[4096];
+    ssize_t len;
+    while ((len = read(fd, buf, sizeof buf)) > 0) content.append(buf, len);
+    close(fd);
+
+    options::limits defaults = { config.cpu_time_limit, config.real_time_limit, config.memory_limit, config.output_limit };
+    string error;
+    if (options::parse_batch_manifest(content, defaults, config.arg.argc > 0, batch_items, error)) {
+        errno = 0;
+        FATAL("%s: %s", config.batch_manifest.c_str(), error.c_str());
+    }
+}
+
+/**
+ * run one batch item in the current cgroup
+ * @return  0           the item passed
+ *          1           the item failed
+ */
+static int run_batch_item(Cgroup& cg, size_t index) {
+    const options::batch_item& item = batch_items[index];
+    INFO("running batch item %lu", (unsigned long)index);
+    setup_start_time = now();
+    telemetry_label = "item=" + strconv::from_ulong((unsigned long)index) + " ";
+
+    int stdin_fd = item.stdin_path.empty() ? STDIN_FILENO : open_as_user(item.stdin_path, O_RDONLY);
+    int stdout_fd = item.stdout_path.empty() ? STDOUT_FILENO : open_as_user(item.stdout_path, O_WRONLY | O_CREAT | O_TRUNC);
+    if (stdin_fd < 0 || stdout_fd < 0) {
+        write_run_error("item", index, "can not open stdin or stdout");
+        if (stdin_fd > STDIN_FILENO) close(stdin_fd);
+        if (stdout_fd > STDOUT_FILENO) close(stdout_fd);
+        return 1;
+    }
+
+    apply_run_limits(cg, item.limits);
+    cg.set(Cgroup::CG_MEMORY, "memory.oom_control", "0\n");
+    if (cg.reset_usages()) WARNING("can not reset cgroup counters");
+    start_run(cg);
+
+    std::vector<char *> args;
+    FOR_EACH(p, item.args) args.push_back(const_cast<char *>(p.c_str()));
+    args.push_back(NULL);
+
+    Cgroup::spawn_arg arg = config.arg;
+    arg.stdin_fd = stdin_fd;
+    arg.stdout_fd = stdout_fd;
+    if (!item.args.empty()) {
+        arg.args = &args[0];
+        arg.argc = (int)item.args.size();
+    }
+
+    pid_t pid = cg.spawn(arg);
+    if (stdin_fd != STDIN_FILENO) close(stdin_fd);
+    if (stdout_fd != STDOUT_FILENO) close(stdout_fd);
+
+    if (pid <= 0) {
+        write_run_error("item", index, spawn_error_message(cg));
+        cg.killall();
+        return 1;
+    }
+
+    run_result result;
+    supervise(cg, pid, result);
+    teardown(cg, pid, result, false /* last */);
+    write_result(result, "item", index);
+
+    return (result.exceeded_limit.empty() && !WIFSIGNALED(result.stat) && WEXITSTATUS(result.stat) == 0) ? 0 : 1;
+}
+
+static int run_batch_worker(batch_state& state) {
+    Cgroup& cg = *config.active_cgroup;
+
+    prepare_run(cg);
+    setup_signal_handlers();
+
+    for (;;) {
+        if (signal_triggered) {
+            fprintf(stderr, "Receive signal %d, exiting...\n", signal_triggered);
+            fflush(stderr);
+            clean_cg_exit(cg, 4);
+        }
+        if (config.batch_fail_fast && state.failed) break;
+
+        size_t index = (size_t)__sync_fetch_and_add(&state.next_item, 1);
+        if (index >= batch_items.size()) break;
+
+        if (run_batch_item(cg, index)) state.failed = 1;
+    }
+
+    if (config.write_result_to_3) close(3);
+    return EXIT_SUCCESS;
+}
+
+static int run_batch() {
+    batch_state *state = (batch_state *)mmap(NULL, sizeof(batch_state), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (state == MAP_FAILED) FATAL("mmap failed");
+    memset(state, 0, sizeof(batch_state));
+
+    int workers = config.batch_workers;
+    if ((size_t)workers > batch_items.size()) workers = (int)batch_items.size();
+
+    if (workers <= 1) {
+        create_cgroup();
+        configure_cgroup();
+        clean_cg_exit(*config.active_cgroup, run_batch_worker(*state));
+    }
+
+    // each worker has its own cgroup and takes the next pending item
+    std::vector<pid_t> pids;
+    for (int i = 0; i < workers; ++i) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+            create_cgroup();
+            configure_cgroup();
+            clean_cg_exit(*config.active_cgroup, run_batch_worker(*state));
+        } else if (pid < 0) {
+            ERROR("can not fork batch worker");
+            break;
+        }
+        pids.push_back(pid);
+    }
+    if (config.write_result_to_3) close(3);
+
+    // forward termination signals to workers, they clean up their cgroups
+    setup_signal_handlers();
+    int ret = pids.empty() ? 5 : EXIT_SUCCESS;
+    for (size_t i = 0; i < pids.size();) {
+        int status;
+        if (waitpid(pids[i], &status, 0) < 0) {
+            if (errno != EINTR) break;
+            if (signal_triggered) FOR_EACH(p, pids) kill(p, SIGTERM);
+            continue;
+        }
+        int code = WIFEXITED(status) ? WEXITSTATUS(status) : 4;
+        if (code && !ret) ret = code;
+        ++i;
+    }
+    return ret;
+}
+
+static int run_lrun(int argc, char * argv[]);
+
+// --daemon: jobs are lrun processes forked from the daemon, so they inherit
+// the cached cgroup mount paths and skip exec, dynamic linking and setup.
+// one epoll loop watches the socket, job connections and job exits
+static const size_t DAEMON_MAX_REQUEST = 65536;
+
+// group owning the lrun executable, its members may execute the setuid lrun
+// and submit jobs to the daemon
+static gid_t daemon_gid;
+
+/**
+ * supplementary groups of a user, as set by login
+ * @param  uid  user id
+ * @param  gid  primary group id, always included
+ */
+static std::vector<gid_t> user_groups(uid_t uid, gid_t gid) {
+    std::vector<gid_t> groups(1, gid);
+    struct passwd *pw = getpwuid(uid);
+    if (!pw) return groups;
+    int n = 32;
+    groups.resize(n);
+    while (getgrouplist(pw->pw_name, gid, &groups[0], &n) < 0) groups.resize(n = n * 2);
+    groups.resize(n);
+    return groups;
+}
+
+/**
+ * run a job in a forked process as if `lrun args...` was executed by the
+ * client in its working directory and environment, with fd 3 being the
+ * connection. never returns
+ *
+ * @param  fds      stdin, stdout, stderr and working directory of the client
+ * @param  request  "lrun\0argc\0arg1\0...argN\0KEY=VALUE\0..."
+ */
+static void run_daemon_job(int conn, const struct ucred& peer, char *request, size_t len, const int fds[4]) {
+    // stdio is from the client
+    for (int i = 0; i < 3; ++i) {
+        if (dup2(fds[i], i) < 0) _exit(5);
+        close(fds[i]);
+    }
+    if (dup2(conn, 3) < 0) _exit(5);
+    close(conn);
+
+    // the same privileges as a setuid lrun executed by the client
+    std::vector<gid_t> groups = user_groups(peer.uid, peer.gid);
+    if (peer.uid != 0 && std::find(groups.begin(), groups.end(), daemon_gid) == groups.end()) {
+        errno = 0;
+        ERROR("uid %d is not allowed to run lrun", (int)peer.uid);
+        _exit(1);
+    }
+    if (setgroups(groups.size(), &groups[0]) || setresgid(peer.gid, 0, 0) || setresuid(peer.uid, 0, 0)) _exit(5);
+    real_uid = peer.uid;
+    real_gid = peer.gid;
+
+    // the directory is checked with the privileges of the client, the
+    // saved ids 0 are kept for become_root
+    if (setegid(peer.gid) || seteuid(peer.uid)) _exit(5);
+    if (fchdir(fds[3])) {
+        ERROR("can not change to the working directory of the client");
+        _exit(1);
+    }
+    if (seteuid(0) || setegid(0)) _exit(5);
+    close(fds[3]);
+
+    // options set when starting the daemon are defaults for jobs
+    int cgroup_pool_size = config.cgroup_pool_size;
+    double status_board_interval = config.status_board_interval;
+    config = lrun::MainConfig();
+    config.cgroup_pool_size = cgroup_pool_size;
+    config.status_board_interval = status_board_interval;
+
+    // the request is NUL separated argv, then the environment
+    std::vector<char *> strings;
+    for (size_t pos = 0; pos < len; pos += strlen(request + pos) + 1) strings.push_back(request + pos);
+    long argc = strings.size() >= 2 ? strconv::to_long(strings[1]) : -1;
+    if (argc < 0 || (size_t)argc + 2 > strings.size()) _exit(5);
+
+    std::vector<char *> argv;
+    argv.push_back(strings[0]);
+    argv.insert(argv.end(), strings.begin() + 2, strings.begin() + 2 + argc);
+    argv.push_back(NULL);
+
+    // the request buffer outlives the job, putenv can use it directly
+    clearenv();
+    for (size_t i = 2 + argc; i < strings.size(); ++i) putenv(strings[i]);
+
+    exit(run_lrun((int)argv.size() - 1, &argv[0]));
+}
+
+static int run_daemon() {
+    setup_signal_handlers();
+
+    // cache mount paths, jobs inherit them
+    for (int id = 0; id < Cgroup::SUBSYS_COUNT; ++id) Cgroup::base_path((Cgroup::subsys_id_t)id);
+
+    const string& path = config.daemon_socket;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_LOCAL;
+    if (path.length() >= sizeof(addr.sun_path)) FATAL("socket path is too long");
+    strcpy(addr.sun_path, path.c_str());
+
+    // like the setuid lrun, only root and the group of the executable
+    // (lrun if installed) can connect. jobs check the peer again
+    struct stat exe_stat;
+    if (stat("/proc/self/exe", &exe_stat)) FATAL("can not stat /proc/self/exe");
+    daemon_gid = exe_stat.st_gid;
+
+    int listen_fd = socket(AF_LOCAL, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    unlink(path.c_str());
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof addr)
+            || chown(path.c_str(), 0, daemon_gid) || chmod(path.c_str(), 0660) || listen(listen_fd, 128)) {
+        FATAL("can not listen on %s", path.c_str());
+    }
+
+    int signal_fd = open_signalfd();
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (signal_fd < 0 || epfd < 0) FATAL("can not create epoll or signal fd");
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+    ev.data.fd = signal_fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, signal_fd, &ev);
+
+    INFO("daemon is listening on %s", path.c_str());
+
+    // connection fd -> job pid, 0 if the request is not received yet
+    std::map<int, pid_t> jobs;
+    static char request[DAEMON_MAX_REQUEST];
+
+    while (!signal_triggered) {
+        struct epoll_event events[64];
+        int n = epoll_wait(epfd, events, sizeof(events) / sizeof(events[0]), -1);
+        if (n < 0 && errno != EINTR) FATAL("epoll_wait failed");
+
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == listen_fd) {
+                int conn = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+                if (conn < 0) continue;
+                ev.events = EPOLLIN;
+                ev.data.fd = conn;
+                epoll_ctl(epfd, EPOLL_CTL_ADD, conn, &ev);
+                jobs[conn] = 0;
+            } else if (fd == signal_fd) {
+                read_signalfd(signal_fd);
+
+                // report exit codes of finished jobs and close connections
+                int status;
+                pid_t pid;
+                while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+                    FOR_EACH(p, jobs) {
+                        if (p.second != pid) continue;
+                        int code = WIFEXITED(status) ? WEXITSTATUS(status) : 4;
+                        string message = "EXIT " + strconv::from_long(code) + "\n";
+                        send(p.first, message.c_str(), message.length(), MSG_NOSIGNAL | MSG_DONTWAIT);
+                        // workers may share the connection, remove it from epoll explicitly
+                        epoll_ctl(epfd, EPOLL_CTL_DEL, p.first, NULL);
+                        close(p.first);
+                        jobs.erase(p.first);
+                        break;
+                    }
+                }
+            } else if (jobs.count(fd) && jobs[fd] > 0) {
+                // the client is gone, cancel the job
+                INFO("client of job %d is gone", (int)jobs[fd]);
+                kill(jobs[fd], SIGTERM);
+                epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+            } else if (jobs.count(fd)) {
+                int fds[fdpass::MAX_FDS];
+                int nfds = fdpass::MAX_FDS;
+                ssize_t len = fdpass::recv(fd, request, sizeof(request) - 1, fds, &nfds);
+                struct ucred peer;
+                socklen_t peer_len = sizeof peer;
+                bool valid = len > 0 && nfds == 4 && request[len - 1] == '\0'
+                    && getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &peer_len) == 0;
+
+                pid_t pid = valid ? fork() : -1;
+                if (pid == 0) {
+                    close(listen_fd);
+                    close(epfd);
+                    close_signalfd(signal_fd);
+                    FOR_EACH(p, jobs) if (p.first != fd) close(p.first);
+                    run_daemon_job(fd, peer, request, (size_t)len, fds);
+                }
+                for (int j = 0; j < nfds; ++j) close(fds[j]);
+
+                if (pid < 0) {
+                    if (len > 0) send(fd, "EXIT 255\n", 9, MSG_NOSIGNAL | MSG_DONTWAIT);
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+                    close(fd);
+                    jobs.erase(fd);
+                    continue;
+                }
+
+                // watch for the client going away
+                INFO("job %d started for uid %d", (int)pid, (int)peer.uid);
+                jobs[fd] = pid;
+                ev.events = EPOLLRDHUP;
+                ev.data.fd = fd;
+                epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+            }
+        }
+    }
+
+    INFO("daemon is stopping");
+    unlink(path.c_str());
+    FOR_EACH(p, jobs) if (p.second > 0) kill(p.second, SIGTERM);
+    while (wait(NULL) > 0 || errno == EINTR);
+    return EXIT_SUCCESS;
 }
 
 int main(int argc, char * argv[]) {
+    real_uid = getuid();
+    real_gid = getgid();
+    return run_lrun(argc, argv);
+}
+
+static int run_lrun(int argc, char * argv[]) {
+    setup_start_time = now();
     if (argc <= 1) lrun::options::help();
 
     options::parse(argc, argv, config);
     config.check();
+
+    if (!config.daemon_socket.empty()) return run_daemon();
+
+    open_testcases();
+    if (!config.batch_manifest.empty()) read_batch_manifest();
     become_root();
 
     INFO("lrun %s pid = %d", VERSION, (int)getpid());
 
+    if (!config.batch_manifest.empty()) return run_batch();
+
     create_cgroup();
 
     {
         Cgroup& cg = *config.active_cgroup;
-        // lock the cgroup so other lrun process with same cgname will wait
-        fs::ScopedFileLock cg_lock(cg.subsys_path().c_str());
         configure_cgroup();
-        int ret = run_command();
+        int ret = !config.testcases.empty() ? run_testcases()
+            : config.repeat > 1 ? run_repeats() : run_command();
         clean_cg_exit(cg, ret);
     }
 
@@ -218,6 +218,10 @@ bool lrun::options::fstracer::alive() {
     return tracer_pid != 0 && kill(tracer_pid, 0) == 0;
 }
 
+pid_t lrun::options::fstracer::pid() {
+    return tracer_pid;
+}
+
 static inline void do_create_tracer() {
     tracer = new fs::Tracer();
     if (tracer->init(
@@ -25,6 +25,7 @@
 #include <string>
 #include "options.h"
 #include "../seccomp.h"
+#include "../status_board.h"
 #include "../version.h"
 
 
@@ -85,11 +86,30 @@ static string help_content(int width) {
         "  --max-cpu-time    seconds     Limit cpu time. `seconds` can be a floating-point number\n"
         "  --max-real-time   seconds     Limit physical time\n"
         "  --max-memory      bytes       Limit memory (+swap) usage. `bytes` supports common suffix like `k`, `m`, `g`\n"
+        "  --memory-accounting mode      What memory usage counts: `total` (peak of everything charged to the cgroup, including page cache),"
+        " `rss` (anonymous memory) or `anon+swap`. rss and anon+swap are sampled every --interval. Page cache is reclaimed by the kernel"
+        " before it causes an oom\n"
+        "  --cpu-quota       cpus        Limit cpu bandwidth using the cpu cgroup. `cpus` is cpu time per real time, ex. 1.0 for one core's"
+        " worth. Unlike --max-cpu-time, the command is throttled, not killed\n"
+        "  --cpu-weight      weight      Share of cpu time when sandboxes compete for cpu, 1 to 10000 (default 100)\n"
+        "  --cpus            list        Run on these cpus, ex. `0-3,8`. Uses the cpuset cgroup, or cpu affinity without it\n"
+        "  --mems            list        Allocate memory on these NUMA nodes. `local`: nodes of --cpus\n"
+        "  --repeat          n           Run the command up to n times and write a summary after results of each run. Stops"
+        " early once the verdict is decided. Regular file stdin is rewound for each run\n"
+        "  --repeat-statistic stat       Statistic of runs used for the verdict: min, median, mean, p95 or max\n"
+        "  --quiet-machine   bool        Reduce timing variance: --exclusive-core and --idle-sibling, preferring isolated cpus,"
+        " disable ASLR and transparent huge pages, and drop page cache charged to the sandbox before each run\n"
+        "  --exclusive-core  bool        Run on a physical core not used by other lrun processes with this option. Cores are"
+        " taken from --cpus if it is set\n"
+        "  --idle-sibling    bool        With --exclusive-core, use one hardware thread and leave its SMT siblings idle\n"
+        "  --exclusive-core-wait seconds Wait for a free core, fail if none is free in time. Negative: wait forever\n"
         "  --max-output      bytes       Limit output. Note: lrun will make a \"best  effort\" to enforce the limit but it is NOT accurate\n"
         "  --max-rtprio      n           Set max realtime priority\n"
         "  --max-nfile       n           Set max number of file descriptors\n"
         "  --max-stack       bytes       Set max stack size per process\n"
         "  --max-nprocess    n           Set RLIMIT_NPROC. Note: user namespace is not separated, current processes are counted\n"
+        "  --max-processes   n           Limit processes and threads in the sandbox using the pids cgroup. Unlike --max-nprocess,"
+        " it is not shared by sandboxes running as the same user. Falls back to RLIMIT_NPROC if pids cgroup is not available\n"
         "  --isolate-process bool        Isolate PID, IPC namespace\n"
         "  --basic-devices   bool        Enable device whitelist: null, zero, full, random, urandom\n"
         "  --remount-dev     bool        Remount /dev and create only basic device files in it (see --basic-device)\n"
@@ -112,9 +132,32 @@ static string help_content(int width) {
         " For full syntax of `syscalls`, see `--help-syscalls`. Conflicts with `--no-new-privs false`\n";
     options +=
         "  --cgname          string      Specify cgroup name to use. The specified cgroup will be created on demand, and will not be deleted. If this option is not set, lrun will pick"
-        " an unique cgroup name and destroy it upon exit.\n"
+        " an unique cgroup name and destroy it upon exit. Names starting with `lrun-pool` are reserved\n"
+        "  --async-cleanup   bool        Write the result and exit without waiting for the cgroup to be cleaned. A detached process finishes the cleanup."
+        " The cgroup stays locked until then so it won't be reused early\n"
+        "  --cgroup-pool     int         Use one of `int` pre-configured cgroups instead of creating a new one, if --cgname is not set."
+        " A slot configured with the same --basic-devices and --cgroup-option settings is reused with only counters reset\n"
+        "  --report-format   format      Format of results written to fd 3: `text`, `json` (one object per line) or `binary` (struct lrun_report"
+        " in src/report.h). json and binary have extra statistics, see `Output format` in README\n"
+        "  --fork-server     path        With --testcase, start the command once with the `path` shim (utils/libforkserver) preloaded."
+        " It stops before main and forks a copy per testcase, skipping exec and dynamic linking. The path is inside the chroot."
+        " The command must be dynamically linked with glibc, and --syscalls must allow clone, pidfd_open, recvmsg and sendmsg."
+        " lrun checks both at start and exits if the server can not fork. Copies are children of lrun\n"
+        "  --daemon          path        Stay resident and run jobs sent to the unix socket `path` (see utils/lrunc). A job has lrun arguments, environment,"
+        " stdin, stdout, stderr and working directory of the client. Its results and then `EXIT code` are sent back on the socket."
+        " Only root can use this. Like the setuid lrun, only root and the group of the lrun executable can submit jobs."
+        " --cgroup-pool and --status-board given here are defaults for jobs\n"
+        "  --batch           path        Run items in the manifest `path` sequentially in one lrun process. See `Batch manifest` below."
+        " The command can be omitted if every item has one. fd 3 gets one result per item once it finishes\n"
+        "  --batch-workers   n           Run batch items on `n` workers, each with its own cgroup. Idle workers take the next pending item\n"
+        "  --batch-fail-fast bool        Do not start more batch items after one fails (non-zero exit code, signaled or exceeded a limit)\n"
         "  --hostname        string      Specify a new hostname\n"
-        "  --interval        seconds     Set interval status update interval\n"
+        "  --interval        seconds     Set status polling interval. It is only used when a limit has no event notification, or by --status\n"
+        "  --telemetry-fd    int         Write a line of resource usage samples to fd `int` every --telemetry-interval while the command runs."
+        " See `Telemetry` in README\n"
+        "  --telemetry-interval seconds  Set telemetry sampling interval\n"
+        "  --status-board    seconds     Publish state, limits and usage to the host-wide status board " LRUN_BOARD_PATH " every `seconds` while the command runs."
+        " Read it using utils/lrun-top. 0 disables it\n"
 #ifndef NDEBUG
         "  --debug                       Print debug messages\n"
         "  --status                      Show realtime resource usage status\n"
@@ -137,6 +180,11 @@ static string help_content(int width) {
         "  --fd              n           Do not close fd `n`\n"
         "  --cmd             cmd         Execute system command after tmpfs mounted. Only root can use this\n"
         "  --group           gid         Set additional groups. Applied to lrun itself. Only root can use this\n"
+        "  --testcase        in out      Run the command once per testcase, with stdin from `in` and stdout to `out`."
+        " The sandbox is set up once and a fresh child is forked from it for each testcase. fd 3 gets one result per testcase."
+        " Require Linux >= 5.3\n"
+        "  --testcase-limit  name value  Override a limit for the last --testcase. `name` is one of max-cpu-time, max-real-time,"
+        " max-memory and max-output\n"
         "\n";
     content += line_wrap(options, width, 32);
     content += line_wrap(
@@ -146,6 +194,14 @@ static string help_content(int width) {
         "  - If `--pass-exitcode` is set to true, lrun will just pass exit code of the child process\n"
         "\n"
         , width, 4);
+    content += line_wrap(
+        "Batch manifest:\n"
+        "  One item per line: [--stdin path] [--stdout path] [--max-cpu-time seconds] [--max-real-time seconds] [--max-memory bytes]"
+        " [--max-output bytes] [-- command-args]. Limits not given are taken from the command line."
+        " Words are separated by spaces, lines starting with '#' are ignored. Limits are checked like the command line"
+        " options and an invalid line is fatal\n"
+        "\n"
+        , width, 2);
     content += line_wrap(
         "Option processing order:\n"
         "  --hostname, --fd, --umount-outside, (mount /proc), --bindfs, --bindfs-ro, --chroot, --tmpfs,"
@@ -156,8 +212,8 @@ static string help_content(int width) {
     content += line_wrap(
         "Default options:\n"
         "  lrun --network true --basic-devices false --isolate-process true"
-        " --remount-dev false --reset-env false --interval 0.02"
-        " --pass-exitcode false --no-new-privs true --umount-outside false"
+        " --remount-dev false --reset-env false --interval 0.02 --telemetry-interval 0.1 --status-board 0"
+        " --pass-exitcode false --report-format text --memory-accounting total --repeat 1 --repeat-statistic median --quiet-machine false --exclusive-core false --idle-sibling false --exclusive-core-wait -1 --async-cleanup false --batch-workers 1 --batch-fail-fast false --no-new-privs true --umount-outside false"
         " --max-nprocess 2048 --max-nfile 256"
         " --max-rtprio 0 --nice 0\n"
         , width, 7, " \\");
@@ -0,0 +1,68 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2012-2015 Jun Wu <quark@zju.edu.cn>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <string>
+#include "../utils/log.h"
+#include "../utils/strconv.h"
+#include "options.h"
+
+using std::string;
+
+// smaller memory limits can not start most programs
+static const long long MIN_MEMORY_LIMIT = 500000LL;
+
+int lrun::options::parse_limit(const string& option, const string& value, limits& limits, string& error) {
+    bool is_time = (option == "max-cpu-time" || option == "max-real-time");
+    bool is_bytes = (option == "max-memory" || option == "max-output");
+    if (!is_time && !is_bytes) return 1;
+
+    if (is_time ? !strconv::is_double(value) : !strconv::is_bytes(value)) {
+        error = "invalid value '" + value + "' for --" + option;
+        return -1;
+    }
+
+    if (is_time) {
+        double seconds = strconv::to_double(value);
+        if (seconds < 0) {
+            error = "--" + option + " can not be negative";
+            return -1;
+        }
+        (option == "max-cpu-time" ? limits.cpu_time : limits.real_time) = seconds;
+    } else {
+        long long bytes = strconv::to_bytes(value);
+        if (bytes < 0) {
+            error = "--" + option + " can not be negative";
+            return -1;
+        }
+        if (option == "max-memory") {
+            if (bytes > 0 && bytes < MIN_MEMORY_LIMIT) {
+                WARNING("max-memory too small, changed to %lld.", MIN_MEMORY_LIMIT);
+                bytes = MIN_MEMORY_LIMIT;
+            }
+            limits.memory = bytes;
+        } else {
+            limits.output = bytes;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,91 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2012-2015 Jun Wu <quark@zju.edu.cn>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <string>
+#include <vector>
+#include "../utils/strconv.h"
+#include "options.h"
+
+using std::string;
+
+int lrun::options::parse_batch_manifest(const string& content, const limits& defaults, bool has_command, std::vector<batch_item>& items, string& error) {
+    size_t line_start = 0;
+    for (int line_no = 1; line_start < content.length(); ++line_no) {
+        size_t line_end = content.find('\n', line_start);
+        if (line_end == string::npos) line_end = content.length();
+        string line = content.substr(line_start, line_end - line_start);
+        line_start = line_end + 1;
+
+        string prefix = "line " + strconv::from_long(line_no) + ": ";
+
+        std::vector<string> words;
+        size_t pos = 0;
+        while ((pos = line.find_first_not_of(" \t\r", pos)) != string::npos) {
+            size_t end = line.find_first_of(" \t\r", pos);
+            if (end == string::npos) end = line.length();
+            words.push_back(line.substr(pos, end - pos));
+            pos = end;
+        }
+        if (words.empty() || words[0][0] == '#') continue;
+
+        batch_item item;
+        item.limits = defaults;
+
+        for (size_t i = 0; i < words.size(); ++i) {
+            const string& option = words[i];
+            if (option == "--") {
+                item.args.assign(words.begin() + i + 1, words.end());
+                break;
+            }
+            if (option.compare(0, 2, "--") != 0) {
+                error = prefix + "unexpected '" + option + "', use '--' before the command";
+                return -1;
+            }
+            if (i + 1 >= words.size()) {
+                error = prefix + option + " requires an argument";
+                return -1;
+            }
+            const string& value = words[++i];
+            if (option == "--stdin") {
+                item.stdin_path = value;
+            } else if (option == "--stdout") {
+                item.stdout_path = value;
+            } else {
+                string message;
+                int ret = parse_limit(option.substr(2), value, item.limits, message);
+                if (ret == 1) message = "unknown option " + option;
+                if (ret != 0) {
+                    error = prefix + message;
+                    return -1;
+                }
+            }
+        }
+
+        if (item.args.empty() && !has_command) {
+            error = prefix + "command is missing";
+            return -1;
+        }
+        items.push_back(item);
+    }
+
+    return 0;
+}
@@ -23,6 +23,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include "../config.h"
 #include "../cgroup.h"
 #include "../utils/fs_tracer.h"
@@ -37,6 +38,38 @@ namespace lrun {
 
         void parse(int argc, char * argv[], lrun::MainConfig& config);
 
+        // limits that can be set by both the command line and --batch items
+        typedef lrun::RunLimits limits;
+
+        /**
+         * parse a limit option, like "max-memory", shared by parse() and
+         * parse_batch_manifest() so both accept the same values
+         * @param   option      option name without leading "--"
+         * @param   error       set to a message if the value is invalid
+         * @return  0           limits is updated
+         *          1           option is not a limit
+         *         -1           value is invalid
+         */
+        int parse_limit(const std::string& option, const std::string& value, limits& limits, std::string& error);
+
+        // a line of a --batch manifest
+        struct batch_item {
+            std::vector<std::string> args;  // empty: use the command line
+            std::string stdin_path;
+            std::string stdout_path;
+            lrun::options::limits limits;
+        };
+
+        /**
+         * parse a --batch manifest
+         * @param   defaults    limits from the command line
+         * @param   has_command whether the command line has a command
+         * @param   error       set to "line N: message" on failure
+         * @return  0           success, items are appended
+         *         -1           the manifest is invalid
+         */
+        int parse_batch_manifest(const std::string& content, const limits& defaults, bool has_command, std::vector<batch_item>& items, std::string& error);
+
         namespace fstracer {
             // fstracer need cgroup information to:
             // - check if a process belongs to this cgroup
@@ -54,6 +87,9 @@ namespace lrun {
 
             bool alive();
             bool started();
+
+            // tracer process pid, 0 if not started
+            pid_t pid();
         }
     }
 }
@@ -21,6 +21,7 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 #include <string>
+#include "../utils/for_each.h"
 #include "../utils/strconv.h"
 #include "../utils/fs.h"
 #include "options.h"
@@ -40,6 +41,13 @@ void lrun::options::parse(int argc, char * argv[], lrun::MainConfig& config) {
     config.arg.args = argv + 1;
     config.arg.argc = argc - 1;
 
+    // set by --max-nprocess, kept by --max-processes
+    bool nproc_set = false;
+
+    // --testcase-limit options of each testcase, applied on top of the
+    // command line limits once all options are read
+    std::vector<std::vector<std::pair<string, string> > > testcase_limit_options;
+
 #define REQUIRE_NARGV(n) \
     if (i + n >= argc) { \
         fprintf(stderr, "Option '%s' requires %d argument%s.\n", option.c_str(), n, n > 1 ? "s" : ""); \
@@ -65,28 +73,65 @@ void lrun::options::parse(int argc, char * argv[], lrun::MainConfig& config) {
 
         string option = argv[i] + 2;
 
-        if (option == "max-cpu-time") {
+        if (option == "max-cpu-time" || option == "max-real-time" || option == "max-memory" || option == "max-output") {
+            REQUIRE_NARGV(1);
+            // same rules as --batch items
+            limits limits = { config.cpu_time_limit, config.real_time_limit, config.memory_limit, config.output_limit };
+            string error;
+            if (parse_limit(option, NEXT_STRING_ARG, limits, error)) {
+                fprintf(stderr, "%s.\n", error.c_str());
+                exit(1);
+            }
+            config.cpu_time_limit = limits.cpu_time;
+            config.real_time_limit = limits.real_time;
+            config.memory_limit = limits.memory;
+            config.output_limit = limits.output;
+            if (option == "max-output") config.arg.rlimits[RLIMIT_FSIZE] = config.output_limit;
+        } else if (option == "max-nprocess") {
             REQUIRE_NARGV(1);
-            config.cpu_time_limit = NEXT_DOUBLE_ARG;
-        } else if (option == "max-real-time") {
+            config.arg.rlimits[RLIMIT_NPROC] = NEXT_LONG_LONG_ARG;
+            nproc_set = true;
+        } else if (option == "max-processes") {
             REQUIRE_NARGV(1);
-            config.real_time_limit = NEXT_DOUBLE_ARG;
-        } else if (option == "max-memory") {
+            config.process_limit = NEXT_LONG_LONG_ARG;
+            // pids.max is per sandbox, the default per-user RLIMIT_NPROC is
+            // not needed. it is restored if the pids controller is not available.
+            // invalid values are rejected by MainConfig::check
+            if (!nproc_set && config.process_limit > 0) config.arg.rlimits.erase(RLIMIT_NPROC);
+        } else if (option == "cpu-quota") {
             REQUIRE_NARGV(1);
-            long long max_memory = strconv::to_bytes(NEXT_STRING_ARG);
-            static const long long MIN_MEMORY_LIMIT = 500000LL;
-            if (max_memory > 0 && max_memory < MIN_MEMORY_LIMIT) {
-                WARNING("max-memory too small, changed to %lld.", MIN_MEMORY_LIMIT);
-                max_memory = MIN_MEMORY_LIMIT;
-            }
-            config.memory_limit = max_memory;
-        } else if (option == "max-output") {
+            config.cpu_quota = NEXT_DOUBLE_ARG;
+        } else if (option == "cpu-weight") {
             REQUIRE_NARGV(1);
-            config.output_limit = strconv::to_bytes(NEXT_STRING_ARG);
-            config.arg.rlimits[RLIMIT_FSIZE] = config.output_limit;
-        } else if (option == "max-nprocess") {
+            config.cpu_weight = (int)NEXT_LONG_LONG_ARG;
+        } else if (option == "cpus") {
             REQUIRE_NARGV(1);
-            config.arg.rlimits[RLIMIT_NPROC] = NEXT_LONG_LONG_ARG;
+            config.cpus = NEXT_STRING_ARG;
+            config.arg.cpu_affinity = strconv::to_int_list(config.cpus);
+        } else if (option == "mems") {
+            REQUIRE_NARGV(1);
+            config.mems = NEXT_STRING_ARG;
+        } else if (option == "repeat") {
+            REQUIRE_NARGV(1);
+            config.repeat = (int)NEXT_LONG_LONG_ARG;
+        } else if (option == "repeat-statistic") {
+            REQUIRE_NARGV(1);
+            config.repeat_statistic = NEXT_STRING_ARG;
+        } else if (option == "quiet-machine") {
+            REQUIRE_NARGV(1);
+            // later options can turn off each part
+            config.quiet_machine = NEXT_BOOL_ARG;
+            config.exclusive_core = config.idle_sibling = config.quiet_machine;
+            config.arg.disable_aslr = config.arg.disable_thp = config.quiet_machine;
+        } else if (option == "exclusive-core") {
+            REQUIRE_NARGV(1);
+            config.exclusive_core = NEXT_BOOL_ARG;
+        } else if (option == "idle-sibling") {
+            REQUIRE_NARGV(1);
+            config.idle_sibling = NEXT_BOOL_ARG;
+        } else if (option == "exclusive-core-wait") {
+            REQUIRE_NARGV(1);
+            config.exclusive_core_wait = NEXT_DOUBLE_ARG;
         } else if (option == "min-nice") {
             // deprecated
             REQUIRE_NARGV(1);
@@ -118,6 +163,33 @@ void lrun::options::parse(int argc, char * argv[], lrun::MainConfig& config) {
         } else if (option == "pass-exitcode") {
             REQUIRE_NARGV(1);
             config.pass_exitcode = NEXT_BOOL_ARG;
+        } else if (option == "async-cleanup") {
+            REQUIRE_NARGV(1);
+            config.async_cleanup = NEXT_BOOL_ARG;
+        } else if (option == "cgroup-pool") {
+            REQUIRE_NARGV(1);
+            config.cgroup_pool_size = (int)NEXT_LONG_LONG_ARG;
+        } else if (option == "memory-accounting") {
+            REQUIRE_NARGV(1);
+            config.memory_accounting = NEXT_STRING_ARG;
+        } else if (option == "report-format") {
+            REQUIRE_NARGV(1);
+            config.report_format = NEXT_STRING_ARG;
+        } else if (option == "fork-server") {
+            REQUIRE_NARGV(1);
+            config.fork_server = NEXT_STRING_ARG;
+        } else if (option == "daemon") {
+            REQUIRE_NARGV(1);
+            config.daemon_socket = NEXT_STRING_ARG;
+        } else if (option == "batch") {
+            REQUIRE_NARGV(1);
+            config.batch_manifest = NEXT_STRING_ARG;
+        } else if (option == "batch-workers") {
+            REQUIRE_NARGV(1);
+            config.batch_workers = (int)NEXT_LONG_LONG_ARG;
+        } else if (option == "batch-fail-fast") {
+            REQUIRE_NARGV(1);
+            config.batch_fail_fast = NEXT_BOOL_ARG;
         } else if (option == "chroot") {
             REQUIRE_NARGV(1);
             config.arg.chroot_path = NEXT_STRING_ARG;
@@ -176,6 +248,16 @@ void lrun::options::parse(int argc, char * argv[], lrun::MainConfig& config) {
             REQUIRE_NARGV(1);
             useconds_t interval = (useconds_t)(NEXT_DOUBLE_ARG * 1000000);
             if (interval > 0) config.interval = interval;
+        } else if (option == "telemetry-fd") {
+            REQUIRE_NARGV(1);
+            config.telemetry_fd = check_fd(NEXT_LONG_LONG_ARG);
+        } else if (option == "telemetry-interval") {
+            REQUIRE_NARGV(1);
+            double interval = NEXT_DOUBLE_ARG;
+            if (interval > 0) config.telemetry_interval = interval;
+        } else if (option == "status-board") {
+            REQUIRE_NARGV(1);
+            config.status_board_interval = NEXT_DOUBLE_ARG;
         } else if (option == "cgname") {
             REQUIRE_NARGV(1);
             config.cgname = NEXT_STRING_ARG;
@@ -219,6 +301,21 @@ void lrun::options::parse(int argc, char * argv[], lrun::MainConfig& config) {
             config.arg.bindfs_list.push_back(make_pair(dest, src));
             config.arg.bindfs_dest_set.insert(dest);
             config.arg.remount_list[dest] |= MS_RDONLY;
+        } else if (option == "testcase") {
+            REQUIRE_NARGV(2);
+            string input = NEXT_STRING_ARG;
+            string output = NEXT_STRING_ARG;
+            config.testcases.push_back(make_pair(input, output));
+            testcase_limit_options.resize(config.testcases.size());
+        } else if (option == "testcase-limit") {
+            REQUIRE_NARGV(2);
+            string name = NEXT_STRING_ARG;
+            string value = NEXT_STRING_ARG;
+            if (config.testcases.empty()) {
+                fprintf(stderr, "`--testcase-limit` must follow a `--testcase`.\n");
+                exit(1);
+            }
+            testcase_limit_options.back().push_back(make_pair(name, value));
         } else if (option == "tmpfs") {
             REQUIRE_NARGV(2);
             string path = NEXT_STRING_ARG;
@@ -280,6 +377,20 @@ void lrun::options::parse(int argc, char * argv[], lrun::MainConfig& config) {
             exit(1);
         }
     }
+
+    FOR_EACH(limit_options, testcase_limit_options) {
+        limits limits = { config.cpu_time_limit, config.real_time_limit, config.memory_limit, config.output_limit };
+        FOR_EACH(p, limit_options) {
+            string error;
+            int ret = parse_limit(p.first, p.second, limits, error);
+            if (ret == 1) error = "`--testcase-limit` does not support `" + p.first + "`";
+            if (ret) {
+                fprintf(stderr, "%s.\n", error.c_str());
+                exit(1);
+            }
+        }
+        config.testcase_limits.push_back(limits);
+    }
 #undef REQUIRE_NARGV
 #undef REQUIRE_ROOT
 #undef NEXT_STRING_ARG
@@ -0,0 +1,142 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2012-2015 Jun Wu <quark@zju.edu.cn>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+// Layout of results written to fd 3 with `--report-format binary`.
+//
+// Each result is one struct lrun_report written in one write(2). Fields are
+// in host byte order. A reader should check magic and version, and use size
+// to skip to the next record: new fields are only appended to the end.
+// This header is plain C so report readers do not need lrun sources.
+
+#pragma once
+
+#include <stdint.h>
+
+#define LRUN_REPORT_MAGIC "LRUN"
+#define LRUN_REPORT_VERSION 1
+#define LRUN_REPORT_MAX_CPUS 256
+
+/**
+ * lrun_report.flags
+ */
+enum lrun_report_flags {
+    LRUN_REPORT_SIGNALED = 1,   // the command was killed by term_sig
+    LRUN_REPORT_ERROR    = 2,   // the command did not run, see error
+    LRUN_REPORT_SUMMARY  = 4,   // --repeat summary, see repeats
+};
+
+/**
+ * lrun_report.exceed
+ */
+enum lrun_report_exceed {
+    LRUN_REPORT_EXCEED_NONE = 0,
+    LRUN_REPORT_EXCEED_CPU_TIME,
+    LRUN_REPORT_EXCEED_REAL_TIME,
+    LRUN_REPORT_EXCEED_MEMORY,
+    LRUN_REPORT_EXCEED_OUTPUT,
+};
+
+/**
+ * statistics of --repeat runs
+ */
+struct lrun_report_stats {
+    double min;
+    double median;
+    double mean;
+    double stddev;
+    double p95;
+    double max;
+};
+
+/**
+ * a value is -1 if it is not available on this system
+ */
+struct lrun_report {
+    char magic[4];                  // LRUN_REPORT_MAGIC, not NUL terminated
+    uint32_t version;               // LRUN_REPORT_VERSION
+    uint32_t size;                  // sizeof(struct lrun_report)
+    uint32_t flags;                 // enum lrun_report_flags
+    int32_t index;                  // --testcase or --batch index, -1 otherwise
+    int32_t exit_code;
+    int32_t term_sig;
+    int32_t exceed;                 // enum lrun_report_exceed
+
+    int64_t memory;                 // peak memory, bytes
+    double cpu_time;                // seconds, same as text CPUTIME
+    double real_time;               // seconds, same as text REALTIME
+    double cpu_overshoot;           // seconds
+
+    double user_time;               // seconds
+    double system_time;             // seconds
+    int64_t minor_faults;
+    int64_t major_faults;
+    int64_t voluntary_switches;
+    int64_t involuntary_switches;
+    int64_t max_rss;                // bytes, largest single process
+    int64_t page_cache;             // bytes, at exit
+    int64_t read_bytes;             // block device io
+    int64_t write_bytes;            // block device io
+    int64_t processes;              // peak processes and threads, sampled
+    int64_t throttled_periods;
+    double throttled_time;          // seconds
+
+    double setup_time;              // seconds, until the command started
+    double run_time;                // seconds, the command started to exited
+    double teardown_time;           // seconds, killing remaining processes
+
+    uint32_t cpu_count;             // used entries of cpu_usage
+    uint32_t reserved;
+    double cpu_usage[LRUN_REPORT_MAX_CPUS];  // seconds per cpu
+
+    char error[128];                // NUL terminated, with LRUN_REPORT_ERROR
+
+    double memory_limit_time;       // seconds since the command started, -1 if not observed
+
+    // peak memory in each --memory-accounting mode, bytes. memory is the
+    // one selected. rss and anon_swap are sampled
+    int64_t memory_total;
+    int64_t memory_rss;
+    int64_t memory_anon_swap;
+
+    // with --max-processes, -1 if not available. processes_peak counts
+    // tasks in the sandbox, sampled
+    int64_t processes_peak;
+    int64_t process_limit_hits;     // forks failed because of pids.max
+
+    char cpus[128];                 // cpus the command could use, like "0-3,8".
+                                    // NUL terminated, empty if unknown
+
+    // outside the sandbox, sampled when the command started and exited.
+    // -1 if not available
+    double cpu_mhz;                 // average frequency of cpus
+    int64_t runnable_tasks;         // max host-wide runnable tasks
+    double host_cpu_pressure;       // "some" avg10 of /proc/pressure/cpu, at exit
+
+    // with LRUN_REPORT_SUMMARY, written after all --repeat runs. memory,
+    // cpu_time and real_time are the --repeat-statistic ones and exceed is
+    // the verdict from them. other fields above are not set
+    uint32_t repeats;               // --repeat
+    uint32_t runs;                  // fewer than repeats if stopped early
+    struct lrun_report_stats cpu_time_stats;
+    struct lrun_report_stats real_time_stats;
+    struct lrun_report_stats memory_stats;
+};
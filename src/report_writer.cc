@@ -0,0 +1,318 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2012-2015 Jun Wu <quark@zju.edu.cn>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "report_writer.h"
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "report.h"
+#include "utils/stats.h"
+#include "utils/strconv.h"
+
+using namespace lrun;
+using std::string;
+
+static int exceed_code(const string& exceeded_limit) {
+    if (exceeded_limit == "CPU_TIME") return LRUN_REPORT_EXCEED_CPU_TIME;
+    if (exceeded_limit == "REAL_TIME") return LRUN_REPORT_EXCEED_REAL_TIME;
+    if (exceeded_limit == "MEMORY") return LRUN_REPORT_EXCEED_MEMORY;
+    if (exceeded_limit == "OUTPUT") return LRUN_REPORT_EXCEED_OUTPUT;
+    return LRUN_REPORT_EXCEED_NONE;
+}
+
+// json values, negative numbers are unavailable and written as null
+static void json_field(string& json, const char *key, long long value) {
+    char buf[64];
+    snprintf(buf, sizeof buf, value < 0 ? ", \"%s\": null" : ", \"%s\": %lld", key, value);
+    json += buf;
+}
+
+static void json_field(string& json, const char *key, double value) {
+    char buf[64];
+    snprintf(buf, sizeof buf, value < 0 ? ", \"%s\": null" : ", \"%s\": %.6f", key, value);
+    json += buf;
+}
+
+static void json_field(string& json, const char *key, const char *value) {
+    json += string(", \"") + key + "\": ";
+    if (!value) {
+        json += "null";
+        return;
+    }
+    json += '"';
+    for (const char *p = value; *p; ++p) {
+        if (*p == '"' || *p == '\\') json += '\\';
+        if ((unsigned char)*p >= 0x20) json += *p;
+    }
+    json += '"';
+}
+
+// json_field adds ", " before each field, drop the first one
+static string json_object(const string& fields) {
+    return "{" + fields.substr(2) + "}\n";
+}
+
+static void write_report(const string& content) {
+    int ret = write(3, content.data(), content.length());
+    (void)ret;
+}
+
+static void write_report(const struct lrun_report& report) {
+    int ret = write(3, &report, sizeof report);
+    (void)ret;
+}
+
+static void init_report(struct lrun_report& report, const char *label, size_t index) {
+    memset(&report, 0, sizeof report);
+    memcpy(report.magic, LRUN_REPORT_MAGIC, sizeof report.magic);
+    report.version = LRUN_REPORT_VERSION;
+    report.size = sizeof report;
+    report.index = label ? (int32_t)index : -1;
+}
+
+static long long rusage_value(const struct rusage& usage, long value, long scale = 1) {
+    return usage.ru_maxrss < 0 ? -1 : (long long)value * scale;
+}
+
+static void write_result_json(const run_result& result, const char *label, size_t index) {
+    const int& stat = result.stat;
+    const struct rusage& usage = result.usage;
+
+    string json;
+    if (label) json_field(json, label, (long long)index);
+    json_field(json, "memory", result.memory_usage);
+    json_field(json, "memory_total", result.memory_total);
+    json_field(json, "memory_rss", result.memory_rss);
+    json_field(json, "memory_anon_swap", result.memory_anon_swap);
+    json_field(json, "cpu_time", result.cpu_time_usage);
+    json_field(json, "real_time", result.real_time_usage);
+    json += WIFSIGNALED(stat) ? ", \"signaled\": true" : ", \"signaled\": false";
+    json_field(json, "exit_code", (long long)WEXITSTATUS(stat));
+    json_field(json, "term_sig", (long long)WTERMSIG(stat));
+    json_field(json, "exceed", result.exceeded_limit.empty() ? NULL : result.exceeded_limit.c_str());
+    json_field(json, "cpu_overshoot", result.cpu_time_overshoot);
+    json_field(json, "memory_limit_time", result.memory_limit_time);
+    json_field(json, "user_time", result.counters.user_time);
+    json_field(json, "system_time", result.counters.system_time);
+    json_field(json, "minor_faults", result.counters.minor_faults);
+    json_field(json, "major_faults", result.counters.major_faults);
+    json_field(json, "voluntary_switches", rusage_value(usage, usage.ru_nvcsw));
+    json_field(json, "involuntary_switches", rusage_value(usage, usage.ru_nivcsw));
+    json_field(json, "max_rss", rusage_value(usage, usage.ru_maxrss, 1024));
+    json_field(json, "page_cache", result.page_cache);
+    json_field(json, "read_bytes", rusage_value(usage, usage.ru_inblock, 512));
+    json_field(json, "write_bytes", rusage_value(usage, usage.ru_oublock, 512));
+    json_field(json, "processes", result.processes);
+    json_field(json, "processes_peak", result.processes_peak);
+    json_field(json, "process_limit_hits", result.process_limit_hits);
+    json_field(json, "throttled_periods", result.counters.throttled_periods);
+    json_field(json, "throttled_time", result.counters.throttled_time);
+    json_field(json, "setup_time", result.setup_time);
+    json_field(json, "run_time", result.run_time);
+    json_field(json, "teardown_time", result.teardown_time);
+    json_field(json, "cpus", result.cpus.empty() ? NULL : result.cpus.c_str());
+    json_field(json, "cpu_mhz", result.environment.cpu_mhz);
+    json_field(json, "runnable_tasks", result.environment.runnable_tasks);
+    json_field(json, "host_cpu_pressure", result.environment.cpu_pressure);
+
+    json += ", \"cpu_usage\": [";
+    for (size_t i = 0; i < result.cpu_usage_percpu.size(); ++i) {
+        char buf[32];
+        snprintf(buf, sizeof buf, i ? ", %.6f" : "%.6f", result.cpu_usage_percpu[i]);
+        json += buf;
+    }
+    json += "]";
+    write_report(json_object(json));
+}
+
+static void write_result_binary(const run_result& result, const char *label, size_t index) {
+    const int& stat = result.stat;
+    const struct rusage& usage = result.usage;
+
+    struct lrun_report report;
+    init_report(report, label, index);
+    if (WIFSIGNALED(stat)) report.flags |= LRUN_REPORT_SIGNALED;
+    report.exit_code = WEXITSTATUS(stat);
+    report.term_sig = WTERMSIG(stat);
+    report.exceed = exceed_code(result.exceeded_limit);
+    report.memory = result.memory_usage;
+    report.cpu_time = result.cpu_time_usage;
+    report.real_time = result.real_time_usage;
+    report.cpu_overshoot = result.cpu_time_overshoot;
+    report.user_time = result.counters.user_time;
+    report.system_time = result.counters.system_time;
+    report.minor_faults = result.counters.minor_faults;
+    report.major_faults = result.counters.major_faults;
+    report.voluntary_switches = rusage_value(usage, usage.ru_nvcsw);
+    report.involuntary_switches = rusage_value(usage, usage.ru_nivcsw);
+    report.max_rss = rusage_value(usage, usage.ru_maxrss, 1024);
+    report.page_cache = result.page_cache;
+    report.read_bytes = rusage_value(usage, usage.ru_inblock, 512);
+    report.write_bytes = rusage_value(usage, usage.ru_oublock, 512);
+    report.processes = result.processes;
+    report.throttled_periods = result.counters.throttled_periods;
+    report.throttled_time = result.counters.throttled_time;
+    report.setup_time = result.setup_time;
+    report.run_time = result.run_time;
+    report.teardown_time = result.teardown_time;
+    report.memory_limit_time = result.memory_limit_time;
+    report.memory_total = result.memory_total;
+    report.memory_rss = result.memory_rss;
+    report.memory_anon_swap = result.memory_anon_swap;
+    report.processes_peak = result.processes_peak;
+    report.process_limit_hits = result.process_limit_hits;
+    snprintf(report.cpus, sizeof report.cpus, "%s", result.cpus.c_str());
+    report.cpu_mhz = result.environment.cpu_mhz;
+    report.runnable_tasks = result.environment.runnable_tasks;
+    report.host_cpu_pressure = result.environment.cpu_pressure;
+
+    for (size_t i = 0; i < result.cpu_usage_percpu.size() && i < LRUN_REPORT_MAX_CPUS; ++i) {
+        report.cpu_usage[i] = result.cpu_usage_percpu[i];
+        report.cpu_count = i + 1;
+    }
+
+    write_report(report);
+}
+
+void lrun::report::write_result(const string& format, const run_result& result, const char *label, size_t index) {
+    if (format == "json") return write_result_json(result, label, index);
+    if (format == "binary") return write_result_binary(result, label, index);
+
+    string header;
+    if (label) {
+        for (const char *p = label; *p; ++p) header += (char)toupper(*p);
+        header += " " + strconv::from_ulong((unsigned long)index) + "\n";
+    }
+
+    char status_report[4096];
+    const int& stat = result.stat;
+
+    snprintf(status_report, sizeof status_report,
+            "%s"
+            "MEMORY   %lld\n"
+            "CPUTIME  %.3f\n"
+            "REALTIME %.3f\n"
+            "SIGNALED %d\n"
+            "EXITCODE %d\n"
+            "TERMSIG  %d\n"
+            "EXCEED   %s\n",
+            header.c_str(),
+            result.memory_usage, result.cpu_time_usage, result.real_time_usage,
+            WIFSIGNALED(stat) ? 1 : 0,
+            WEXITSTATUS(stat),
+            WTERMSIG(stat),
+            result.exceeded_limit.empty() ? "none" : result.exceeded_limit.c_str());
+
+    int ret = write(3, status_report, strlen(status_report));
+    (void)ret;
+}
+
+void lrun::report::write_error(const string& format, const char *label, size_t index, const string& message) {
+    if (format == "json") {
+        string json;
+        json_field(json, label, (long long)index);
+        json_field(json, "error", message.c_str());
+        write_report(json_object(json));
+    } else if (format == "binary") {
+        struct lrun_report report;
+        init_report(report, label, index);
+        report.flags = LRUN_REPORT_ERROR;
+        strncpy(report.error, message.c_str(), sizeof(report.error) - 1);
+        write_report(report);
+    } else {
+        string header;
+        for (const char *p = label; *p; ++p) header += (char)toupper(*p);
+        write_report(header + " " + strconv::from_ulong((unsigned long)index) + "\nERROR    " + message + "\n");
+    }
+}
+
+static void json_stats(string& json, const char *key, const stats::summary& s) {
+    string fields;
+    json_field(fields, "min", s.min);
+    json_field(fields, "median", s.median);
+    json_field(fields, "mean", s.mean);
+    json_field(fields, "stddev", s.stddev);
+    json_field(fields, "p95", s.p95);
+    json_field(fields, "max", s.max);
+    json += string(", \"") + key + "\": {" + fields.substr(2) + "}";
+}
+
+static void report_stats(struct lrun_report_stats& report, const stats::summary& s) {
+    report.min = s.min;
+    report.median = s.median;
+    report.mean = s.mean;
+    report.stddev = s.stddev;
+    report.p95 = s.p95;
+    report.max = s.max;
+}
+
+void lrun::report::write_repeat_summary(const string& format, const repeat_samples& samples, int repeats, const string& statistic, const string& verdict) {
+    size_t runs = samples.cpu_time.size();
+    stats::summary cpu_time = stats::summarize(samples.cpu_time);
+    stats::summary real_time = stats::summarize(samples.real_time);
+    stats::summary memory = stats::summarize(samples.memory);
+
+    if (format == "json") {
+        string json;
+        json += ", \"summary\": true";
+        json_field(json, "repeats", (long long)repeats);
+        json_field(json, "runs", (long long)runs);
+        json_field(json, "statistic", statistic.c_str());
+        json_stats(json, "memory", memory);
+        json_stats(json, "cpu_time", cpu_time);
+        json_stats(json, "real_time", real_time);
+        json_field(json, "exceed", verdict.empty() ? NULL : verdict.c_str());
+        return write_report(json_object(json));
+    }
+
+    if (format == "binary") {
+        struct lrun_report report;
+        init_report(report, NULL, 0);
+        report.flags |= LRUN_REPORT_SUMMARY;
+        report.exceed = exceed_code(verdict);
+        report.memory = (int64_t)stats::get(memory, statistic);
+        report.cpu_time = stats::get(cpu_time, statistic);
+        report.real_time = stats::get(real_time, statistic);
+        report.repeats = repeats;
+        report.runs = runs;
+        report_stats(report.memory_stats, memory);
+        report_stats(report.cpu_time_stats, cpu_time);
+        report_stats(report.real_time_stats, real_time);
+        return write_report(report);
+    }
+
+    char summary[1024];
+    snprintf(summary, sizeof summary,
+            "SUMMARY  %lu/%d %s\n"
+            "MEMORY   min %.0f median %.0f mean %.0f stddev %.0f p95 %.0f max %.0f\n"
+            "CPUTIME  min %.3f median %.3f mean %.3f stddev %.3f p95 %.3f max %.3f\n"
+            "REALTIME min %.3f median %.3f mean %.3f stddev %.3f p95 %.3f max %.3f\n"
+            "EXCEED   %s\n",
+            (unsigned long)runs, repeats, statistic.c_str(),
+            memory.min, memory.median, memory.mean, memory.stddev, memory.p95, memory.max,
+            cpu_time.min, cpu_time.median, cpu_time.mean, cpu_time.stddev, cpu_time.p95, cpu_time.max,
+            real_time.min, real_time.median, real_time.mean, real_time.stddev, real_time.p95, real_time.max,
+            verdict.empty() ? "none" : verdict.c_str());
+    write_report(string(summary));
+}
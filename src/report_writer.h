@@ -0,0 +1,121 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2012-2015 Jun Wu <quark@zju.edu.cn>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+// Writers of results to fd 3 in each --report-format. The layout of binary
+// results is in report.h.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+namespace lrun {
+
+    // cumulative cgroup counters. they can not be reset, a run uses the
+    // difference of snapshots. -1: not available
+    struct cgroup_counters {
+        double user_time;
+        double system_time;
+        long long minor_faults;
+        long long major_faults;
+        long long throttled_periods;
+        double throttled_time;
+    };
+
+    // things outside the sandbox which affect timing, -1 if not available
+    struct environment_sample {
+        double cpu_mhz;             // average of cpus the command can use
+        long long runnable_tasks;   // host-wide, except lrun itself
+        double cpu_pressure;        // host-wide "some" avg10 in /proc/pressure/cpu
+    };
+
+    // resource usages and exit status of a finished run
+    struct run_result {
+        int stat;
+        long long memory_usage;
+        double cpu_time_usage;
+        double cpu_time_overshoot;
+        double real_time_usage;
+        double teardown_time;
+        std::string exceeded_limit;
+        double memory_limit_time;   // -1 if the memory limit was not hit, or
+                                    // only noticed when the command exited
+
+        // peaks in all --memory-accounting modes, -1 if not sampled
+        long long memory_total;
+        long long memory_rss;
+        long long memory_anon_swap;
+
+        // only collected for json and binary reports, see collect_details
+        bool detailed;
+        double setup_time;
+        double run_time;
+        cgroup_counters counters;
+        struct rusage usage;
+        long long page_cache;
+        long long processes;            // sampled peak of tasks in the sandbox
+        // with --max-processes, -1 if not available
+        long long processes_peak;       // sampled pids.current
+        long long process_limit_hits;   // forks failed because of pids.max
+        std::string cpus;               // cpus the command could use, empty if unknown
+        environment_sample environment; // mhz averaged, runnable tasks is the max
+        std::vector<double> cpu_usage_percpu;
+    };
+
+    // --repeat: samples of runs, usages are capped at limits
+    struct repeat_samples {
+        std::vector<double> cpu_time;
+        std::vector<double> real_time;
+        std::vector<double> memory;
+        bool output_exceeded;
+    };
+
+    namespace report {
+        /**
+         * write a result to fd 3 in one write, so results written by
+         * several processes do not interleave
+         * @param   format      "text", "json" or "binary"
+         * @param   label       "testcase" or "item" for a run with index,
+         *                      NULL for a single run. text reports write it
+         *                      in upper case before the result, ex.
+         *                      "TESTCASE 1\n"
+         */
+        void write_result(const std::string& format, const run_result& result, const char *label = NULL, size_t index = 0);
+
+        /**
+         * write an error instead of a result, for a testcase or batch item
+         * which can not be started
+         * @param   format      see write_result
+         */
+        void write_error(const std::string& format, const char *label, size_t index, const std::string& message);
+
+        /**
+         * write the summary of --repeat runs, after results of each run
+         * @param   format      see write_result
+         * @param   repeats     --repeat
+         * @param   statistic   --repeat-statistic
+         * @param   verdict     exceeded limit, empty if none
+         */
+        void write_repeat_summary(const std::string& format, const repeat_samples& samples, int repeats, const std::string& statistic, const std::string& verdict);
+    }
+}
@@ -0,0 +1,88 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2012-2015 Jun Wu <quark@zju.edu.cn>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+// Layout of the host-wide status board, see --status-board.
+//
+// lrun processes publish live counters of their runs into slots of a
+// shared file mapped by every reader, so monitors like utils/lrun-top read
+// them without syscalls. A slot is claimed with a compare-and-swap on pid
+// and updated with a sequence lock: seq is odd while the slot is being
+// written, readers retry if seq is odd or changed while reading.
+// The owner's start time tells a live owner from a process that reused
+// the pid of a killed one.
+// This header is plain C so monitors do not need lrun sources.
+
+#pragma once
+
+#include <stdint.h>
+
+#define LRUN_BOARD_PATH "/run/lrun-board"
+#define LRUN_BOARD_MAGIC 0x4452424cu    // "LBRD"
+#define LRUN_BOARD_VERSION 2
+#define LRUN_BOARD_SLOTS 256
+
+/**
+ * lrun_board_slot.state
+ */
+enum lrun_board_state {
+    LRUN_BOARD_IDLE     = 0,    // claimed, no run yet
+    LRUN_BOARD_SETUP    = 1,    // setting up the sandbox and spawning
+    LRUN_BOARD_RUNNING  = 2,
+    LRUN_BOARD_TEARDOWN = 3,    // killing remaining processes
+};
+
+/**
+ * limits are <= 0 if not set. times are seconds since the epoch
+ */
+struct lrun_board_slot {
+    volatile uint32_t seq;          // odd while being written
+    volatile int32_t pid;           // owner lrun process, 0 if free
+    uint32_t state;                 // enum lrun_board_state
+    int32_t child_pid;              // the running command, 0 if none
+
+    // set after pid is claimed. owner_start_time is only valid if
+    // owner_start_pid is pid
+    volatile int32_t owner_start_pid;
+    volatile uint64_t owner_start_time; // clock ticks since boot, field 22 of /proc/<pid>/stat
+
+    char cgname[64];                // NUL terminated
+
+    double cpu_time_limit;          // seconds
+    double real_time_limit;         // seconds
+    int64_t memory_limit;           // bytes
+    int64_t output_limit;           // bytes
+
+    double start_time;              // when the state was entered
+    double update_time;             // when the counters were updated
+    double cpu_time;                // seconds
+    int64_t memory;                 // bytes, current usage
+    int64_t output;                 // bytes, -1 if not counted
+    uint64_t runs;                  // finished runs, ex. testcases
+};
+
+struct lrun_board {
+    uint32_t magic;                 // LRUN_BOARD_MAGIC, set last
+    uint32_t version;               // LRUN_BOARD_VERSION
+    uint32_t slot_size;             // sizeof(struct lrun_board_slot)
+    uint32_t slot_count;            // LRUN_BOARD_SLOTS
+    struct lrun_board_slot slots[LRUN_BOARD_SLOTS];
+};
@@ -0,0 +1,38 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2012-2015 Jun Wu <quark@zju.edu.cn>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "checkpoint.h"
+
+double checkpoint::next_cpu(double remaining, double observed_rate, int threads, long cpu_count) {
+    // the cgroup can not use more cpu time than min(threads, cpus) per
+    // second. the observed rate covers threads created since last check.
+    double rate = threads < cpu_count ? threads : cpu_count;
+    if (rate < 1) rate = 1;
+    if (observed_rate > rate) rate = observed_rate;
+
+    // only wait for half of the predicted time so that checks become more
+    // frequent near the limit and the overshoot is bounded by the minimal
+    // interval times the rate
+    double wait = remaining / rate / 2;
+    if (wait < MIN_CPU_INTERVAL) wait = MIN_CPU_INTERVAL;
+    return wait;
+}
@@ -0,0 +1,49 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2012-2015 Jun Wu <quark@zju.edu.cn>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+#include <sys/types.h>
+
+namespace fdpass {
+    /**
+     * send a message with file descriptors (SCM_RIGHTS)
+     * @param   sock        unix socket
+     * @param   buf         payload, must not be empty
+     * @param   fds         fds to send
+     * @param   nfds        number of fds, up to MAX_FDS
+     * @return  0           success
+     *         <0           failed
+     */
+    int send(int sock, const void *buf, size_t len, const int *fds = NULL, int nfds = 0);
+
+    /**
+     * receive a message with file descriptors. received fds are O_CLOEXEC
+     * @param   fds         filled with received fds
+     * @param   nfds        in: capacity of fds, out: number of received fds
+     * @return  bytes       payload length, 0 if peer closed, <0 if failed
+     */
+    ssize_t recv(int sock, void *buf, size_t len, int *fds, int *nfds);
+
+    const int MAX_FDS = 16;
+}
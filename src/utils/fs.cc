@@ -44,6 +44,7 @@ const char fs::PATH_SEPARATOR = '/';
 const char * const fs::PROC_PATH = "/proc";
 const char * const fs::MOUNTS_PATH = "/proc/mounts";
 const char * const fs::TYPE_CGROUP = "cgroup";
+const char * const fs::TYPE_CGROUP2 = "cgroup2";
 const char * const fs::TYPE_TMPFS  = "tmpfs";
 
 string fs::join(const string& dirname, const string& basename) {
@@ -396,13 +397,13 @@ std::string fs::get_mount_point(const std::string& path) {
   return result;
 }
 
-fs::ScopedFileLock::ScopedFileLock(const char path[]) {
+fs::ScopedFileLock::ScopedFileLock(const char path[], bool wait) {
     int fd = open(path, O_RDONLY);
     if (fd < 0) {
         this->fd_ = -1;
         return;
     }
-    if (flock(fd, LOCK_EX) == 0) {
+    if (flock(fd, wait ? LOCK_EX : (LOCK_EX | LOCK_NB)) == 0) {
         this->fd_ = fd;
     } else {
         close(fd);
@@ -416,3 +417,7 @@ fs::ScopedFileLock::~ScopedFileLock() {
     flock(fd, LOCK_UN);
     close(fd);
 }
+
+bool fs::ScopedFileLock::locked() const {
+    return this->fd_ >= 0;
+}
@@ -69,6 +69,11 @@ namespace fs {
      */
     extern const char * const TYPE_CGROUP;
 
+    /**
+     * Cgroup v2 (unified hierarchy) filesystem type name: "cgroup2"
+     */
+    extern const char * const TYPE_CGROUP2;
+
     /**
      * tmpfs type name: "tmpfs"
      */
@@ -237,8 +242,18 @@ namespace fs {
 
     class ScopedFileLock {
         public:
-            ScopedFileLock(const char path[]);
+            /**
+             * take an exclusive flock on `path`
+             * @param   wait    block until the lock is available. if false,
+             *                  give up immediately if someone holds the lock
+             */
+            ScopedFileLock(const char path[], bool wait = true);
             ~ScopedFileLock();
+
+            /**
+             * @return  true if the lock is held
+             */
+            bool locked() const;
         private:
             int fd_;
     };
@@ -90,17 +90,20 @@
         exit(-1); }
 
 #define ERROR(...) { \
+        int saved_errno_ = errno; \
         SCOPED_LOG_LOCK; \
         PRINT_TIMESTAMP; \
         FILE* fp = flog ? flog : stderr; \
         fprintf(fp, "ERROR: "); \
         fprintf(fp, __VA_ARGS__); \
-        if (errno) fprintf(fp, " (%s)", strerror(errno)); \
+        if (saved_errno_) fprintf(fp, " (%s)", strerror(saved_errno_)); \
         fprintf(fp, "\n"); \
         SHOW_SOURCE_LOCATION; \
-        fflush(fp); }
+        fflush(fp); \
+        errno = saved_errno_; }
 
 #define WARNING(...) { \
+        int saved_errno_ = errno; \
         SCOPED_LOG_LOCK; \
         PRINT_TIMESTAMP; \
         FILE* fp = flog ? flog : stderr; \
@@ -108,4 +111,5 @@
         fprintf(fp, __VA_ARGS__); \
         fprintf(fp, "\n"); \
         SHOW_SOURCE_LOCATION; \
-        fflush(fp); }
+        fflush(fp); \
+        errno = saved_errno_; }
@@ -0,0 +1,76 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2012-2015 Jun Wu <quark@zju.edu.cn>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "pidfd.h"
+#include <cstdio>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+// older glibc does not have these syscall numbers
+#ifndef __NR_pidfd_send_signal
+# define __NR_pidfd_send_signal 424
+#endif
+#ifndef __NR_pidfd_open
+# define __NR_pidfd_open 434
+#endif
+#ifndef P_PIDFD
+# define P_PIDFD 3
+#endif
+
+
+int pidfd::open(pid_t pid) {
+    // pidfd is always O_CLOEXEC
+    return (int)syscall(__NR_pidfd_open, pid, 0);
+}
+
+int pidfd::send_signal(int fd, int signal) {
+    return (int)syscall(__NR_pidfd_send_signal, fd, signal, NULL, 0);
+}
+
+int pidfd::reap(int fd) {
+    siginfo_t info;
+    info.si_pid = 0;
+    if (waitid((idtype_t)P_PIDFD, (id_t)fd, &info, WEXITED | WNOHANG | __WALL)) return -1;
+    return info.si_pid == 0 ? 1 : 0;
+}
+
+bool pidfd::is_child(int fd) {
+    // waitid fails with ECHILD for other processes
+    siginfo_t info;
+    return waitid((idtype_t)P_PIDFD, (id_t)fd, &info, WEXITED | WNOHANG | WNOWAIT | __WALL) == 0;
+}
+
+pid_t pidfd::get_pid(int fd) {
+    char path[sizeof(int) * 3 + sizeof("/proc/self/fdinfo/")];
+    snprintf(path, sizeof path, "/proc/self/fdinfo/%d", fd);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+
+    long pid = -1;
+    char line[128];
+    while (fgets(line, sizeof line, fp)) {
+        if (sscanf(line, "Pid: %ld", &pid) == 1) break;
+    }
+    fclose(fp);
+    return pid > 0 ? (pid_t)pid : -1;
+}
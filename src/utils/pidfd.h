@@ -0,0 +1,60 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2012-2015 Jun Wu <quark@zju.edu.cn>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <sys/types.h>
+
+namespace pidfd {
+    /**
+     * open a pidfd (Linux >= 5.3). a pidfd is readable when the process exits
+     * @return  fd          pidfd opened with O_CLOEXEC, negative if failed
+     */
+    int open(pid_t pid);
+
+    /**
+     * send signal using a pidfd (Linux >= 5.1)
+     * @return  0           success
+     *         <0           failed
+     */
+    int send_signal(int fd, int signal);
+
+    /**
+     * reap a child process if it has exited, using waitid P_PIDFD (Linux >= 5.4).
+     * children without an exit signal (ex. pid namespace init) are included
+     * @return  0           reaped
+     *          1           still running
+     *         <0           failed, ex. not a child or already reaped
+     */
+    int reap(int fd);
+
+    /**
+     * check if a pidfd refers to a child of the caller, without reaping it
+     */
+    bool is_child(int fd);
+
+    /**
+     * get pid of a pidfd in the current pid namespace, using fdinfo (Linux >= 5.4)
+     * @return  pid         pid, negative if failed
+     */
+    pid_t get_pid(int fd);
+}
@@ -0,0 +1,95 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2012-2015 Jun Wu <quark@zju.edu.cn>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "stats.h"
+#include <algorithm>
+#include <cmath>
+
+using std::string;
+using std::vector;
+
+// index of a nearest-rank quantile in sorted samples
+static size_t rank(size_t count, double q) {
+    double r = ceil(q * count) - 1;
+    return r < 0 ? 0 : (size_t)r;
+}
+
+static double quantile_of(const string& statistic) {
+    if (statistic == "min") return 0;
+    if (statistic == "median") return 0.5;
+    if (statistic == "p95") return 0.95;
+    return 1;
+}
+
+stats::summary stats::summarize(const vector<double>& values) {
+    vector<double> sorted = values;
+    std::sort(sorted.begin(), sorted.end());
+    size_t n = sorted.size();
+
+    summary s;
+    s.min = sorted[0];
+    s.max = sorted[n - 1];
+    s.median = sorted[rank(n, 0.5)];
+    s.p95 = sorted[rank(n, 0.95)];
+
+    double sum = 0;
+    for (size_t i = 0; i < n; ++i) sum += sorted[i];
+    s.mean = sum / n;
+
+    double variance = 0;
+    for (size_t i = 0; i < n; ++i) variance += (sorted[i] - s.mean) * (sorted[i] - s.mean);
+    s.stddev = n > 1 ? sqrt(variance / (n - 1)) : 0;
+
+    return s;
+}
+
+bool stats::is_statistic(const string& statistic) {
+    return statistic == "min" || statistic == "median" || statistic == "mean" || statistic == "p95" || statistic == "max";
+}
+
+double stats::get(const summary& s, const string& statistic) {
+    if (statistic == "min") return s.min;
+    if (statistic == "median") return s.median;
+    if (statistic == "mean") return s.mean;
+    if (statistic == "p95") return s.p95;
+    return s.max;
+}
+
+int stats::decide(const vector<double>& values, size_t total, const string& statistic, double limit) {
+    size_t under = 0, left = total > values.size() ? total - values.size() : 0;
+    for (size_t i = 0; i < values.size(); ++i) {
+        if (values[i] < limit) ++under;
+    }
+
+    if (statistic == "mean") {
+        // samples are at most limit, so the mean reaches it only if all do
+        if (under > 0) return 0;
+        return left == 0 ? 1 : -1;
+    }
+
+    // the quantile is the sample at rank r, it reaches the limit iff at
+    // most r samples are under the limit
+    size_t r = rank(total, quantile_of(statistic));
+    if (under > r) return 0;
+    if (under + left <= r) return 1;
+    return -1;
+}
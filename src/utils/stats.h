@@ -0,0 +1,72 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2012-2015 Jun Wu <quark@zju.edu.cn>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace stats {
+    /**
+     * statistics of samples. quantiles use the nearest-rank method, so
+     * they are always one of the samples
+     */
+    struct summary {
+        double min;
+        double median;
+        double mean;
+        double stddev;              // sample standard deviation
+        double p95;
+        double max;
+    };
+
+    /**
+     * @param   values      samples, not empty
+     */
+    summary summarize(const std::vector<double>& values);
+
+    /**
+     * @param   statistic   "min", "median", "mean", "p95" or "max"
+     * @return  true if statistic is one of above
+     */
+    bool is_statistic(const std::string& statistic);
+
+    /**
+     * @param   statistic   see is_statistic
+     * @return  the statistic in s
+     */
+    double get(const summary& s, const std::string& statistic);
+
+    /**
+     * decide whether the statistic of all samples will reach a limit,
+     * before all samples are taken
+     * @param   values      samples taken so far. none of them, or the ones
+     *                      not taken yet, is larger than limit
+     * @param   total       number of samples in the end
+     * @param   statistic   see is_statistic
+     * @param   limit       the limit
+     * @return  1           the statistic will be >= limit
+     *          0           the statistic will be < limit
+     *         -1           not decided yet
+     */
+    int decide(const std::vector<double>& values, size_t total, const std::string& statistic, double limit);
+}
@@ -21,7 +21,12 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 #include "strconv.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
 using std::string;
 
@@ -85,6 +90,22 @@ long long strconv::to_bytes(const string& str) {
     return result;
 }
 
+bool strconv::is_double(const string& str) {
+    if (str.empty() || isspace((unsigned char)str[0])) return false;
+    char *end = NULL;
+    double v = strtod(str.c_str(), &end);
+    // inf and nan are not limits
+    return end && *end == '\0' && std::isfinite(v);
+}
+
+bool strconv::is_bytes(const string& str) {
+    // same suffixes as to_bytes
+    size_t len = str.length();
+    if (len > 1 && (str[len - 1] == 'b' || str[len - 1] == 'B')) --len;
+    if (len > 1 && strchr("gGmMkK", str[len - 1])) --len;
+    return is_double(str.substr(0, len));
+}
+
 string strconv::from_double(double value, int precision) {
     char buf[1024];
     char format[16];
@@ -110,3 +131,39 @@ string strconv::from_longlong(long long value) {
     snprintf(buf, sizeof buf, "%lld", value);
     return buf;
 }
+
+std::vector<int> strconv::to_int_list(const string& str) {
+    // larger than any cpu or node id, avoid huge allocations
+    static const int MAX_VALUE = 65535;
+    std::vector<int> result;
+    const char *p = str.c_str();
+    while (*p && *p != '\n') {
+        int first, last, len = 0;
+        if (sscanf(p, "%d%n", &first, &len) != 1 || first < 0 || first > MAX_VALUE) return std::vector<int>();
+        p += len;
+        last = first;
+        if (*p == '-') {
+            if (sscanf(p + 1, "%d%n", &last, &len) != 1 || last < first || last > MAX_VALUE) return std::vector<int>();
+            p += 1 + len;
+        }
+        for (int i = first; i <= last; ++i) result.push_back(i);
+        if (*p == ',') ++p;
+        else if (*p && *p != '\n') return std::vector<int>();
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+string strconv::from_int_list(const std::vector<int>& values) {
+    string result;
+    for (size_t i = 0; i < values.size(); ++i) {
+        size_t j = i;
+        while (j + 1 < values.size() && values[j + 1] == values[j] + 1) ++j;
+        if (!result.empty()) result += ",";
+        result += from_long(values[i]);
+        if (j > i) result += "-" + from_long(values[j]);
+        i = j;
+    }
+    return result;
+}
@@ -22,6 +22,7 @@
 
 #pragma once
 #include <string>
+#include <vector>
 
 namespace strconv {
     double to_double(const std::string& str);
@@ -31,8 +32,29 @@ namespace strconv {
     bool to_bool(const std::string& str);
     long long to_bytes(const std::string& str);
 
+    /**
+     * @return  true if the whole str is a number accepted by to_double
+     */
+    bool is_double(const std::string& str);
+
+    /**
+     * @return  true if the whole str is accepted by to_bytes
+     */
+    bool is_bytes(const std::string& str);
+
     std::string from_double(double value, int precision = 0);
     std::string from_long(long value);
     std::string from_ulong(unsigned long value);
     std::string from_longlong(long long value);
+
+    /**
+     * parse a list like "0-3,8", used by cpuset and sysfs
+     * @return  sorted values without duplicates, empty if str is invalid
+     */
+    std::vector<int> to_int_list(const std::string& str);
+
+    /**
+     * @return  a list like "0-3,8", values should be sorted
+     */
+    std::string from_int_list(const std::vector<int>& values);
 }
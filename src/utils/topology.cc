@@ -0,0 +1,92 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2012-2015 Jun Wu <quark@zju.edu.cn>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "topology.h"
+#include "fs.h"
+#include "strconv.h"
+#include <algorithm>
+#include <cctype>
+#include <dirent.h>
+#include <cstdlib>
+#include <cstring>
+
+using std::string;
+using std::vector;
+
+static const char NODE_PATH[] = "/sys/devices/system/node";
+
+vector<int> topology::local_nodes(const vector<int>& cpus) {
+    vector<int> nodes;
+    DIR *dir = opendir(NODE_PATH);
+    if (!dir) return nodes;
+
+    // nodes without memory can not be used in cpuset.mems
+    vector<int> memory_nodes = strconv::to_int_list(fs::read(string(NODE_PATH) + "/has_memory"));
+
+    // nodeN/cpulist lists cpus of node N
+    for (struct dirent *ent = readdir(dir); ent; ent = readdir(dir)) {
+        if (strncmp(ent->d_name, "node", 4) != 0 || !isdigit(ent->d_name[4])) continue;
+        int node = atoi(ent->d_name + 4);
+        if (!std::binary_search(memory_nodes.begin(), memory_nodes.end(), node)) continue;
+        vector<int> node_cpus = strconv::to_int_list(fs::read(string(NODE_PATH) + "/" + ent->d_name + "/cpulist"));
+        for (size_t i = 0; i < cpus.size(); ++i) {
+            if (std::binary_search(node_cpus.begin(), node_cpus.end(), cpus[i])) {
+                nodes.push_back(node);
+                break;
+            }
+        }
+    }
+    closedir(dir);
+
+    std::sort(nodes.begin(), nodes.end());
+    return nodes;
+}
+
+vector<vector<int> > topology::cores() {
+    vector<vector<int> > result;
+    vector<int> online = strconv::to_int_list(fs::read("/sys/devices/system/cpu/online"));
+
+    // a core is listed once, by its first online sibling
+    vector<int> listed;
+    for (size_t i = 0; i < online.size(); ++i) {
+        int cpu = online[i];
+        if (std::binary_search(listed.begin(), listed.end(), cpu)) continue;
+
+        string path = "/sys/devices/system/cpu/cpu" + strconv::from_long(cpu) + "/topology/thread_siblings_list";
+        vector<int> siblings = strconv::to_int_list(fs::read(path));
+        vector<int> core;
+        for (size_t j = 0; j < siblings.size(); ++j) {
+            if (std::binary_search(online.begin(), online.end(), siblings[j])) core.push_back(siblings[j]);
+        }
+        if (core.empty()) core.push_back(cpu);
+
+        listed.insert(listed.end(), core.begin(), core.end());
+        std::sort(listed.begin(), listed.end());
+        result.push_back(core);
+    }
+
+    return result;
+}
+
+vector<int> topology::isolated_cpus() {
+    return strconv::to_int_list(fs::read("/sys/devices/system/cpu/isolated"));
+}
@@ -22,6 +22,10 @@
 
 #include "cgroup.h"
 #include "test.h"
+#include "utils/fs.h"
+#include <cerrno>
+#include <unistd.h>
+#include <sys/wait.h>
 
 using namespace lrun;
 
@@ -39,8 +43,9 @@ TESTCASE(create_and_destroy) {
 TESTCASE(set_properties) {
     Cgroup cg = Cgroup::create("testsetprop");
     // FIXME assume no swap here
-    CHECK(cg.set(Cgroup::CG_MEMORY, "memory.limit_in_bytes", "1048576") == 0);
-    CHECK(cg.get(Cgroup::CG_MEMORY, "memory.limit_in_bytes") == "1048576\n");
+    const char *limit = Cgroup::version() == 2 ? "memory.max" : "memory.limit_in_bytes";
+    CHECK(cg.set(Cgroup::CG_MEMORY, limit, "1048576") == 0);
+    CHECK(cg.get(Cgroup::CG_MEMORY, limit) == "1048576\n");
     CHECK(cg.reset_usages() == 0);
     CHECK(cg.destroy() == 0);
 }
@@ -54,4 +59,197 @@ TESTCASE(create_use_exist) {
     CHECK(!cg1.valid());
 }
 
+TESTCASE(optional_subsys) {
+    // optional v1 cgroups are only joined if asked for
+    Cgroup cg = Cgroup::create("testoptional");
+    if (Cgroup::version() == 1 && Cgroup::subsys_available(Cgroup::CG_PIDS)) {
+        CHECK(!cg.has_subsys(Cgroup::CG_PIDS));
+        CHECK(!fs::is_dir(Cgroup::base_path(Cgroup::CG_PIDS) + "/testoptional"));
+        CHECK(cg.set_pids_limit(10) != 0);
+    }
+    CHECK(cg.destroy() == 0);
+}
+
+TESTCASE(pids_limit) {
+    Cgroup cg = Cgroup::create("testpids", 1 << Cgroup::CG_PIDS);
+    if (Cgroup::subsys_available(Cgroup::CG_PIDS)) {
+        CHECK(cg.set_pids_limit(10) == 0);
+        CHECK(cg.get(Cgroup::CG_PIDS, "pids.max") == "10\n");
+        CHECK(cg.set_pids_limit(-1) == 0);
+        CHECK(cg.get(Cgroup::CG_PIDS, "pids.max") == "max\n");
+        CHECK(cg.pids_current() == 0);
+        CHECK(cg.pids_limit_hits() == 0);
+    } else {
+        CHECK(cg.set_pids_limit(10) != 0);
+    }
+    CHECK(cg.destroy() == 0);
+}
+
+TESTCASE(cpu_bandwidth) {
+    Cgroup cg = Cgroup::create("testcpu", 1 << Cgroup::CG_CPU);
+    if (Cgroup::subsys_available(Cgroup::CG_CPU)) {
+        CHECK(cg.set_cpu_quota(1.5) == 0);
+        CHECK(cg.set_cpu_weight(50) == 0);
+        if (Cgroup::version() == 2) {
+            CHECK(cg.get(Cgroup::CG_CPU, "cpu.max") == "150000 100000\n");
+            CHECK(cg.get(Cgroup::CG_CPU, "cpu.weight") == "50\n");
+        } else {
+            CHECK(cg.get(Cgroup::CG_CPU, "cpu.cfs_quota_us") == "150000\n");
+            CHECK(cg.get(Cgroup::CG_CPU, "cpu.shares") == "512\n");
+        }
+        CHECK(cg.set_cpu_quota(-1) == 0);
+        CHECK(cg.set_cpu_weight(-1) == 0);
+    } else {
+        CHECK(cg.set_cpu_quota(1) != 0);
+    }
+    CHECK(cg.destroy() == 0);
+}
+
+TESTCASE(cpuset) {
+    Cgroup cg = Cgroup::create("testcpuset", 1 << Cgroup::CG_CPUSET);
+    if (Cgroup::subsys_available(Cgroup::CG_CPUSET)) {
+        CHECK(cg.set_cpuset("0", "0") == 0);
+        CHECK(cg.cpuset_cpus() == "0");
+        CHECK(cg.set_cpuset("", "") == 0);
+        CHECK(!cg.cpuset_cpus().empty());
+    } else {
+        CHECK(cg.set_cpuset("0", "") != 0);
+        CHECK(cg.cpuset_cpus().empty());
+    }
+    CHECK(cg.destroy() == 0);
+}
+
+TESTCASE(version) {
+    int version = Cgroup::version();
+    CHECK(version == 1 || version == 2);
+}
+
+
+
+// a child waiting to be killed. it touches bytes of memory after it is
+// told to over a pipe, so the memory is charged to the cgroup it is in
+static pid_t fork_child(size_t bytes, int *go_fd, int *ready_fd) {
+    int go[2], ready[2];
+    if (pipe(go) || pipe(ready)) return -1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        char c;
+        if (read(go[0], &c, 1) != 1) _exit(1);
+        if (bytes) memset(malloc(bytes), 1, bytes);
+        if (write(ready[1], &c, 1) != 1) _exit(1);
+        for (;;) pause();
+    }
+    close(go[0]);
+    close(ready[1]);
+    *go_fd = go[1];
+    *ready_fd = ready[0];
+    return pid;
+}
+
+static bool start_child(int go_fd, int ready_fd) {
+    char c = 'g';
+    bool ok = write(go_fd, &c, 1) == 1 && read(ready_fd, &c, 1) == 1;
+    close(go_fd);
+    close(ready_fd);
+    return ok;
+}
 
+// on a v2 host, these cover the v2 paths: cgroup.procs, cgroup.kill,
+// memory.peak and the "0::" line of /proc/<pid>/cgroup
+TESTCASE(attach_and_killall) {
+    Cgroup cg = Cgroup::create("testattach");
+    Cgroup other = Cgroup::create("testattachother");
+    int go_fd, ready_fd;
+    pid_t pid = fork_child(0, &go_fd, &ready_fd);
+    CHECK(pid > 0);
+    CHECK(cg.empty());
+    CHECK(cg.attach(pid) == 0);
+    CHECK(start_child(go_fd, ready_fd));
+    CHECK(cg.has_pid(pid));
+    CHECK(!other.has_pid(pid));
+    CHECK(!cg.empty());
+
+    cg.killall();
+    int stat = 0;
+    CHECK(waitpid(pid, &stat, 0) == pid && WIFSIGNALED(stat));
+    CHECK(cg.empty());
+    CHECK(!cg.has_pid(pid));
+    CHECK(other.destroy() == 0);
+    CHECK(cg.destroy() == 0);
+}
+
+TESTCASE(memory_peak) {
+    static const size_t BYTES = 16 << 20;
+    Cgroup cg = Cgroup::create("testpeak");
+    CHECK(cg.memory_peak() < (long long)BYTES);
+
+    int go_fd, ready_fd;
+    pid_t pid = fork_child(BYTES, &go_fd, &ready_fd);
+    CHECK(cg.attach(pid) == 0);
+    CHECK(start_child(go_fd, ready_fd));
+    CHECK(cg.memory_peak() >= (long long)BYTES);
+    CHECK(cg.memory_current() >= (long long)BYTES);
+
+    cg.killall();
+    while (waitpid(pid, NULL, 0) < 0 && errno == EINTR);
+    CHECK(cg.destroy() == 0);
+}
+
+TESTCASE(v2_has_pid) {
+    // skipped if cgroup v2 is not used
+    if (Cgroup::version() != 2) return;
+    Cgroup cg = Cgroup::create("testv2pid");
+    int go_fd, ready_fd;
+    pid_t pid = fork_child(0, &go_fd, &ready_fd);
+    CHECK(cg.attach(pid) == 0);
+    CHECK(start_child(go_fd, ready_fd));
+    char path[64];
+    snprintf(path, sizeof path, "/proc/%d/cgroup", (int)pid);
+    CHECK(fs::read(path).find("0::/lrun/testv2pid\n") != std::string::npos);
+    CHECK(cg.has_pid(pid));
+
+    cg.killall();
+    while (waitpid(pid, NULL, 0) < 0 && errno == EINTR);
+    CHECK(cg.destroy() == 0);
+}
+
+TESTCASE(zygote_killall) {
+    Cgroup cg = Cgroup::create("testzygote");
+    char *args[] = {(char *)"/bin/sh", (char *)"-c", (char *)"sleep 100 & exec sleep 100", NULL};
+    Cgroup::spawn_arg arg;
+    arg.clone_flags = CLONE_NEWPID;
+    arg.args = args;
+    arg.argc = 3;
+    arg.uid = arg.gid = 65534;
+    arg.umask = 022;
+    arg.nice = 0;
+    arg.no_new_privs = true;
+    arg.disable_aslr = arg.disable_thp = arg.umount_outside = false;
+    arg.stdin_fd = STDIN_FILENO;
+    arg.stdout_fd = STDOUT_FILENO;
+    arg.stderr_fd = STDERR_FILENO;
+    arg.reset_env = arg.remount_dev = 0;
+    arg.callback_child = NULL;
+    arg.syscall_action = seccomp::action_t::OTHERS_EPERM;
+    CHECK(cg.start_zygote(arg) == 0);
+
+    std::map<int, rlim_t> rlimits;
+    rlimits[RLIMIT_NOFILE] = 123;
+    for (int i = 0; i < 2; ++i) {
+        pid_t pid = cg.spawn_from_zygote(STDIN_FILENO, STDOUT_FILENO, i ? &rlimits : NULL);
+        CHECK(pid > 0);
+        CHECK(cg.has_pid(pid));
+        char path[64];
+        snprintf(path, sizeof path, "/proc/%d/limits", (int)pid);
+        CHECK((fs::read(path).find("Max open files            123") != std::string::npos) == (i == 1));
+
+        // the child and its background process are killed, the zygote
+        // survives for the next child
+        cg.killall();
+        CHECK(cg.empty());
+        waitpid(pid, NULL, __WALL | WNOHANG);
+    }
+
+    cg.stop_zygote();
+    CHECK(cg.destroy() == 0);
+}
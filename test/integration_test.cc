@@ -24,7 +24,10 @@
 #include <cstdlib>
 #include <cstdio>
 #include <cassert>
+#include <ctime>
 #include <string>
+#include <unistd.h>
+#include "report.h"
 
 using std::string;
 
@@ -84,6 +87,32 @@ void test_cmd(string cmd, string expect, string lrun_flags = "") {
 }
 
 
+// stdout of a shell command
+static string run(const string& cmd) {
+    FILE *fp = popen(cmd.c_str(), "r");
+    assert(fp);
+    string result;
+    char buf[1024];
+    size_t bytes;
+    while ((bytes = fread(buf, 1, sizeof(buf), fp)) > 0) result.append(buf, bytes);
+    pclose(fp);
+    return result;
+}
+
+static void write_file(const char *path, const char *content) {
+    FILE *fp = fopen(path, "w");
+    assert(fp);
+    fputs(content, fp);
+    fclose(fp);
+}
+
+// number after key in a report, -1 if not found
+static long long report_value(const string& result, const string& key) {
+    size_t pos = result.find(key);
+    if (pos == string::npos) return -1;
+    return atoll(result.c_str() + pos + key.length());
+}
+
 static char flags[2][32] = {
     "--isolate-process true",
     "--isolate-process false" };
@@ -167,3 +196,201 @@ TESTCASE(syscall_filter) {
     test_cmd("env true", "EXITCODE 1" /* 126 */, "--syscalls '!execve'");
     test_cmd("env true", "EXITCODE 1" /* 125 */, "--syscalls 'access,arch_prctl,brk,close,exit_group,fstat,mmap,mprotect,munmap,open,read,exit'");
 }
+
+TESTCASE(testcases) {
+    write_file(TMP "/lrun-t0.in", "0");
+    write_file(TMP "/lrun-t1.in", "1");
+    write_file(TMP "/lrun-t2.in", "2");
+    // 1: busy loop, 2: leaves a busy child behind
+    string code = "main(){int n=0;scanf(\"%d\",&n);if(n==1)for(;;);if(n==2&&fork()==0)for(;;);printf(\"%d\",n);return n;}";
+    for_each_flag("--max-cpu-time 0.2"
+            " --testcase " TMP "/lrun-t0.in " TMP "/lrun-t0.out"
+            " --testcase " TMP "/lrun-t1.in " TMP "/lrun-t1.out --testcase-limit max-cpu-time 0.5"
+            " --testcase " TMP "/lrun-t.missing " TMP "/lrun-t3.out"
+            " --testcase " TMP "/lrun-t2.in " TMP "/lrun-t2.out") {
+        test_c_code(code, "TESTCASE 0\nMEMORY", c.flag);
+        test_c_code(code, "CPUTIME  0.500", c.flag);
+        // a testcase which can not start does not stop the others
+        test_c_code(code, "TESTCASE 2\nERROR", c.flag);
+        test_c_code(code, "EXITCODE 2", c.flag);
+    }
+}
+
+TESTCASE(batch_manifest) {
+    const char *manifest = TMP "/lrun-t.manifest";
+    write_file(manifest, "--max-cpu-time 1 -- /bin/true\n--stdin " TMP "/lrun-t0.in -- /bin/false\n");
+    string result = run(string("lrun --batch ") + manifest + " 3>&1 2>&1; echo exit=$?");
+    CHECK(result.find("ITEM 0\nMEMORY") != string::npos);
+    CHECK(result.find("ITEM 1\nMEMORY") != string::npos);
+
+    // errors name the line, and nothing runs
+    const char *bad[][2] = {
+        {"--max-memory x -- /bin/true\n", "line 2: invalid value 'x' for --max-memory"},
+        {"--max-cpu-time -1 -- /bin/true\n", "line 2: --max-cpu-time can not be negative"},
+        {"/bin/true\n", "line 2: unexpected '/bin/true', use '--' before the command"},
+        {"--stdout\n", "line 2: --stdout requires an argument"},
+        {"--max-cpu-time 1\n", "line 2: command is missing"},
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+        write_file(manifest, (string("-- /bin/true\n") + bad[i][0]).c_str());
+        result = run(string("lrun --batch ") + manifest + " 3>&1 2>&1; echo exit=$?");
+        CHECK(result.find(bad[i][1]) != string::npos, 3, "result, expect:", result.c_str(), bad[i][1]);
+        CHECK(result.find("ITEM") == string::npos);
+        CHECK(result.find("exit=0") == string::npos);
+    }
+}
+
+TESTCASE(report_format) {
+    string result = run("lrun --report-format json /bin/true 3>&1 >/dev/null 2>&1");
+    CHECK(result.find("{\"memory\": ") == 0);
+    CHECK(result.find("\"exit_code\": 0, ") != string::npos);
+    CHECK(result.find("\"exceed\": null") != string::npos);
+    CHECK(result.length() > 2 && result.substr(result.length() - 2) == "}\n");
+
+    // 2 runs and the summary
+    result = run("lrun --report-format binary --repeat 2 /bin/false 3>&1 >/dev/null 2>&1");
+    CHECK(result.length() == 3 * sizeof(struct lrun_report));
+    for (size_t i = 0; i < 3 && (i + 1) * sizeof(struct lrun_report) <= result.length(); ++i) {
+        struct lrun_report report;
+        memcpy(&report, result.data() + i * sizeof report, sizeof report);
+        CHECK(memcmp(report.magic, LRUN_REPORT_MAGIC, sizeof report.magic) == 0);
+        CHECK(report.version == LRUN_REPORT_VERSION);
+        CHECK(report.size == sizeof report);
+        if (i < 2) {
+            CHECK(report.index == (int32_t)i);
+            CHECK(report.exit_code == 1);
+            CHECK(report.exceed == LRUN_REPORT_EXCEED_NONE);
+        } else {
+            CHECK(report.flags & LRUN_REPORT_SUMMARY);
+            CHECK(report.repeats == 2 && report.runs == 2);
+        }
+    }
+}
+
+TESTCASE(telemetry) {
+    string result = run("lrun --telemetry-fd 5 --telemetry-interval 0.05 sleep 0.2 5>&1 3>/dev/null >/dev/null 2>&1");
+    // start, samples and exit
+    int lines = 0;
+    double last_t = 0;
+    for (size_t pos = 0, end; (end = result.find('\n', pos)) != string::npos; pos = end + 1, ++lines) {
+        double t, cpu;
+        long long mem, rss, cache;
+        int tasks;
+        string line = result.substr(pos, end - pos);
+        int fields = sscanf(line.c_str(), "t=%lf cpu=%lf mem=%lld rss=%lld cache=%lld tasks=%d", &t, &cpu, &mem, &rss, &cache, &tasks);
+        CHECK(fields == 6, 2, "line:", line.c_str());
+        CHECK(t >= last_t);
+        last_t = t;
+    }
+    CHECK(lines >= 3);
+    CHECK(last_t >= 0.2);
+
+    write_file(TMP "/lrun-t0.in", "0");
+    result = run("lrun --telemetry-fd 5 --testcase " TMP "/lrun-t0.in " TMP "/lrun-t0.out --testcase " TMP "/lrun-t0.in " TMP "/lrun-t1.out"
+            " /bin/true 5>&1 3>/dev/null >/dev/null 2>&1");
+    CHECK(result.find("testcase=0 t=0.000 cpu=") == 0);
+    CHECK(result.find("\ntestcase=1 t=0.000 cpu=") != string::npos);
+}
+
+TESTCASE(memory_accounting) {
+    // 32MB page cache and 4MB anonymous memory, kept until sampled
+    write_file(TMP "/lrun-t-mem.c",
+            "#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n#include <unistd.h>\n"
+            "int main(){static char b[1<<20];FILE*f=fopen(\"" TMP "/lrun-t.cache\",\"w\");"
+            "for(int i=0;i<32;++i)fwrite(b,1,sizeof b,f);fclose(f);"
+            "char*p=malloc(4<<20);memset(p,1,4<<20);usleep(200000);return p[100]-1;}");
+    assert(system("gcc -std=gnu99 " TMP "/lrun-t-mem.c -o " TMP "/lrun-t-mem >/dev/null 2>/dev/null") == 0);
+
+    long long total = report_value(run("lrun --memory-accounting total " TMP "/lrun-t-mem 3>&1 >/dev/null 2>&1"), "MEMORY");
+    long long rss = report_value(run("lrun --memory-accounting rss " TMP "/lrun-t-mem 3>&1 >/dev/null 2>&1"), "MEMORY");
+    CHECK(total >= (32 << 20));
+    CHECK(rss >= (4 << 20) && rss < (16 << 20));
+
+    // all modes are reported, memory is the selected one
+    string result = run("lrun --report-format json --memory-accounting rss " TMP "/lrun-t-mem 3>&1 >/dev/null 2>&1");
+    CHECK(report_value(result, "\"memory\": ") == report_value(result, "\"memory_rss\": "));
+    CHECK(report_value(result, "\"memory_total\": ") >= (32 << 20));
+    unlink(TMP "/lrun-t.cache");
+}
+
+TESTCASE(exclusive_core) {
+    // hold the core of cpu 0, then ask for it without waiting
+    string cpus = run("cat /sys/devices/system/cpu/cpu0/topology/thread_siblings_list 2>/dev/null");
+    if (cpus.empty()) return;
+    cpus = cpus.substr(0, cpus.find('\n'));
+    string cmd = "lrun --exclusive-core true --cpus " + cpus;
+    assert(system((cmd + " sleep 1 3>/dev/null >/dev/null 2>&1 &").c_str()) == 0);
+    usleep(300000);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    string result = run(cmd + " --exclusive-core-wait 0 /bin/true 3>&1 2>&1; echo exit=$?");
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    CHECK(result.find("no free core for --exclusive-core") != string::npos);
+    CHECK(result.find("MEMORY") == string::npos);
+    CHECK(result.find("exit=2") != string::npos);
+    CHECK(end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9 < 0.5);
+
+    // the core is free again once the holder exits
+    usleep(1000000);
+    result = run(cmd + " --exclusive-core-wait 0 /bin/true 3>&1 2>&1");
+    CHECK(result.find("EXITCODE 0") != string::npos);
+}
+
+TESTCASE(fork_server) {
+    // LRUN_FORK_SERVER: path of utils/libforkserver/libforkserver.so, which
+    // the sandbox user can read. skipped if not set
+    const char *shim = getenv("LRUN_FORK_SERVER");
+    if (!shim) return;
+    string code = "main(){int n=0;scanf(\"%d\",&n);if(n==1)for(;;);if(n==2&&fork()==0)for(;;);printf(\"%d\",n);return n;}";
+    write_file(TMP "/lrun-t0.in", "0");
+    write_file(TMP "/lrun-t1.in", "1");
+    write_file(TMP "/lrun-t2.in", "2");
+    for_each_flag(string("--fork-server ") + shim + " --max-cpu-time 0.2"
+            " --testcase " TMP "/lrun-t2.in " TMP "/lrun-t2.out"
+            " --testcase " TMP "/lrun-t1.in " TMP "/lrun-t1.out"
+            " --testcase " TMP "/lrun-t0.in " TMP "/lrun-t0.out") {
+        // statuses come from the kernel: exit code, cpu time limit
+        test_c_code(code, "TESTCASE 0\nMEMORY", c.flag);
+        test_c_code(code, "EXITCODE 2", c.flag);
+        test_c_code(code, "TESTCASE 1\nMEMORY", c.flag);
+        test_c_code(code, "EXCEED   CPU_TIME", c.flag);
+        test_c_code(code, "EXITCODE 0\nTERMSIG  0\nEXCEED   none\n", c.flag);
+    }
+
+    // without the shim loaded, the command runs main. lrun gives up early
+    // instead of waiting for the real time limit
+    string result = run("lrun --max-real-time 30 --fork-server " TMP "/lrun-t.missing.so --testcase " TMP "/lrun-t0.in " TMP "/lrun-t0.out"
+            " sleep 30 3>&1 2>&1 >/dev/null; echo exit=$?");
+    CHECK(result.find("fork server is not ready") != string::npos);
+    CHECK(result.find("exit=11") != string::npos);
+
+    // a filter which blocks fork fails once, before any testcase
+    result = run(string("lrun --syscalls '!clone' --fork-server ") + shim + " --testcase " TMP "/lrun-t0.in " TMP "/lrun-t0.out"
+            " -- " TMP_EXE " 3>&1 2>&1 >/dev/null; echo exit=$?");
+    CHECK(result.find("fork server can not fork") != string::npos);
+    CHECK(result.find("TESTCASE") == string::npos);
+}
+
+TESTCASE(daemon) {
+    // LRUN_SOCKET: socket of a running `lrun --daemon`, lrunc is in PATH.
+    // skipped if not set
+    if (!getenv("LRUN_SOCKET")) return;
+    string result = run("lrunc -- /bin/true 3>&1 >/dev/null 2>&1; echo exit=$?");
+    CHECK(result.find("EXITCODE 0") != string::npos);
+    CHECK(result.find("exit=0") != string::npos);
+    result = run("lrunc -- /bin/false 3>&1 >/dev/null 2>&1");
+    CHECK(result.find("EXITCODE 1") != string::npos);
+
+    // the job runs in the working directory and environment of lrunc
+    result = run("cd " TMP " && LRUN_T=env-ok lrunc -- /bin/sh -c 'echo $LRUN_T; pwd' 3>/dev/null 2>&1");
+    CHECK(result == "env-ok\n" TMP "\n");
+
+    // and as the user of lrunc
+    CHECK(run("lrunc -- /usr/bin/id -u 3>/dev/null 2>&1") == run("id -u"));
+
+    // lrun argument errors are reported like the setuid lrun
+    result = run("lrunc --max-cpu-time x -- /bin/true 3>/dev/null 2>&1; echo exit=$?");
+    CHECK(result.find("invalid value") != string::npos);
+    CHECK(result.find("exit=1") != string::npos);
+}
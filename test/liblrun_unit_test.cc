@@ -0,0 +1,151 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2012-2015 Jun Wu <quark@zju.edu.cn>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "lib/liblrun.h"
+#include "test.h"
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <sys/wait.h>
+
+static lrun_sandbox *create(const char *name, double cpu_time = 0, double real_time = 0) {
+    lrun_sandbox *sb = lrun_sandbox_create(name);
+    if (!sb) return NULL;
+    lrun_sandbox_set_user(sb, 65534, 65534);
+    struct lrun_limits limits = { cpu_time, real_time, 0, 0 };
+    lrun_sandbox_set_limits(sb, &limits);
+    return sb;
+}
+
+static int wait_result(lrun_sandbox *sb, struct lrun_result *result) {
+    for (;;) {
+        struct pollfd pfd = { lrun_sandbox_fd(sb), POLLIN, 0 };
+        if (pfd.fd < 0 || poll(&pfd, 1, 10000) <= 0) return -1;
+        int e = lrun_sandbox_update(sb, result);
+        if (e != 0) return e;
+    }
+}
+
+TESTCASE(init) {
+    CHECK(lrun_init() == 0);
+    // only the first call does the work
+    CHECK(lrun_init() == 0);
+}
+
+TESTCASE(run_exit_code) {
+    lrun_sandbox *sb = create("testliblrun1");
+    CHECK(sb != NULL);
+    const char *argv[] = {"/bin/sh", "-c", "exit 3", NULL};
+    CHECK(lrun_sandbox_spawn(sb, (char * const *)argv) > 0);
+    struct lrun_result result;
+    CHECK(wait_result(sb, &result) == 1);
+    CHECK(WIFEXITED(result.status) && WEXITSTATUS(result.status) == 3);
+    CHECK(result.exceed == LRUN_EXCEED_NONE);
+    CHECK(lrun_sandbox_fd(sb) == -1);
+    CHECK(lrun_sandbox_update(sb, &result) < 0);
+    lrun_sandbox_destroy(sb);
+}
+
+TESTCASE(spawn_error) {
+    lrun_sandbox *sb = create("testliblrun2");
+    const char *argv[] = {"/nonexistent", NULL};
+    CHECK(lrun_sandbox_spawn(sb, (char * const *)argv) < 0);
+    CHECK(strlen(lrun_sandbox_error(sb)) > 0);
+    // reusable after an error
+    const char *argv2[] = {"/bin/true", NULL};
+    CHECK(lrun_sandbox_spawn(sb, (char * const *)argv2) > 0);
+    struct lrun_result result;
+    CHECK(wait_result(sb, &result) == 1);
+    CHECK(WIFEXITED(result.status) && WEXITSTATUS(result.status) == 0);
+    lrun_sandbox_destroy(sb);
+}
+
+TESTCASE(limits) {
+    lrun_sandbox *sb = create("testliblrun3", 0.2, 0);
+    const char *cpu_argv[] = {"/bin/sh", "-c", "while :; do :; done", NULL};
+    CHECK(lrun_sandbox_spawn(sb, (char * const *)cpu_argv) > 0);
+    struct lrun_result result;
+    CHECK(wait_result(sb, &result) == 1);
+    CHECK(result.exceed == LRUN_EXCEED_CPU_TIME);
+
+    struct lrun_limits limits = { 0, 0.2, 0, 0 };
+    lrun_sandbox_set_limits(sb, &limits);
+    const char *sleep_argv[] = {"/bin/sleep", "10", NULL};
+    CHECK(lrun_sandbox_spawn(sb, (char * const *)sleep_argv) > 0);
+    CHECK(wait_result(sb, &result) == 1);
+    CHECK(result.exceed == LRUN_EXCEED_REAL_TIME);
+    CHECK(result.cpu_time < 0.2);
+    lrun_sandbox_destroy(sb);
+}
+
+TESTCASE(concurrent) {
+    // a short command finishes while a long one is still running
+    lrun_sandbox *sb1 = create("testliblrun4", 0, 2);
+    lrun_sandbox *sb2 = create("testliblrun5");
+    const char *argv1[] = {"/bin/sleep", "1", NULL};
+    const char *argv2[] = {"/bin/true", NULL};
+    CHECK(lrun_sandbox_spawn(sb1, (char * const *)argv1) > 0);
+    CHECK(lrun_sandbox_spawn(sb2, (char * const *)argv2) > 0);
+    struct lrun_result result;
+    CHECK(wait_result(sb2, &result) == 1);
+    CHECK(lrun_sandbox_update(sb1, &result) == 0);
+    CHECK(wait_result(sb1, &result) == 1);
+    CHECK(WIFEXITED(result.status) && result.exceed == LRUN_EXCEED_NONE);
+    CHECK(result.real_time >= 1);
+    lrun_sandbox_destroy(sb1);
+    lrun_sandbox_destroy(sb2);
+}
+
+static void run_in_thread(const char *name, int runs, std::atomic<int> *passed) {
+    lrun_sandbox *sb = create(name);
+    const char *argv[] = {"/bin/true", NULL};
+    struct lrun_result result;
+    for (int i = 0; i < runs; ++i) {
+        if (lrun_sandbox_spawn(sb, (char * const *)argv) > 0 && wait_result(sb, &result) == 1
+                && WIFEXITED(result.status) && WEXITSTATUS(result.status) == 0) {
+            ++*passed;
+        }
+    }
+    lrun_sandbox_destroy(sb);
+}
+
+static void allocate_until(std::atomic<bool> *done) {
+    while (!*done) free(malloc(1 + rand() % 4096));
+}
+
+TESTCASE(threads) {
+    // sandboxes are used from several threads while another one keeps
+    // taking the malloc lock
+    const char *names[] = {"testliblrun6", "testliblrun7", "testliblrun8"};
+    const int RUNS = 10;
+    std::atomic<int> passed(0);
+    std::atomic<bool> done(false);
+    std::thread allocator(allocate_until, &done);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 3; ++i) threads.push_back(std::thread(run_in_thread, names[i], RUNS, &passed));
+    for (size_t i = 0; i < threads.size(); ++i) threads[i].join();
+    done = true;
+    allocator.join();
+    CHECK(passed == 3 * RUNS);
+}
@@ -0,0 +1,83 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2012-2015 Jun Wu <quark@zju.edu.cn>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "test.h"
+#include "options/options.h"
+
+using namespace lrun::options;
+using std::string;
+using std::vector;
+
+static limits defaults = { 1, 2, 64000000, -1 };
+
+static int parse(const string& content, vector<batch_item>& items, string& error, bool has_command = true) {
+    items.clear();
+    error.clear();
+    return parse_batch_manifest(content, defaults, has_command, items, error);
+}
+
+TESTCASE(limit_options) {
+    limits l = defaults;
+    string error;
+    CHECK(parse_limit("max-cpu-time", "1.5", l, error) == 0 && l.cpu_time == 1.5);
+    CHECK(parse_limit("max-real-time", "0", l, error) == 0 && l.real_time == 0);
+    CHECK(parse_limit("max-memory", "32m", l, error) == 0 && l.memory == 32 * 1024 * 1024);
+    CHECK(parse_limit("max-output", "1k", l, error) == 0 && l.output == 1024);
+    CHECK(parse_limit("max-memory", "1000", l, error) == 0 && l.memory == 500000);
+    CHECK(parse_limit("max-nprocess", "1", l, error) == 1);
+    CHECK(parse_limit("max-cpu-time", "1s", l, error) == -1 && !error.empty());
+    CHECK(parse_limit("max-cpu-time", "-1", l, error) == -1);
+    CHECK(parse_limit("max-output", "-1k", l, error) == -1);
+    CHECK(parse_limit("max-memory", "lots", l, error) == -1);
+    CHECK(l.cpu_time == 1.5 && l.output == 1024);
+}
+
+TESTCASE(manifest_items) {
+    vector<batch_item> items;
+    string error;
+    CHECK(parse("# comment\n\n--stdin 1.in --stdout 1.out\n  --max-cpu-time 3 --max-memory 128m -- ./b x\r\n", items, error) == 0);
+    CHECK(items.size() == 2);
+    CHECK(items[0].stdin_path == "1.in" && items[0].stdout_path == "1.out");
+    CHECK(items[0].args.empty());
+    CHECK(items[0].limits.cpu_time == 1 && items[0].limits.memory == 64000000);
+    CHECK(items[1].limits.cpu_time == 3 && items[1].limits.real_time == 2);
+    CHECK(items[1].limits.memory == 128 * 1024 * 1024);
+    CHECK(items[1].args.size() == 2 && items[1].args[0] == "./b" && items[1].args[1] == "x");
+}
+
+TESTCASE(manifest_errors) {
+    vector<batch_item> items;
+    string error;
+    CHECK(parse("--stdin a\n--max-cpu-time x\n", items, error) == -1);
+    CHECK(error.find("line 2: ") == 0);
+    CHECK(parse("--max-memory -5\n", items, error) == -1);
+    CHECK(error.find("line 1: ") == 0);
+    CHECK(parse("\n#\n--chroot /\n", items, error) == -1);
+    CHECK(error == "line 3: unknown option --chroot");
+    CHECK(parse("--stdin\n", items, error) == -1);
+    CHECK(error == "line 1: --stdin requires an argument");
+    CHECK(parse("./a\n", items, error) == -1);
+    CHECK(error.find("line 1: unexpected") == 0);
+    CHECK(parse("--stdin a\n", items, error, false) == -1);
+    CHECK(error == "line 1: command is missing");
+    CHECK(parse("--stdin a -- ./a\n", items, error, false) == 0 && items.size() == 1);
+}
@@ -0,0 +1,74 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2012-2015 Jun Wu <quark@zju.edu.cn>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "test.h"
+#include "utils/stats.h"
+
+using std::vector;
+
+TESTCASE(summarize) {
+    double samples[] = {3, 1, 4, 1, 5, 9, 2, 6, 5, 3};
+    vector<double> values(samples, samples + 10);
+    stats::summary s = stats::summarize(values);
+    CHECK(s.min == 1);
+    CHECK(s.max == 9);
+    CHECK(s.median == 3);
+    CHECK(s.p95 == 9);
+    CHECK(s.mean == 3.9);
+    CHECK(s.stddev > 2.46 && s.stddev < 2.47);
+
+    s = stats::summarize(vector<double>(1, 2));
+    CHECK(s.median == 2 && s.stddev == 0);
+}
+
+TESTCASE(statistic) {
+    CHECK(stats::is_statistic("median"));
+    CHECK(stats::is_statistic("p95"));
+    CHECK(!stats::is_statistic("p50"));
+    CHECK(!stats::is_statistic(""));
+
+    stats::summary s = stats::summarize(vector<double>(3, 1.5));
+    CHECK(stats::get(s, "mean") == 1.5);
+}
+
+TESTCASE(decide) {
+    vector<double> values;
+    CHECK(stats::decide(values, 5, "median", 1) == -1);
+
+    // median of 5 is the 3rd smallest
+    values.push_back(1);
+    values.push_back(1);
+    CHECK(stats::decide(values, 5, "median", 1) == -1);
+    values.push_back(1);
+    CHECK(stats::decide(values, 5, "median", 1) == 1);
+    CHECK(stats::decide(values, 5, "max", 1) == 1);
+    CHECK(stats::decide(values, 5, "min", 1) == -1);
+    CHECK(stats::decide(values, 5, "mean", 1) == -1);
+    CHECK(stats::decide(values, 3, "mean", 1) == 1);
+
+    values.assign(3, 0.5);
+    CHECK(stats::decide(values, 5, "median", 1) == 0);
+    CHECK(stats::decide(values, 5, "min", 1) == 0);
+    CHECK(stats::decide(values, 5, "mean", 1) == 0);
+    CHECK(stats::decide(values, 5, "max", 1) == -1);
+    CHECK(stats::decide(values, 5, "p95", 1) == -1);
+}
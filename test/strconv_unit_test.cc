@@ -59,3 +59,34 @@ TESTCASE(to_bytes) {
     CHECK(to_bytes("0.5mb") == 524288);
     CHECK(to_bytes("0.5GB") == 536870912);
 }
+
+TESTCASE(int_list) {
+    std::vector<int> cpus = to_int_list("0-2,8,5\n");
+    CHECK(cpus.size() == 5);
+    CHECK(cpus[3] == 5);
+    CHECK(from_int_list(cpus) == "0-2,5,8");
+    CHECK(to_int_list("3,2-3").size() == 2);
+    CHECK(to_int_list("").empty());
+    CHECK(to_int_list("1-").empty());
+    CHECK(to_int_list("3-1").empty());
+    CHECK(to_int_list("a").empty());
+    CHECK(from_int_list(std::vector<int>()) == "");
+}
+
+TESTCASE(is_number) {
+    CHECK(is_double("1.5"));
+    CHECK(is_double("-2"));
+    CHECK(!is_double(""));
+    CHECK(!is_double("abc"));
+    CHECK(!is_double("1s"));
+    CHECK(!is_double(" 1"));
+    CHECK(!is_double("inf"));
+    CHECK(is_bytes("64m"));
+    CHECK(is_bytes("0.5GB"));
+    CHECK(is_bytes("1024"));
+    CHECK(is_bytes("2b"));
+    CHECK(!is_bytes("m"));
+    CHECK(!is_bytes("abc"));
+    CHECK(!is_bytes("1x"));
+    CHECK(!is_bytes("1mm"));
+}
@@ -0,0 +1,30 @@
+#!/bin/bash
+# Compare wall time of many short jobs run by a setuid lrun and by lrunc
+# against `lrun --daemon`. Requires root.
+#
+# Usage: LRUN=path/to/lrun LRUNC=path/to/lrunc JOBS=200 PARALLEL=8 ./daemon.sh
+
+LRUN=${LRUN:-lrun}
+LRUNC=${LRUNC:-lrunc}
+JOBS=${JOBS:-200}
+PARALLEL=${PARALLEL:-8}
+OPTS="--uid 65534 --gid 65534 --max-cpu-time 1"
+export LRUN_SOCKET=${LRUN_SOCKET:-/tmp/lrun-bench.sock}
+
+bench() {
+    local name="$1"
+    shift
+    local start=$(date +%s.%N)
+    seq "$JOBS" | xargs -P "$PARALLEL" -I{} "$@" $OPTS -- /bin/true 3>/dev/null
+    local end=$(date +%s.%N)
+    awk -v name="$name" -v s="$start" -v e="$end" -v n="$JOBS" \
+        'BEGIN { printf "%-8s %4d jobs  %7.3fs  %7.2f jobs/s\n", name, n, e - s, n / (e - s) }'
+}
+
+"$LRUN" --daemon "$LRUN_SOCKET" --cgroup-pool "$PARALLEL" &
+DAEMON=$!
+trap 'kill $DAEMON; wait $DAEMON' EXIT
+while [ ! -S "$LRUN_SOCKET" ]; do sleep 0.1; done
+
+bench lrun  "$LRUN"
+bench lrunc "$LRUNC"
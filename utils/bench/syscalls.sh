@@ -0,0 +1,28 @@
+#!/bin/bash
+# Count syscalls made by the lrun supervisor process (children are not
+# counted) for some typical runs. Requires root.
+#
+# Usage: LRUN=path/to/lrun ./syscalls.sh
+
+LRUN=${LRUN:-lrun}
+SYSCOUNT=$(dirname "$0")/syscount
+OPTS="--uid 65534 --gid 65534"
+
+bench() {
+    local name="$1"
+    shift
+    # syscall numbers (x86_64): 0 read, 1 write, 2 open, 4 stat, 5 fstat,
+    # 6 lstat, 17 pread64, 257 openat, 262 newfstatat
+    "$SYSCOUNT" "$LRUN" $OPTS "$@" 3>/dev/null 2>&1 >/dev/null | awk -v name="$name" '
+        $1 == "total" { total = $2 }
+        $1 == 0 { rd += $2 } $1 == 17 { rd += $2 }
+        $1 == 2 || $1 == 257 { op += $2 }
+        $1 == 4 || $1 == 5 || $1 == 6 || $1 == 262 { st += $2 }
+        END { printf "%-12s total %6d  open %5d  read %5d  stat %5d\n", name, total, op, rd, st }'
+}
+
+bench true         -- /bin/true
+bench sleep        --max-real-time 0.5 -- /bin/sleep 1
+bench cpu          --max-cpu-time 1 -- /bin/sh -c 'while :; do :; done'
+bench memory       --max-memory 32m -- /bin/sh -c 'a=x; while :; do a=$a$a; done'
+bench output       --max-output 100000000 -- /bin/sh -c 'i=0; while [ $i -lt 20000 ]; do echo $i; i=$((i+1)); done'
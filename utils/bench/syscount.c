@@ -0,0 +1,106 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2012-2015 Jun Wu <quark@zju.edu.cn>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+// Count syscalls made by a process (not its children) using ptrace.
+// Usage: syscount command [args...]
+// Prints "total <n>" and per syscall number counts to stderr.
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef __x86_64__
+# error "only x86_64 is supported"
+#endif
+
+#define MAX_SYSCALL_NR 1024
+
+static unsigned long counts[MAX_SYSCALL_NR];
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s command [args...]\n", argv[0]);
+        return 1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+
+    if (pid == 0) {
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        raise(SIGSTOP);
+        execvp(argv[1], argv + 1);
+        perror("execvp");
+        _exit(127);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    // do not count syscalls in the tracee before exec
+    ptrace(PTRACE_SETOPTIONS, pid, NULL, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL);
+
+    int execed = 0, in_syscall = 0, sig = 0;
+    unsigned long total = 0;
+
+    for (;;) {
+        ptrace(PTRACE_SYSCALL, pid, NULL, sig);
+        sig = 0;
+        if (waitpid(pid, &status, 0) < 0) break;
+        if (WIFEXITED(status) || WIFSIGNALED(status)) break;
+        if (!WIFSTOPPED(status)) continue;
+
+        if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+            // syscall enter or exit
+            in_syscall = !in_syscall;
+            if (!in_syscall || !execed) continue;
+            struct user_regs_struct regs;
+            if (ptrace(PTRACE_GETREGS, pid, NULL, &regs)) continue;
+            unsigned long nr = regs.orig_rax;
+            if (nr < MAX_SYSCALL_NR) ++counts[nr];
+            ++total;
+        } else if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_EXEC << 8))) {
+            execed = 1;
+            // the exec syscall exit stop follows
+        } else {
+            // deliver other signals
+            sig = WSTOPSIG(status);
+            if (sig == SIGSTOP || sig == SIGTRAP) sig = 0;
+        }
+    }
+
+    fprintf(stderr, "total %lu\n", total);
+    for (int i = 0; i < MAX_SYSCALL_NR; ++i) {
+        if (counts[i]) fprintf(stderr, "%d %lu\n", i, counts[i]);
+    }
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
@@ -0,0 +1,40 @@
+#!/bin/bash
+# Compare cpu time variance of a cpu bound command run by lrun with and
+# without --quiet-machine. Requires root. Run it with other load on the host
+# to see the difference.
+#
+# Usage: LRUN=path/to/lrun RUNS=30 ./variance.sh [command [args...]]
+
+LRUN=${LRUN:-lrun}
+RUNS=${RUNS:-30}
+OPTS="--uid 65534 --gid 65534 --report-format json"
+[ $# -eq 0 ] && set -- awk 'BEGIN { for (i = 0; i < 3000000; ++i) s += i * i }'
+
+# runs of both settings are interleaved, so drift of the host (frequency,
+# steal time, other load) affects them alike
+cpu_time() {
+    "$LRUN" $OPTS "$@" 3>&1 >/dev/null | grep -o '"cpu_time": [0-9.]*' | cut -d' ' -f2
+}
+
+summary() {
+    awk -v name="$1" '
+        { x[NR] = $1; sum += $1 }
+        END {
+            mean = sum / NR
+            for (i = 1; i <= NR; ++i) var += (x[i] - mean) ^ 2
+            sd = sqrt(var / (NR - 1))
+            printf "%-8s %4d runs  mean %.4fs  stddev %.4fs  cv %.2f%%\n", name, NR, mean, sd, sd / mean * 100
+        }' "$2"
+}
+
+DEFAULT_TIMES=$(mktemp)
+QUIET_TIMES=$(mktemp)
+trap 'rm -f "$DEFAULT_TIMES" "$QUIET_TIMES"' EXIT
+
+for i in $(seq "$RUNS"); do
+    cpu_time "$@" >> "$DEFAULT_TIMES"
+    cpu_time --quiet-machine true "$@" >> "$QUIET_TIMES"
+done
+
+summary default "$DEFAULT_TIMES"
+summary quiet "$QUIET_TIMES"
@@ -0,0 +1,183 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2012-2015 Jun Wu <quark@zju.edu.cn>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+// Preloaded by `lrun --fork-server`. Stops the program at __libc_start_main,
+// before constructors and main, then forks a copy per testcase on request.
+// This saves exec and dynamic linking time of each testcase.
+//
+// Protocol over the unix socket in $LRUN_FORK_SERVER_FD:
+//   server -> lrun: "R" once ready
+//   lrun -> server: 1 byte with fds [stdin, stdout, status socket]
+//   server -> lrun: int errno, with a pidfd of the copy (SCM_RIGHTS)
+//   lrun -> copy (status socket): 1 byte, let the copy run main
+//
+// Copies are forked with CLONE_PARENT, so they are children of lrun, which
+// waits for them. Nothing the server sends is trusted: lrun checks that the
+// pidfd refers to its own child in the sandbox.
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdlib.h> // getenv, atoi
+#include <string.h> // strncmp, memcpy, memset
+#include <link.h>   // ElfW
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/syscall.h>
+
+#ifndef __NR_pidfd_open
+# define __NR_pidfd_open 434
+#endif
+
+typedef int (*main_t)(int, char **, char **);
+
+#ifndef __unbounded
+# define __unbounded
+#endif
+
+static const char FD_ENV[] = "LRUN_FORK_SERVER_FD=";
+static const char PRELOAD_ENV[] = "LD_PRELOAD=";
+
+// __libc_start_main takes env from the stack, not from environ
+static void strip_env(char **envp) {
+    char **p = envp;
+    for (; *envp; ++envp) {
+        if (strncmp(*envp, FD_ENV, sizeof(FD_ENV) - 1) == 0) continue;
+        if (strncmp(*envp, PRELOAD_ENV, sizeof(PRELOAD_ENV) - 1) == 0) continue;
+        *(p++) = *envp;
+    }
+    *p = NULL;
+}
+
+static int recv_fds(int sock, int *fds, int nfds) {
+    char buf[1];
+    char control[CMSG_SPACE(sizeof(int) * 3)];
+    struct iovec iov = { buf, sizeof(buf) };
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) <= 0) return -1;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) return -1;
+    if (cmsg->cmsg_len != CMSG_LEN(sizeof(int) * nfds)) return -1;
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * nfds);
+    return 0;
+}
+
+static void send_reply(int sock, int err, int pidfd) {
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { &err, sizeof(err) };
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (pidfd >= 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &pidfd, sizeof(int));
+    }
+    sendmsg(sock, &msg, MSG_NOSIGNAL);
+}
+
+static void redirect(int fd, int target) {
+    if (fd == target) return;
+    if (dup2(fd, target) < 0) _exit(127);
+    close(fd);
+}
+
+// returns only in forked copies
+static void serve(int sock) {
+    for (;;) {
+        int fds[3], pidfd, err;
+        char buf[1];
+        pid_t pid;
+
+        // EOF or unexpected message: lrun is done with us
+        if (recv_fds(sock, fds, 3)) _exit(0);
+
+        // like fork(), but the copy is a child of lrun. there are no other
+        // threads before main, no locks are held
+        pid = (pid_t)syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, NULL, NULL, 0);
+        if (pid == 0) {
+            close(sock);
+            redirect(fds[0], STDIN_FILENO);
+            redirect(fds[1], STDOUT_FILENO);
+            // wait for lrun to reset counters
+            if (read(fds[2], buf, sizeof(buf)) != 1) _exit(127);
+            close(fds[2]);
+            return;
+        }
+
+        close(fds[0]);
+        close(fds[1]);
+        pidfd = pid > 0 ? (int)syscall(__NR_pidfd_open, pid, 0) : -1;
+        err = pidfd < 0 ? errno : 0;
+        send_reply(sock, err, pidfd);
+        if (pidfd >= 0) close(pidfd);
+        close(fds[2]);
+    }
+}
+
+int __libc_start_main(main_t main, int argc,
+    char *__unbounded *__unbounded ubp_av,
+    ElfW(auxv_t) *__unbounded auxvec,
+    __typeof (main) init,
+    void (*fini) (void),
+    void (*rtld_fini) (void), void *__unbounded
+    stack_end)
+{
+    int (*libc_start_main)(main_t main,
+        int,
+        char *__unbounded *__unbounded,
+        ElfW(auxv_t) *,
+        __typeof (main),
+        void (*fini) (void),
+        void (*rtld_fini) (void),
+        void *__unbounded stack_end);
+    const char *fd_str = getenv("LRUN_FORK_SERVER_FD");
+
+    libc_start_main = dlsym(RTLD_NEXT, "__libc_start_main");
+    if (!libc_start_main) exit(-2);
+
+    if (fd_str) {
+        int sock = atoi(fd_str);
+        strip_env(ubp_av + argc + 1);
+        if (send(sock, "R", 1, MSG_NOSIGNAL) == 1) serve(sock);
+    }
+
+    return ((*libc_start_main)(main, argc, ubp_av, auxvec,
+                 init, fini, rtld_fini, stack_end));
+}
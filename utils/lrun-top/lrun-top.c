@@ -0,0 +1,201 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2012-2015 Jun Wu <quark@zju.edu.cn>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+// Show runs published to the lrun status board (lrun --status-board).
+//
+// The board is mapped once. Refreshing only reads memory, so polling it
+// often is cheap. Usage: lrun-top [-1] [-d seconds]
+//   -1          print once and exit, for scripts
+//   -d seconds  refresh interval, default 1
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h> // atof
+#include <string.h> // memcpy, strerror
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../../src/status_board.h"
+
+static const char * const state_names[] = { "idle", "setup", "running", "teardown" };
+
+static double realtime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// retries of read_slot. a writer killed in the middle leaves seq odd
+#define READ_SLOT_RETRIES 1000
+
+// consistent copy of a slot, using its sequence lock.
+// returns 0, or -1 if the slot kept changing or was left in the middle of
+// a write, the copy may be inconsistent then
+static int read_slot(const struct lrun_board_slot *slot, struct lrun_board_slot *copy) {
+    int i;
+    for (i = 0; i < READ_SLOT_RETRIES; ++i) {
+        uint32_t seq = slot->seq;
+        __sync_synchronize();
+        memcpy(copy, (const void *)slot, sizeof(*copy));
+        __sync_synchronize();
+        if ((seq & 1) == 0 && slot->seq == seq) return 0;
+    }
+    return -1;
+}
+
+// start time of a process in clock ticks since boot, field 22 of
+// /proc/<pid>/stat. 0 if unknown
+static unsigned long long process_start_time(pid_t pid) {
+    char path[64], buf[1024], *p;
+    int field;
+    ssize_t len;
+    int fd;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) return 0;
+    buf[len] = '\0';
+
+    // comm (field 2) may contain spaces and ')'
+    p = strrchr(buf, ')');
+    if (!p) return 0;
+    for (field = 3, ++p; field < 22 && *p; ++field) {
+        while (*p == ' ') ++p;
+        while (*p && *p != ' ') ++p;
+    }
+    return strtoull(p, NULL, 10);
+}
+
+// whether the slot owner is alive, not a process reusing its pid
+static int is_owner_alive(const struct lrun_board_slot *slot) {
+    if (kill(slot->pid, 0) && errno == ESRCH) return 0;
+    if (slot->owner_start_pid != slot->pid) return 1;
+    return slot->owner_start_time == process_start_time(slot->pid);
+}
+
+static void format_bytes(char *buf, size_t size, int64_t bytes) {
+    if (bytes < 0) {
+        snprintf(buf, size, "-");
+    } else {
+        snprintf(buf, size, "%.1fM", bytes / 1048576.0);
+    }
+}
+
+static void format_limit(char *buf, size_t size, const char *value, double limit, const char *limit_str) {
+    if (limit > 0) {
+        snprintf(buf, size, "%s/%s", value, limit_str);
+    } else {
+        snprintf(buf, size, "%s", value);
+    }
+}
+
+static void print_board(const struct lrun_board *board) {
+    double time = realtime();
+    int i, count = 0;
+
+    printf("%7s %7s %-16s %-8s %8s %16s %18s %8s %6s %6s\n",
+           "PID", "CHILD", "CGNAME", "STATE", "ELAPSED", "CPU", "MEMORY", "OUTPUT", "RUNS", "AGE");
+    for (i = 0; i < (int)board->slot_count && i < LRUN_BOARD_SLOTS; ++i) {
+        struct lrun_board_slot slot;
+        char cpu[32], cpu_str[16], cpu_limit[16], memory[32], memory_str[16], memory_limit[16], output[16];
+        int stale;
+        if (board->slots[i].pid == 0) continue;
+        stale = read_slot(&board->slots[i], &slot) != 0;
+        if (slot.pid == 0) continue;
+        // left by a killed lrun, the next lrun reuses it
+        if (!stale && !is_owner_alive(&slot)) stale = 1;
+        if (!stale) ++count;
+
+        snprintf(cpu_str, sizeof(cpu_str), "%.2f", slot.cpu_time);
+        snprintf(cpu_limit, sizeof(cpu_limit), "%.2f", slot.cpu_time_limit);
+        format_limit(cpu, sizeof(cpu), cpu_str, slot.cpu_time_limit, cpu_limit);
+        format_bytes(memory_str, sizeof(memory_str), slot.memory);
+        format_bytes(memory_limit, sizeof(memory_limit), slot.memory_limit);
+        format_limit(memory, sizeof(memory), memory_str, (double)slot.memory_limit, memory_limit);
+        format_bytes(output, sizeof(output), slot.output);
+        slot.cgname[sizeof(slot.cgname) - 1] = '\0';
+
+        printf("%7d %7d %-16.16s %-8s %8.2f %16s %18s %8s %6llu %6.1f\n",
+               (int)slot.pid, (int)slot.child_pid, slot.cgname,
+               stale ? "stale" : slot.state < sizeof(state_names) / sizeof(state_names[0]) ? state_names[slot.state] : "?",
+               slot.start_time > 0 ? time - slot.start_time : 0, cpu, memory, output,
+               (unsigned long long)slot.runs, slot.update_time > 0 ? time - slot.update_time : 0);
+    }
+    printf("%d active\n", count);
+}
+
+int main(int argc, char *argv[]) {
+    const struct lrun_board *board;
+    double interval = 1;
+    int once = 0, opt, fd;
+    struct stat st;
+
+    while ((opt = getopt(argc, argv, "1d:")) != -1) {
+        switch (opt) {
+            case '1':
+                once = 1;
+                break;
+            case 'd':
+                interval = atof(optarg);
+                if (interval <= 0) interval = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-1] [-d seconds]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    fd = open(LRUN_BOARD_PATH, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "lrun-top: can not open %s: %s\n", LRUN_BOARD_PATH, strerror(errno));
+        return 1;
+    }
+    // reading beyond the end of the file would be SIGBUS
+    board = fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(*board)
+        ? mmap(NULL, sizeof(*board), PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (board == MAP_FAILED) {
+        fprintf(stderr, "lrun-top: can not map %s: %s\n", LRUN_BOARD_PATH, strerror(errno));
+        return 1;
+    }
+    if (board->magic != LRUN_BOARD_MAGIC || board->version != LRUN_BOARD_VERSION
+            || board->slot_size != sizeof(struct lrun_board_slot)) {
+        fprintf(stderr, "lrun-top: %s has an unknown format\n", LRUN_BOARD_PATH);
+        return 1;
+    }
+
+    for (;;) {
+        // clear the screen
+        if (!once && isatty(STDOUT_FILENO)) printf("\033[H\033[J");
+        print_board(board);
+        fflush(stdout);
+        if (once) return 0;
+        usleep((useconds_t)(interval * 1e6));
+    }
+}
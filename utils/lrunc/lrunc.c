@@ -0,0 +1,140 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2012-2015 Jun Wu <quark@zju.edu.cn>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+// Client of `lrun --daemon`. Runs `lrun args...` in the daemon, with the
+// stdin, stdout, stderr, working directory and environment of this process,
+// as the user of this process.
+//
+// Protocol over the SOCK_SEQPACKET unix socket in $LRUN_SOCKET:
+//   lrunc -> daemon: "lrun\0N\0arg1\0...argN\0KEY=VALUE\0...", N being the
+//                    count of args, with fds [0, 1, 2, cwd] (SCM_RIGHTS).
+//                    at most 65535 bytes
+//   daemon -> lrunc: the lrun report (what lrun writes to fd 3), copied to
+//                    fd 3 if it is open
+//   daemon -> lrunc: "EXIT code\n", the exit code of lrun
+//
+// Closing the socket (ex. killing lrunc) cancels the job.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h> // getenv, atoi, malloc
+#include <string.h> // strlen, strncmp, memcpy, memset, stpcpy
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+extern char **environ;
+
+static const char DEFAULT_SOCKET[] = "/run/lrun.sock";
+static const size_t MAX_REQUEST = 65535;
+
+static int send_request(int sock, const char *buf, size_t len, int cwd) {
+    int fds[4] = { 0, 1, 2, cwd };
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = { (void *)buf, len };
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == (ssize_t)len ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = getenv("LRUN_SOCKET");
+    struct sockaddr_un addr;
+    size_t len = sizeof("lrun");
+    char *request, *p;
+    char buf[65536];
+    int sock, cwd, i;
+    int report_fd = fcntl(3, F_GETFD) == -1 ? -1 : 3;
+
+    if (!path || !*path) path = DEFAULT_SOCKET;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "lrunc: socket path is too long\n");
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+
+    // argc, argv and environ, NUL separated
+    len += snprintf(buf, sizeof(buf), "%d", argc - 1) + 1;
+    for (i = 1; i < argc; ++i) len += strlen(argv[i]) + 1;
+    for (i = 0; environ[i]; ++i) len += strlen(environ[i]) + 1;
+    if (len > MAX_REQUEST) {
+        fprintf(stderr, "lrunc: arguments and environment are too long\n");
+        return 1;
+    }
+    p = request = malloc(len);
+    if (!request) return 1;
+    memcpy(p, "lrun", sizeof("lrun"));
+    p += sizeof("lrun");
+    p = stpcpy(p, buf) + 1;
+    for (i = 1; i < argc; ++i) p = stpcpy(p, argv[i]) + 1;
+    for (i = 0; environ[i]; ++i) p = stpcpy(p, environ[i]) + 1;
+
+    cwd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (cwd < 0) {
+        fprintf(stderr, "lrunc: can not open working directory: %s\n", strerror(errno));
+        return 1;
+    }
+
+    sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+        fprintf(stderr, "lrunc: can not connect to %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    if (send_request(sock, request, len, cwd)) {
+        fprintf(stderr, "lrunc: can not send request: %s\n", strerror(errno));
+        return 1;
+    }
+    free(request);
+    close(cwd);
+
+    for (;;) {
+        ssize_t n = recv(sock, buf, sizeof(buf) - 1, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        if (n > 5 && strncmp(buf, "EXIT ", 5) == 0) {
+            buf[n] = '\0';
+            return atoi(buf + 5);
+        }
+        if (report_fd >= 0 && write(report_fd, buf, n) != n) report_fd = -1;
+    }
+
+    fprintf(stderr, "lrunc: connection closed unexpectedly\n");
+    return 1;
+}